@@ -31,10 +31,85 @@ def plot_per_structure(df, output_dir):
         plt.grid(True)
 
         # Clean filename for saving
-        filename = f"{structure.replace(' ', '_').replace('+', 'plus')}.png"
+        filename = f"{structure.replace(' ', '_').replace('+', 'plus').replace('/', '-')}.png"
         plt.savefig(os.path.join(output_dir, filename))
         plt.close()
 
+def plot_metric_per_structure(df, output_dir, column, ylabel):
+    # Latencies and event counts are only measured for some rows, and missing from files written before they were added
+    if column not in df.columns:
+        return
+    os.makedirs(output_dir, exist_ok=True)
+
+    for structure, group in df.dropna(subset=[column]).groupby('structure'):
+        plt.figure(figsize=(10, 6))
+
+        for thread_level, thread_group in group.groupby('thread_level'):
+            sorted_group = thread_group.sort_values('size')
+            plt.plot(sorted_group['size'] / 1e6, sorted_group[column],
+                     marker='o', label=f'Threads: {thread_level}')
+
+        plt.xlabel("Index Size (in millions)")
+        plt.ylabel(ylabel)
+        plt.title(f"{ylabel} vs Size — {structure}")
+        plt.legend(title="Thread Level")
+        plt.grid(True)
+
+        filename = f"{structure.replace(' ', '_').replace('+', 'plus').replace('/', '-')}_{column}.png"
+        plt.savefig(os.path.join(output_dir, filename))
+        plt.close()
+
+def plot_read_only_comparison(df, output_dir):
+    # The learned index against the structures it could replace for read-only data, a plot per key set and thread count
+    os.makedirs(output_dir, exist_ok=True)
+
+    for keys in ['Dense', 'Sparse']:
+        structures = [f'{keys} Trie', f'{keys} B+ Tree', f'{keys} B+ Tree (frozen)', f'{keys} Learned Index']
+        selected = df[df['structure'].isin(structures)]
+        if not (selected['structure'] == f'{keys} Learned Index').any():
+            continue
+
+        for thread_level, thread_group in selected.groupby('thread_level'):
+            plt.figure(figsize=(10, 6))
+
+            for structure in structures:
+                sorted_group = thread_group[thread_group['structure'] == structure].sort_values('size')
+                if not sorted_group.empty:
+                    plt.plot(sorted_group['size'] / 1e6, sorted_group['Throughput (M q/s)'],
+                             marker='o', label=structure)
+
+            plt.xlabel("Index Size (in millions)")
+            plt.ylabel("Throughput (Million Queries per Second)")
+            plt.title(f"Read-only Structures — {keys} keys, {thread_level} threads")
+            plt.legend(title="Structure")
+            plt.grid(True)
+
+            plt.savefig(os.path.join(output_dir, f"{keys}_read_only_{thread_level}_threads.png"))
+            plt.close()
+
+def plot_bytes_per_key(df, output_dir):
+    # Memory per key of every structure with random lookups, which the same trees of the other query types share
+    if 'bytes_per_key' not in df.columns:
+        return
+    os.makedirs(output_dir, exist_ok=True)
+    selected = df[(df['query_type'] == 'random') & df['bytes_per_key'].notna()]
+    if selected.empty:
+        return
+
+    plt.figure(figsize=(10, 6))
+    for structure, group in selected.groupby('structure'):
+        sorted_group = group.drop_duplicates('size').sort_values('size')
+        plt.plot(sorted_group['size'] / 1e6, sorted_group['bytes_per_key'], marker='o', label=structure)
+
+    plt.xlabel("Index Size (in millions)")
+    plt.ylabel("Bytes per Key")
+    plt.title("Memory Footprint vs Size")
+    plt.legend(title="Structure", fontsize='small')
+    plt.grid(True)
+
+    plt.savefig(os.path.join(output_dir, "bytes_per_key.png"))
+    plt.close()
+
 if __name__ == "__main__":
     if len(sys.argv) < 2:
         print("Usage: python plot_throughput_per_structure.py <data.csv> [output_dir]")
@@ -46,3 +121,10 @@ if __name__ == "__main__":
     df = load_data(filename)
     df = convert_time_to_throughput(df)
     plot_per_structure(df, output_dir)
+    plot_read_only_comparison(df, output_dir)
+    plot_bytes_per_key(df, output_dir)
+    plot_metric_per_structure(df, output_dir, 'p99', "p99 Latency (ns)")
+    # Written with ./app --counters
+    plot_metric_per_structure(df, output_dir, 'llc_misses', "LLC Misses per Query")
+    plot_metric_per_structure(df, output_dir, 'l1d_misses', "L1d Misses per Query")
+    plot_metric_per_structure(df, output_dir, 'dtlb_misses', "dTLB Misses per Query")
@@ -0,0 +1,100 @@
+#include <sys/mman.h>
+
+#include <cstdint>
+
+#include "arena.h"
+
+static constexpr size_t roundUp(const size_t bytes, const size_t align) { return (bytes + align - 1) / align * align; }
+
+Arena::~Arena() {
+    for (void *chunk: chunks)
+        munmap(chunk, chunkBytes);
+}
+
+Arena::FreeList &Arena::freeList(const size_t size) {
+    for (FreeList &list: freeLists) {
+        if (list.size == size)
+            return list;
+    }
+    return freeLists.emplace_back(FreeList{size, nullptr});
+}
+
+void Arena::mapChunk() {
+    // Over-map by one chunk so the chunk can start on a huge page boundary, then trim both ends
+    void *mapped = mmap(nullptr, 2 * chunkBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED)
+        throw std::bad_alloc();
+    const auto base = reinterpret_cast<uintptr_t>(mapped);
+    const uintptr_t aligned = roundUp(base, chunkBytes);
+    if (aligned > base)
+        munmap(mapped, aligned - base);
+    munmap(reinterpret_cast<void *>(aligned + chunkBytes), base + chunkBytes - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void *>(aligned), chunkBytes, MADV_HUGEPAGE);
+#endif
+
+    chunks.push_back(reinterpret_cast<void *>(aligned));
+    cursor = reinterpret_cast<char *>(aligned);
+    end = cursor + chunkBytes;
+}
+
+void *Arena::allocate(size_t bytes) {
+    bytes = roundUp(bytes, blockAlign);
+    std::lock_guard lock(mutex);
+
+    FreeList &list = freeList(bytes);
+    if (list.head) {
+        FreeBlock *block = list.head;
+        list.head = block->next;
+        return block;
+    }
+
+    if (cursor + bytes > end) {
+        if (bytes > chunkBytes)
+            throw std::bad_alloc();
+        mapChunk();
+    }
+
+    void *block = cursor;
+    cursor += bytes;
+    return block;
+}
+
+void Arena::allocateRun(size_t bytes, const std::span<void *> blocks) {
+    bytes = roundUp(bytes, blockAlign);
+    if (bytes > chunkBytes)
+        throw std::bad_alloc();
+    std::lock_guard lock(mutex);
+
+    for (void *&block: blocks) {
+        if (cursor + bytes > end)
+            mapChunk();
+        block = cursor;
+        cursor += bytes;
+    }
+}
+
+void Arena::deallocate(void *block, size_t bytes) {
+    bytes = roundUp(bytes, blockAlign);
+    std::lock_guard lock(mutex);
+
+    FreeList &list = freeList(bytes);
+    const auto freed = static_cast<FreeBlock *>(block);
+    freed->next = list.head;
+    list.head = freed;
+}
+
+size_t Arena::mappedBytes() {
+    std::lock_guard lock(mutex);
+    return chunks.size() * chunkBytes;
+}
+
+size_t Arena::freeBytes() {
+    std::lock_guard lock(mutex);
+    size_t total = end - cursor;
+    for (const FreeList &list: freeLists) {
+        for (const FreeBlock *block = list.head; block; block = block->next)
+            total += list.size;
+    }
+    return total;
+}
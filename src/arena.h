@@ -0,0 +1,73 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Slab allocator owning all nodes of one structure. Nodes are carved from 2 MiB chunks (backed by transparent huge
+// pages where available) in cache-line sized steps, so siblings allocated together sit next to each other, and
+// freed blocks are kept on per-size free lists for reuse. Chunks are first touched by the allocating thread, which
+// places them on that thread's NUMA node. Destroying the arena releases every chunk at once without visiting nodes,
+// so nodes must not need their destructors run. Safe to use from several threads.
+class Arena {
+public:
+    Arena() = default;
+    ~Arena();
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    template<typename T, typename... Args>
+    T *create(Args &&...args) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena memory is released without running destructors");
+        static_assert(alignof(T) <= blockAlign);
+        return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template<typename T>
+    void destroy(T *object) {
+        deallocate(object, sizeof(T));
+    }
+
+    // Raw blocks for nodes whose size is only known at runtime; a block goes back with the size it was taken with.
+    void *allocate(size_t bytes);
+    void deallocate(void *block, size_t bytes);
+    // Fills blocks with that many blocks of bytes each, taken under one lock and laid out back to back except where
+    // they cross into a new chunk, for bulk loaders that build many nodes from several threads. Free lists are left
+    // alone; the blocks go back one by one through deallocate.
+    void allocateRun(size_t bytes, std::span<void *> blocks);
+
+    // Bytes of all chunks mapped so far.
+    size_t mappedBytes();
+    // Of those, the bytes on free lists and at the end of the last chunk, which no node holds.
+    size_t freeBytes();
+
+private:
+    static constexpr size_t blockAlign = 64;
+    static constexpr size_t chunkBytes = 2 << 20;
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    struct FreeList {
+        size_t size;
+        FreeBlock *head;
+    };
+
+    std::mutex mutex;
+    std::vector<void *> chunks;
+    char *cursor = nullptr;
+    char *end = nullptr;
+    std::vector<FreeList> freeLists;
+
+    FreeList &freeList(size_t size);
+    // Starts carving from a fresh chunk. mutex must be held.
+    void mapChunk();
+};
+
+#endif // ARENA_H
@@ -1,201 +1,1278 @@
 #include <algorithm>
+#include <array>
+#include <cstring>
 #include <iostream>
+#include <optional>
 #include <vector>
 
 #include "b_plus_tree.h"
+#include "frozen_b_plus_tree.h"
+#include "node_layout.h"
+#include "parallel_sort.h"
 
 using namespace std;
 
-// const int DEGREE = 3; // degree (t) = Minimum number of children for a node
-// max keys = 2*t - 1
-
-class BPlusTree::Node {
+// Key arrays are padded to whole cache lines, which also keeps them readable for the vector search kernels.
+// A node holds at most capacity keys; inserts split full nodes on their way down, so a parent always has room for
+// the separator of a splitting child.
+//
+// Readers look at nodes that writers may be changing under them, and only trust what they read once the node's
+// version still matches. Every array element is written as a whole word, so such reads are stale, never wild.
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+class BPlusTree<Key, Value, Compare, NodeBytes>::Node {
 public:
+    OptimisticLock lock;
     bool isLeaf;
-    std::vector<uint32_t> keys;
-    std::vector<uint32_t> values;
-    std::vector<Node *> children;
-    Node *next; // for leaves
+    uint16_t count;
 
-    explicit Node(const bool leaf) : isLeaf(leaf), next(nullptr) {}
+    explicit Node(const bool leaf) : isLeaf(leaf), count(0) {}
 };
 
-BPlusTree::BPlusTree(int degree) : degree(degree), root(nullptr) {}
+// Leaves keep their entries in one of several encodings, picked per leaf. Keys are stored as offsets from the leaf's
+// base key in 1, 2 or 4 bytes, or in full. Values are stored as their difference to the key in 0, 1 or 2 bytes (0 when
+// every value equals its key), or as they are. The plain encoding (base 0, full keys and values) is the layout of an
+// uncompressed leaf and the only one for keys and values that are not integers. Narrower ones fit several times as
+// many entries into the same NodeBytes, and their key offsets are searched in place by the narrow vector kernels.
+// capacity is that of the plain encoding, which every other encoding at least matches, so any run of up to capacity
+// entries always fits into one leaf.
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+class BPlusTree<Key, Value, Compare, NodeBytes>::Leaf : public Node {
+public:
+    // Value widths below 4 bytes would be taken for differences
+    static constexpr bool compressible = vectorSearchable<Key, Compare> && std::is_integral_v<Value> &&
+                                         sizeof(Value) >= 4;
+
+    struct Format {
+        Key base;
+        uint8_t keyBytes;
+        uint8_t valueBytes;
+    };
 
-void BPlusTree::insertInternal(uint32_t key, Node *parent, Node *child) {
-    if (!parent) {
-        root = new Node(false);
-        root->keys.push_back(key);
-        root->children.push_back(child);
-        root->children.push_back(nullptr);
-        return;
+    static constexpr int capacity = packedCapacity(NodeBytes, sizeof(Key), sizeof(Value));
+    static constexpr int maxCapacity = compressible ? packedCapacity(NodeBytes, 1, 0) : capacity;
+    static constexpr int minCount = capacity / 4;
+    static constexpr Format plain{Key{}, sizeof(Key), sizeof(Value)};
+
+    Leaf *next;
+    Key base;
+    uint8_t keyBytes;
+    uint8_t valueBytes;
+    alignas(cacheLine) uint8_t data[NodeBytes - cacheLine];
+
+    Leaf() : Node(true), next(nullptr), base(plain.base), keyBytes(plain.keyBytes), valueBytes(plain.valueBytes) {}
+
+    // The entries as a reader sees them. The encoding is read once and the count clamped to what it holds, so while
+    // a writer re-encodes the leaf a reader may get a mix of old and new fields, which validation catches, but never
+    // reads outside the node.
+    class View {
+    public:
+        int count;
+
+        explicit View(const Leaf *leaf) :
+            base(leaf->base), keyBytes(leaf->keyBytes), valueBytes(leaf->valueBytes), keys(leaf->data) {
+            const Geometry &geometry = geometryOf(keyBytes, valueBytes);
+            count = std::min<int>(leaf->count, geometry.capacity);
+            values = keys + geometry.valueOffset;
+        }
+
+        Key key(const int i) const {
+            if constexpr (compressible) {
+                switch (keyBytes) {
+                    case 1:
+                        return base + keys[i];
+                    case 2:
+                        return base + load<uint16_t>(keys + 2 * i);
+                    case 4:
+                        return base + load<uint32_t>(keys + 4 * i);
+                    default:
+                        return base + load<Key>(keys + sizeof(Key) * i);
+                }
+            } else {
+                return load<Key>(keys + sizeof(Key) * i);
+            }
+        }
+
+        Value value(const int i) const {
+            if constexpr (compressible) {
+                switch (valueBytes) {
+                    case 0:
+                        return addDelta<Key, Value>(key(i), 0);
+                    case 1:
+                        return addDelta<Key, Value>(key(i), static_cast<int8_t>(values[i]));
+                    case 2:
+                        return addDelta<Key, Value>(key(i), static_cast<int16_t>(load<uint16_t>(values + 2 * i)));
+                    default:
+                        break;
+                }
+            }
+            return load<Value>(values + sizeof(Value) * i);
+        }
+
+        const uint8_t *valueAddress(const int i) const { return values + i * valueBytes; }
+
+        // Number of keys < key.
+        int lowerBound(const KeySearch search, const Key &key) const {
+            if constexpr (compressible) {
+                if (key < base)
+                    return 0;
+                const Key offset = key - base;
+                switch (keyBytes) {
+                    case 1:
+                        return offset > UINT8_MAX ? count
+                                                  : ::lowerBound(search, keys, count, static_cast<uint8_t>(offset));
+                    case 2:
+                        return offset > UINT16_MAX ? count
+                                                   : ::lowerBound(search, reinterpret_cast<const uint16_t *>(keys),
+                                                                  count, static_cast<uint16_t>(offset));
+                    case 4:
+                        return offset > UINT32_MAX ? count
+                                                   : ::lowerBound(search, reinterpret_cast<const uint32_t *>(keys),
+                                                                  count, static_cast<uint32_t>(offset));
+                    default:
+                        return ::lowerBound(search, reinterpret_cast<const Key *>(keys), count, offset);
+                }
+            } else {
+                return ::lowerBound(search, reinterpret_cast<const Key *>(keys), count, key, Compare{});
+            }
+        }
+
+        // Number of keys <= key.
+        int upperBound(const KeySearch search, const Key &key) const {
+            if constexpr (compressible) {
+                if (key < base)
+                    return 0;
+                const Key offset = key - base;
+                switch (keyBytes) {
+                    case 1:
+                        return offset > UINT8_MAX ? count
+                                                  : ::upperBound(search, keys, count, static_cast<uint8_t>(offset));
+                    case 2:
+                        return offset > UINT16_MAX ? count
+                                                   : ::upperBound(search, reinterpret_cast<const uint16_t *>(keys),
+                                                                  count, static_cast<uint16_t>(offset));
+                    case 4:
+                        return offset > UINT32_MAX ? count
+                                                   : ::upperBound(search, reinterpret_cast<const uint32_t *>(keys),
+                                                                  count, static_cast<uint32_t>(offset));
+                    default:
+                        return ::upperBound(search, reinterpret_cast<const Key *>(keys), count, offset);
+                }
+            } else {
+                return ::upperBound(search, reinterpret_cast<const Key *>(keys), count, key, Compare{});
+            }
+        }
+
+        // Position of key, or -1.
+        int find(const KeySearch search, const Key &key) const {
+            const int idx = lowerBound(search, key);
+            return idx < count && !Compare{}(key, this->key(idx)) ? idx : -1;
+        }
+
+    private:
+        Key base;
+        int keyBytes;
+        int valueBytes;
+        const uint8_t *keys;
+        const uint8_t *values;
+    };
+
+    View view() const { return View(this); }
+
+    // The encoding with the narrowest fields that holds n sorted entries. Without compress, it is the plain one
+    // unless n only fits in a narrower encoding, which only happens to entries taken from a leaf that already has one.
+    static Format formatFor(const Key *keys, const Value *values, const int n, const bool compress) {
+        if constexpr (compressible) {
+            if (n == 0 || (!compress && n <= capacity))
+                return plain;
+            int64_t lowDelta = 0;
+            int64_t highDelta = 0;
+            for (int i = 0; i < n; i++) {
+                const int64_t delta = valueDelta(keys[i], values[i]);
+                lowDelta = std::min(lowDelta, delta);
+                highDelta = std::max(highDelta, delta);
+            }
+            return {keys[0], keyWidth(keys[n - 1] - keys[0]), valueWidth(lowDelta, highDelta)};
+        } else {
+            return plain;
+        }
+    }
+
+    static int capacityOf(const Format format) { return geometryOf(format.keyBytes, format.valueBytes).capacity; }
+
+    // Whether n sorted entries fit into one leaf.
+    static bool fits(const Key *keys, const Value *values, const int n, const bool compress) {
+        return n <= capacityOf(formatFor(keys, values, n, compress));
+    }
+
+    // Copies the entries out in full, returning how many there are. The leaf must not change meanwhile.
+    int decode(Key *keys, Value *values) const {
+        const View entries = view();
+        for (int i = 0; i < entries.count; i++) {
+            keys[i] = entries.key(i);
+            values[i] = entries.value(i);
+        }
+        return entries.count;
     }
 
-    const auto it = ranges::upper_bound(parent->keys, key);
-    const uint32_t idx = it - parent->keys.begin();
-    parent->keys.insert(it, key);
-    parent->children.insert(parent->children.begin() + idx + 1, child);
+    // Replaces the entries with n sorted ones in format, which must hold them.
+    void encode(const Key *keys, const Value *values, const int n, const Format format) {
+        base = format.base;
+        keyBytes = format.keyBytes;
+        valueBytes = format.valueBytes;
+        uint8_t *valueData = data + geometryOf(keyBytes, valueBytes).valueOffset;
+        for (int i = 0; i < n; i++) {
+            storeKey(data, i, keys[i]);
+            storeValue(valueData, i, keys[i], values[i]);
+        }
+        this->count = n;
+    }
 
-    if (parent->keys.size() >= 2 * degree) {
-        splitInternal(parent);
+    // Whether upsert can take the pair without a split.
+    bool accepts(const KeySearch search, const Key &key, const Value &value, const bool compress) const {
+        const View entries = view();
+        const int total = entries.count + (entries.find(search, key) < 0);
+        if (total <= capacity || (holds(key, value) && total <= geometryOf(keyBytes, valueBytes).capacity))
+            return true;
+        if constexpr (compressible) {
+            // Only a different encoding could still make room
+            Key keys[maxCapacity + 1];
+            Value values[maxCapacity + 1];
+            const int n = decodeWith(key, value, keys, values);
+            return fits(keys, values, n, compress);
+        } else {
+            return false;
+        }
+    }
+
+    // Inserts the pair or updates the value of an existing key; accepts() must hold. Entries are shifted in place
+    // while the pair fits the current encoding, otherwise the leaf is re-encoded.
+    void upsert(const KeySearch search, const Key &key, const Value &value, const bool compress) {
+        const View entries = view();
+        const int idx = entries.lowerBound(search, key);
+        const bool present = idx < entries.count && !Compare{}(key, entries.key(idx));
+        const Geometry &geometry = geometryOf(keyBytes, valueBytes);
+        if (holds(key, value) && entries.count + !present <= geometry.capacity) {
+            uint8_t *valueData = data + geometry.valueOffset;
+            if (!present) {
+                memmove(data + (idx + 1) * keyBytes, data + idx * keyBytes, (entries.count - idx) * keyBytes);
+                memmove(valueData + (idx + 1) * valueBytes, valueData + idx * valueBytes,
+                        (entries.count - idx) * valueBytes);
+                storeKey(data, idx, key);
+                this->count++;
+            }
+            storeValue(valueData, idx, key, value);
+            return;
+        }
+
+        Key keys[maxCapacity + 1];
+        Value values[maxCapacity + 1];
+        const int n = decodeWith(key, value, keys, values);
+        encode(keys, values, n, formatFor(keys, values, n, compress));
+    }
+
+    // Removes key if present.
+    bool remove(const KeySearch search, const Key &key) {
+        const View entries = view();
+        const int idx = entries.find(search, key);
+        if (idx < 0)
+            return false;
+        uint8_t *valueData = data + geometryOf(keyBytes, valueBytes).valueOffset;
+        memmove(data + idx * keyBytes, data + (idx + 1) * keyBytes, (entries.count - idx - 1) * keyBytes);
+        memmove(valueData + idx * valueBytes, valueData + (idx + 1) * valueBytes,
+                (entries.count - idx - 1) * valueBytes);
+        this->count--;
+        return true;
+    }
+
+    // Moves the upper half into a new right sibling and returns it; separator is the sibling's first key. Both halves
+    // are re-encoded, which can only make their fields narrower.
+    Leaf *split(Arena &arena, Key &separator, const bool compress) {
+        Key keys[maxCapacity];
+        Value values[maxCapacity];
+        const int n = decode(keys, values);
+        const int midIndex = n / 2;
+
+        const auto sibling = arena.create<Leaf>();
+        sibling->encode(keys + midIndex, values + midIndex, n - midIndex,
+                        formatFor(keys + midIndex, values + midIndex, n - midIndex, compress));
+        sibling->next = next;
+
+        encode(keys, values, midIndex, formatFor(keys, values, midIndex, compress));
+        next = sibling;
+        separator = keys[midIndex];
+        return sibling;
+    }
+
+    // Leaf sizes for bulk loading n sorted entries compressed: each leaf takes entries until fillFactor of what its
+    // encoding holds. A short last leaf is topped up from the one before it.
+    static std::vector<size_t> packedSizes(const Key *keys, const Value *values, const size_t n,
+                                           const double fillFactor) {
+        std::vector<size_t> sizes;
+        if constexpr (compressible) {
+            for (size_t pos = 0; pos < n;) {
+                size_t size = 0;
+                int64_t lowDelta = 0;
+                int64_t highDelta = 0;
+                while (pos + size < n) {
+                    const size_t i = pos + size;
+                    const int64_t delta = valueDelta(keys[i], values[i]);
+                    const int64_t low = std::min(lowDelta, delta);
+                    const int64_t high = std::max(highDelta, delta);
+                    const int limit = static_cast<int>(
+                            geometryOf(keyWidth(keys[i] - keys[pos]), valueWidth(low, high)).capacity * fillFactor);
+                    if (size > 0 && static_cast<int>(size) + 1 > limit)
+                        break;
+                    lowDelta = low;
+                    highDelta = high;
+                    size++;
+                }
+                sizes.push_back(size);
+                pos += size;
+            }
+        }
+
+        if (sizes.size() > 1 && sizes.back() < capacity / 2) {
+            const size_t pair = sizes[sizes.size() - 2] + sizes.back();
+            sizes.back() = std::min<size_t>(pair / 2, capacity / 2);
+            sizes[sizes.size() - 2] = pair - sizes.back();
+        }
+        return sizes;
     }
+
+private:
+    struct Geometry {
+        int capacity;
+        int valueOffset; // where the value array starts in data
+    };
+
+    static constexpr Geometry geometry(const int keyBytes, const int valueBytes) {
+        const int capacity = packedCapacity(NodeBytes, keyBytes, valueBytes);
+        return {capacity, static_cast<int>(lines(capacity * keyBytes))};
+    }
+
+    // Indexed by key bytes and value bytes; only the combinations in use are filled in.
+    static constexpr auto geometries = [] {
+        std::array<std::array<Geometry, 9>, 9> table{};
+        if constexpr (compressible) {
+            for (const int keyBytes: {1, 2, 4, static_cast<int>(sizeof(Key))}) {
+                for (const int valueBytes: {0, 1, 2, static_cast<int>(sizeof(Value))})
+                    table[keyBytes][valueBytes] = geometry(keyBytes, valueBytes);
+            }
+        }
+        return table;
+    }();
+
+    static constexpr Geometry plainGeometry = geometry(sizeof(Key), sizeof(Value));
+
+    static const Geometry &geometryOf(const int keyBytes, const int valueBytes) {
+        if constexpr (compressible)
+            return geometries[keyBytes][valueBytes];
+        else
+            return plainGeometry;
+    }
+
+    template<typename T>
+    static T load(const uint8_t *at) {
+        T word;
+        memcpy(&word, at, sizeof(T));
+        return word;
+    }
+
+    static uint8_t keyWidth(const Key &span) {
+        if constexpr (compressible)
+            return span <= UINT8_MAX ? 1 : span <= UINT16_MAX ? 2 : span <= UINT32_MAX ? 4 : sizeof(Key);
+        else
+            return sizeof(Key);
+    }
+
+    static uint8_t valueWidth(const int64_t lowDelta, const int64_t highDelta) {
+        if (lowDelta == 0 && highDelta == 0)
+            return 0;
+        if (lowDelta >= INT8_MIN && highDelta <= INT8_MAX)
+            return 1;
+        if (lowDelta >= INT16_MIN && highDelta <= INT16_MAX)
+            return 2;
+        return sizeof(Value);
+    }
+
+    // Whether the pair can be stored in the current encoding.
+    bool holds(const Key &key, const Value &value) const {
+        if constexpr (compressible) {
+            if (key < base || (keyBytes < sizeof(Key) && key - base > (Key{1} << 8 * keyBytes) - 1))
+                return false;
+            const int64_t delta = valueDelta(key, value);
+            return valueWidth(std::min<int64_t>(delta, 0), std::max<int64_t>(delta, 0)) <= valueBytes;
+        } else {
+            return true;
+        }
+    }
+
+    void storeKey(uint8_t *keys, const int i, const Key &key) const {
+        if constexpr (compressible) {
+            const Key offset = key - base;
+            memcpy(keys + i * keyBytes, &offset, keyBytes);
+        } else {
+            memcpy(keys + i * sizeof(Key), &key, sizeof(Key));
+        }
+    }
+
+    void storeValue(uint8_t *values, const int i, const Key &key, const Value &value) const {
+        if constexpr (compressible) {
+            if (valueBytes < sizeof(Value)) {
+                const int64_t delta = valueDelta(key, value);
+                memcpy(values + i * valueBytes, &delta, valueBytes);
+                return;
+            }
+        }
+        memcpy(values + i * sizeof(Value), &value, sizeof(Value));
+    }
+
+    // Decodes the entries with the pair inserted or updated, returning how many there are.
+    int decodeWith(const Key &key, const Value &value, Key *keys, Value *values) const {
+        const int n = decode(keys, values);
+        // Searched in the decoded copy: a second look at the leaf may see another count when it is read unlocked
+        const int idx = static_cast<int>(std::lower_bound(keys, keys + n, key, Compare{}) - keys);
+        if (idx < n && !Compare{}(key, keys[idx])) {
+            values[idx] = value;
+            return n;
+        }
+        std::move_backward(keys + idx, keys + n, keys + n + 1);
+        std::move_backward(values + idx, values + n, values + n + 1);
+        keys[idx] = key;
+        values[idx] = value;
+        return n + 1;
+    }
+};
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+class BPlusTree<Key, Value, Compare, NodeBytes>::Inner : public Node {
+public:
+    static constexpr int capacity = fitCapacity(NodeBytes, sizeof(Key), sizeof(Node *), 1);
+    static constexpr int minCount = capacity / 4;
+
+    alignas(cacheLine) Key keys[lines(capacity * sizeof(Key)) / sizeof(Key)];
+    alignas(cacheLine) Node *children[capacity + 1];
+
+    Inner() : Node(false) {}
+
+    // Index of the child whose keys cover key.
+    int childFor(const KeySearch search, const Key &key) const {
+        return upperBound(search, keys, this->count, key, Compare{});
+    }
+
+    // Adds child to the right of the separator key; the node must not be full.
+    void insert(const KeySearch search, const Key &key, Node *child) {
+        const int idx = childFor(search, key);
+        memmove(keys + idx + 1, keys + idx, (this->count - idx) * sizeof(Key));
+        memmove(children + idx + 2, children + idx + 1, (this->count - idx) * sizeof(Node *));
+        keys[idx] = key;
+        children[idx + 1] = child;
+        this->count++;
+    }
+
+    // Drops the separator at idx together with the child to its right.
+    void removeAt(const int idx) {
+        memmove(keys + idx, keys + idx + 1, (this->count - idx - 1) * sizeof(Key));
+        memmove(children + idx + 1, children + idx + 2, (this->count - idx - 1) * sizeof(Node *));
+        this->count--;
+    }
+
+    // Moves the keys and children above the middle key into a new right sibling; the middle key moves up as
+    // separator.
+    Inner *split(Arena &arena, Key &separator) {
+        const int midIndex = this->count / 2;
+        separator = keys[midIndex];
+
+        const auto sibling = arena.create<Inner>();
+        sibling->count = this->count - midIndex - 1;
+        memcpy(sibling->keys, keys + midIndex + 1, sibling->count * sizeof(Key));
+        memcpy(sibling->children, children + midIndex + 1, (sibling->count + 1) * sizeof(Node *));
+
+        this->count = midIndex;
+        return sibling;
+    }
+};
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>::BPlusTree() :
+    root(nullptr), search(KeySearch::Vector), compress(false), arena(make_unique<Arena>()),
+    epochs(make_unique<EpochManager>()) {
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>);
+    static_assert(sizeof(Leaf) <= NodeBytes && sizeof(Inner) <= NodeBytes);
+    static_assert(Leaf::capacity >= 4 && Inner::capacity >= 4, "NodeBytes too small for a B+ tree node");
 }
 
-void BPlusTree::splitInternal(Node *node) {
-    const int midIndex = node->keys.size() / 2;
-    const uint32_t midKey = node->keys[midIndex];
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>::BPlusTree(BPlusTree &&other) noexcept :
+    root(other.root.exchange(nullptr)), search(other.search), compress(other.compress), cache(std::move(other.cache)),
+    arena(std::move(other.arena)), epochs(std::move(other.epochs)) {}
 
-    Node *sibling = new Node(false);
-    sibling->keys.assign(node->keys.begin() + midIndex + 1, node->keys.end());
-    sibling->children.assign(node->children.begin() + midIndex + 1, node->children.end());
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes> &
+BPlusTree<Key, Value, Compare, NodeBytes>::operator=(BPlusTree &&other) noexcept {
+    if (this != &other) {
+        root.store(other.root.exchange(nullptr));
+        search = other.search;
+        compress = other.compress;
+        cache = std::move(other.cache);
+        // The old epoch manager hands its pending nodes back to the old arena, so it has to go first
+        epochs = std::move(other.epochs);
+        arena = std::move(other.arena);
+    }
+    return *this;
+}
 
-    node->keys.resize(midIndex);
-    node->children.resize(midIndex + 1);
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::setKeySearch(const KeySearch mode) {
+    search = mode;
+}
 
-    if (node == root) {
-        const auto newRoot = new Node(false);
-        newRoot->keys.push_back(midKey);
-        newRoot->children.push_back(node);
-        newRoot->children.push_back(sibling);
-        root = newRoot;
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::setLeafCompression(const bool enabled) {
+    compress = enabled && Leaf::compressible;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::setHotKeyCache(const size_t entries) {
+    cache = entries > 0 ? make_unique<HotKeyCache<Key, Value>>(entries) : nullptr;
+}
+
+// Splits node into two and hooks the new sibling into parent, or into a new root if node is the root. The caller
+// holds the write locks of both.
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::splitChild(Node *node, Inner *parent) {
+    Key separator;
+    Node *sibling;
+    if (node->isLeaf)
+        sibling = static_cast<Leaf *>(node)->split(*arena, separator, compress);
+    else
+        sibling = static_cast<Inner *>(node)->split(*arena, separator);
+
+    if (parent) {
+        parent->insert(search, separator, sibling);
     } else {
-        insertInternal(midKey, findParent(root, node), sibling);
+        const auto newRoot = arena->create<Inner>();
+        newRoot->keys[0] = separator;
+        newRoot->children[0] = node;
+        newRoot->children[1] = sibling;
+        newRoot->count = 1;
+        root.store(newRoot, memory_order_release);
     }
 }
 
-void BPlusTree::splitLeaf(Node *leaf) {
-    const uint32_t midIndex = leaf->keys.size() / 2;
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+bool BPlusTree<Key, Value, Compare, NodeBytes>::tryInsert(const Key &key, const Value &value) {
+    Node *node = root.load(memory_order_acquire);
+    if (!node) {
+        const auto leaf = arena->create<Leaf>();
+        leaf->upsert(search, key, value, compress);
+        if (root.compare_exchange_strong(node, leaf))
+            return true;
+        arena->destroy(leaf);
+        return false;
+    }
 
-    const auto sibling = new Node(true);
-    sibling->keys.assign(leaf->keys.begin() + midIndex, leaf->keys.end());
-    sibling->values.assign(leaf->values.begin() + midIndex, leaf->values.end());
+    uint64_t version;
+    if (!node->lock.readLock(version) || node != root.load(memory_order_acquire))
+        return false;
 
-    leaf->keys.resize(midIndex);
-    leaf->values.resize(midIndex);
+    Inner *parent = nullptr;
+    uint64_t parentVersion = 0;
+    while (true) {
+        // Updating a key that is already in a full leaf needs no room, so that case does not split unless the new
+        // value needs a wider encoding
+        const bool full = node->isLeaf ? !static_cast<Leaf *>(node)->accepts(search, key, value, compress)
+                                       : node->count == Inner::capacity;
+        if (full) {
+            if (parent && !parent->lock.upgrade(parentVersion))
+                return false;
+            if (!node->lock.upgrade(version)) {
+                if (parent)
+                    parent->lock.writeUnlock();
+                return false;
+            }
+            if (!parent && node != root.load(memory_order_acquire)) {
+                node->lock.writeUnlock();
+                return false;
+            }
+            splitChild(node, parent);
+            node->lock.writeUnlock();
+            if (parent)
+                parent->lock.writeUnlock();
+            return false;
+        }
+        if (node->isLeaf)
+            break;
 
-    sibling->next = leaf->next;
-    leaf->next = sibling;
+        if (parent && !parent->lock.validate(parentVersion))
+            return false;
+        const auto inner = static_cast<Inner *>(node);
+        parent = inner;
+        parentVersion = version;
+        node = inner->children[inner->childFor(search, key)];
+        if (!inner->lock.validate(version) || !node->lock.readLock(version))
+            return false;
+    }
 
-    if (leaf == root) {
-        const auto newRoot = new Node(false);
-        newRoot->keys.push_back(sibling->keys[0]);
-        newRoot->children.push_back(leaf);
-        newRoot->children.push_back(sibling);
-        root = newRoot;
-    } else {
-        insertInternal(sibling->keys[0], findParent(root, leaf), sibling);
+    const auto leaf = static_cast<Leaf *>(node);
+    if (!leaf->lock.upgrade(version))
+        return false;
+    if (parent && !parent->lock.validate(parentVersion)) {
+        leaf->lock.writeUnlock();
+        return false;
+    }
+    leaf->upsert(search, key, value, compress);
+    leaf->lock.writeUnlock();
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::insert(const Key &key, const Value &value) {
+    EpochManager::Guard guard(*epochs);
+    while (!tryInsert(key, value)) {
     }
+    if (cache)
+        cache->invalidate(key);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::reclaim(void *node, void *arena) {
+    const auto retired = static_cast<Node *>(node);
+    if (retired->isLeaf)
+        static_cast<Arena *>(arena)->destroy(static_cast<Leaf *>(retired));
+    else
+        static_cast<Arena *>(arena)->destroy(static_cast<Inner *>(retired));
 }
 
-BPlusTree::Node *BPlusTree::findParent(Node *current, Node *child) {
-    if (current->isLeaf)
+// Merges right into left when both fit into one node, dropping their separator at idx from parent, and otherwise
+// shares their entries out evenly. The caller holds the write locks of all three. Returns right if it was merged
+// away, nullptr otherwise.
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::Node *
+BPlusTree<Key, Value, Compare, NodeBytes>::rebalance(Inner *parent, const int idx, Node *left, Node *right) {
+    if (left->isLeaf) {
+        const auto l = static_cast<Leaf *>(left);
+        const auto r = static_cast<Leaf *>(right);
+        Key keys[2 * Leaf::maxCapacity];
+        Value values[2 * Leaf::maxCapacity];
+        const int leftCount = l->decode(keys, values);
+        const int total = leftCount + r->decode(keys + leftCount, values + leftCount);
+        if (compress ? Leaf::fits(keys, values, total, true) : total <= Leaf::capacity) {
+            l->encode(keys, values, total, Leaf::formatFor(keys, values, total, compress));
+            l->next = r->next;
+            parent->removeAt(idx);
+            return r;
+        }
+
+        // Cut in the middle, unless one half would then need wider fields than leave it room. The smaller node then
+        // only gets topped up to half of the plain capacity, which fits any entries, and the other keeps a part of
+        // what it had, which fits as before.
+        int cut = total / 2;
+        if (!Leaf::fits(keys, values, cut, compress) || !Leaf::fits(keys + cut, values + cut, total - cut, compress))
+            cut = leftCount < total - leftCount ? Leaf::capacity / 2 : total - Leaf::capacity / 2;
+        r->encode(keys + cut, values + cut, total - cut, Leaf::formatFor(keys + cut, values + cut, total - cut, compress));
+        l->encode(keys, values, cut, Leaf::formatFor(keys, values, cut, compress));
+        parent->keys[idx] = keys[cut];
         return nullptr;
+    }
 
-    for (const auto c: current->children) {
-        if (c == child)
-            return current;
-        if (Node *p = findParent(c, child))
-            return p;
+    const auto l = static_cast<Inner *>(left);
+    const auto r = static_cast<Inner *>(right);
+    if (l->count + 1 + r->count <= Inner::capacity) {
+        // The separator comes down between the two halves
+        l->keys[l->count] = parent->keys[idx];
+        memcpy(l->keys + l->count + 1, r->keys, r->count * sizeof(Key));
+        memcpy(l->children + l->count + 1, r->children, (r->count + 1) * sizeof(Node *));
+        l->count += 1 + r->count;
+        parent->removeAt(idx);
+        return r;
     }
+
+    // Rotate through the parent: line up both nodes and their separator, then cut the sequence in the middle again
+    Key keys[2 * Inner::capacity + 1];
+    Node *children[2 * Inner::capacity + 2];
+    const int total = l->count + 1 + r->count;
+    memcpy(keys, l->keys, l->count * sizeof(Key));
+    keys[l->count] = parent->keys[idx];
+    memcpy(keys + l->count + 1, r->keys, r->count * sizeof(Key));
+    memcpy(children, l->children, (l->count + 1) * sizeof(Node *));
+    memcpy(children + l->count + 1, r->children, (r->count + 1) * sizeof(Node *));
+
+    const int leftCount = total / 2;
+    memcpy(l->keys, keys, leftCount * sizeof(Key));
+    memcpy(l->children, children, (leftCount + 1) * sizeof(Node *));
+    l->count = leftCount;
+    parent->keys[idx] = keys[leftCount];
+    r->count = total - leftCount - 1;
+    memcpy(r->keys, keys + leftCount + 1, r->count * sizeof(Key));
+    memcpy(r->children, children + leftCount + 1, (r->count + 1) * sizeof(Node *));
     return nullptr;
 }
 
-void BPlusTree::insert(const uint32_t key, const uint32_t value) {
-    if (!root) {
-        root = new Node(true);
-        root->keys.push_back(key);
-        root->values.push_back(value);
-        return;
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+bool BPlusTree<Key, Value, Compare, NodeBytes>::tryErase(const Key &key, bool &erased) {
+    Node *node = root.load(memory_order_acquire);
+    if (!node) {
+        erased = false;
+        return true;
     }
 
-    Node *current = root;
-    while (!current->isLeaf) {
-        auto it = ranges::upper_bound(current->keys, key);
-        const uint32_t idx = it - current->keys.begin();
-        current = current->children[idx];
-    }
+    uint64_t version;
+    if (!node->lock.readLock(version) || node != root.load(memory_order_acquire))
+        return false;
 
-    // Find position for insertion
-    const auto it = ranges::lower_bound(current->keys, key);
-    const uint32_t idx = it - current->keys.begin();
+    while (!node->isLeaf) {
+        const auto inner = static_cast<Inner *>(node);
+        const int idx = inner->childFor(search, key);
+        Node *child = inner->children[idx];
+        // Validated again once the child's version is read, or a split of the child in between could send the erase
+        // to a leaf that no longer holds the key
+        uint64_t childVersion;
+        if (!inner->lock.validate(version) || !child->lock.readLock(childVersion) || !inner->lock.validate(version))
+            return false;
 
-    // Update value if key already exists
-    if (it != current->keys.end() && *it == key) {
-        current->values[idx] = value;
-        return;
+        // Top up a child that could not spare an entry before going into it, pairing it with its right neighbour
+        // (or its left one when it is the last child), then start over
+        if (child->count <= (child->isLeaf ? Leaf::minCount : Inner::minCount)) {
+            if (!inner->lock.upgrade(version))
+                return false;
+            if (!child->lock.upgrade(childVersion)) {
+                inner->lock.writeUnlock();
+                return false;
+            }
+            const int left = idx < inner->count ? idx : idx - 1;
+            Node *sibling = inner->children[left == idx ? idx + 1 : idx - 1];
+            if (!sibling->lock.writeLock()) {
+                child->lock.writeUnlock();
+                inner->lock.writeUnlock();
+                return false;
+            }
+
+            Node *leftNode = left == idx ? child : sibling;
+            Node *merged = rebalance(inner, left, leftNode, left == idx ? sibling : child);
+            if (merged && inner->count == 0 && inner == root.load(memory_order_relaxed)) {
+                // The root gave its last separator to the merge, so the merged node takes its place
+                root.store(leftNode, memory_order_release);
+                inner->lock.writeUnlockObsolete();
+                epochs->retire(inner, reclaim, arena.get());
+            } else {
+                inner->lock.writeUnlock();
+            }
+            leftNode->lock.writeUnlock();
+            if (merged) {
+                merged->lock.writeUnlockObsolete();
+                epochs->retire(merged, reclaim, arena.get());
+            } else {
+                (leftNode == child ? sibling : child)->lock.writeUnlock();
+            }
+            return false;
+        }
+
+        node = child;
+        version = childVersion;
     }
 
-    // Insert new key-value pair
-    current->keys.insert(it, key);
-    current->values.insert(current->values.begin() + idx, value);
+    const auto leaf = static_cast<Leaf *>(node);
+    if (!leaf->lock.upgrade(version))
+        return false;
+    erased = leaf->remove(search, key);
+    leaf->lock.writeUnlock();
+    return true;
+}
 
-    if (current->keys.size() >= 2 * degree) {
-        splitLeaf(current);
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+bool BPlusTree<Key, Value, Compare, NodeBytes>::erase(const Key &key) {
+    EpochManager::Guard guard(*epochs);
+    bool erased;
+    while (!tryErase(key, erased)) {
     }
+    if (erased && cache)
+        cache->invalidate(key);
+    return erased;
 }
 
-uint32_t BPlusTree::query(const uint32_t key) const {
-    if (!root)
-        return 0;
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+bool BPlusTree<Key, Value, Compare, NodeBytes>::descend(const Key &key, const Leaf *&leaf, uint64_t &version) const {
+    leaf = nullptr;
+    const Node *node = root.load(memory_order_acquire);
+    if (!node)
+        return true;
+    if (!node->lock.readLock(version) || node != root.load(memory_order_acquire))
+        return false;
 
-    Node *current = root;
-    while (!current->isLeaf) {
-        auto it = ranges::upper_bound(current->keys, key);
-        const uint32_t idx = it - current->keys.begin();
-        current = current->children[idx];
+    while (!node->isLeaf) {
+        const auto inner = static_cast<const Inner *>(node);
+        node = inner->children[inner->childFor(search, key)];
+        // The child pointer is only safe to follow once the parent is known not to have changed, and the child's
+        // version only counts if the parent still has not changed after it was read: a split of the child in between
+        // would leave keys in a new sibling the parent now points to instead
+        uint64_t childVersion;
+        if (!inner->lock.validate(version) || !node->lock.readLock(childVersion) || !inner->lock.validate(version))
+            return false;
+        version = childVersion;
     }
+    leaf = static_cast<const Leaf *>(node);
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+Value BPlusTree<Key, Value, Compare, NodeBytes>::query(const Key &key) const {
+    Value value;
+    uint32_t ticket = 1; // odd, so fill would ignore it had lookup not set it
+    if (cache && cache->lookup(key, value, ticket))
+        return value;
+
+    {
+        EpochManager::Guard guard(*epochs);
+        while (true) {
+            const Leaf *leaf;
+            uint64_t version;
+            if (!descend(key, leaf, version))
+                continue;
+            if (!leaf) {
+                value = Value{};
+                break;
+            }
 
-    const auto it = ranges::lower_bound(current->keys, key);
-    const uint32_t idx = it - current->keys.begin();
+            const auto entries = leaf->view();
+            const int idx = entries.find(search, key);
+            value = idx >= 0 ? entries.value(idx) : Value{}; // Value{} if key not found
 
-    if (it != current->keys.end() && *it == key) {
-        return current->values[idx];
+            if (leaf->lock.validate(version))
+                break;
+        }
     }
+    if (cache)
+        cache->fill(key, value, ticket);
+    return value;
+}
+
+// Keys looked up together by queryBatch. Enough to keep the core's outstanding misses busy, few enough that a group's
+// nodes stay in L1 between passes.
+static constexpr size_t batchGroup = 16;
 
-    return 0; // Return 0 if key not found
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::prefetch(const Node *node) {
+    // The header and the key array are all a search reads before picking a child or a slot
+    constexpr size_t bytes = cacheLine + lines(std::max(Leaf::capacity, Inner::capacity) * sizeof(Key));
+    for (size_t offset = 0; offset < bytes; offset += cacheLine)
+        __builtin_prefetch(reinterpret_cast<const char *>(node) + offset);
 }
 
-void BPlusTree::display() const {
-    if (!root)
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::queryBatch(const std::span<const Key> keys,
+                                                           const std::span<Value> out) const {
+    EpochManager::Guard guard(*epochs);
+    for (size_t first = 0; first < keys.size(); first += batchGroup) {
+        const size_t size = std::min(batchGroup, keys.size() - first);
+        const Key *groupKeys = keys.data() + first;
+        Value *groupOut = out.data() + first;
+
+        const Node *start = root.load(memory_order_acquire);
+        uint64_t rootVersion;
+        if (!start) {
+            std::fill_n(groupOut, size, Value{});
+            continue;
+        }
+        if (!start->lock.readLock(rootVersion) || start != root.load(memory_order_acquire)) {
+            for (size_t i = 0; i < size; i++)
+                groupOut[i] = query(groupKeys[i]);
+            continue;
+        }
+
+        // A key whose node changed underneath it drops out of the group (nodes[i] = nullptr) and is looked up on its
+        // own instead.
+        const Node *nodes[batchGroup];
+        uint64_t versions[batchGroup];
+        const Inner *parents[batchGroup];
+        uint64_t parentVersions[batchGroup];
+        std::optional<typename Leaf::View> views[batchGroup];
+        int positions[batchGroup];
+        std::fill_n(nodes, size, start);
+        std::fill_n(versions, size, rootVersion);
+        auto fallBack = [&](const size_t i) {
+            groupOut[i] = query(groupKeys[i]);
+            nodes[i] = nullptr;
+        };
+
+        // One level per pass: pick every key's child and prefetch it, then read the children's versions, by which
+        // time the first prefetches have landed. As in descend, a child's version only counts if its parent still
+        // has not changed after it was read.
+        bool descended = true;
+        while (descended) {
+            descended = false;
+            for (size_t i = 0; i < size; i++) {
+                parents[i] = nullptr;
+                if (!nodes[i] || nodes[i]->isLeaf)
+                    continue;
+                const auto inner = static_cast<const Inner *>(nodes[i]);
+                const Node *child = inner->children[inner->childFor(search, groupKeys[i])];
+                if (!inner->lock.validate(versions[i])) {
+                    fallBack(i);
+                    continue;
+                }
+                prefetch(child);
+                parents[i] = inner;
+                parentVersions[i] = versions[i];
+                nodes[i] = child;
+                descended = true;
+            }
+            if (!descended)
+                break;
+            for (size_t i = 0; i < size; i++) {
+                if (parents[i] &&
+                    (!nodes[i]->lock.readLock(versions[i]) || !parents[i]->lock.validate(parentVersions[i])))
+                    fallBack(i);
+            }
+        }
+
+        // Same for the leaves: search the keys and prefetch the value, then read it through the same view, whose
+        // encoding the position belongs to, and validate
+        for (size_t i = 0; i < size; i++) {
+            if (!nodes[i])
+                continue;
+            const auto &entries = views[i].emplace(static_cast<const Leaf *>(nodes[i]));
+            positions[i] = entries.find(search, groupKeys[i]);
+            if (positions[i] >= 0)
+                __builtin_prefetch(entries.valueAddress(positions[i]));
+        }
+        for (size_t i = 0; i < size; i++) {
+            if (!nodes[i])
+                continue;
+            const Value value = positions[i] >= 0 ? views[i]->value(positions[i]) : Value{};
+            if (nodes[i]->lock.validate(versions[i]))
+                groupOut[i] = value;
+            else
+                fallBack(i);
+        }
+    }
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::display() const {
+    const Node *current = root.load();
+    if (!current)
         return;
-    const Node *current = root;
     while (!current->isLeaf)
-        current = current->children[0];
+        current = static_cast<const Inner *>(current)->children[0];
 
-    while (current) {
-        for (size_t i = 0; i < current->keys.size(); ++i) {
-            std::cout << "(" << current->keys[i] << ":" << current->values[i] << ") ";
+    for (auto leaf = static_cast<const Leaf *>(current); leaf; leaf = leaf->next) {
+        const auto entries = leaf->view();
+        for (int i = 0; i < entries.count; ++i) {
+            std::cout << "(" << entries.key(i) << ":" << entries.value(i) << ") ";
         }
         std::cout << "| ";
-        current = current->next;
     }
     std::cout << "\n";
 }
 
-std::vector<std::pair<uint32_t, uint32_t>> BPlusTree::range(const uint32_t low, const uint32_t high) const {
-    std::vector<std::pair<uint32_t, uint32_t>> result;
-
-    if (!root)
-        return result;
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+IndexStats BPlusTree<Key, Value, Compare, NodeBytes>::stats() const {
+    IndexStats stats;
+    std::vector<const Node *> level;
+    if (const Node *top = root.load())
+        level.push_back(top);
+    for (size_t depth = 0; !level.empty(); depth++) {
+        std::vector<const Node *> below;
+        for (const Node *node: level) {
+            if (node->isLeaf) {
+                const auto leaf = static_cast<const Leaf *>(node);
+                stats.keys += leaf->count;
+                stats.addNode(depth, sizeof(Leaf), leaf->count,
+                              Leaf::capacityOf({leaf->base, leaf->keyBytes, leaf->valueBytes}));
+            } else {
+                const auto inner = static_cast<const Inner *>(node);
+                stats.addNode(depth, sizeof(Inner), inner->count, Inner::capacity);
+                below.insert(below.end(), inner->children, inner->children + inner->count + 1);
+            }
+        }
+        level = std::move(below);
+    }
+    if (arena) {
+        stats.allocatedBytes = arena->mappedBytes();
+        stats.freeBytes = arena->freeBytes();
+    }
+    if (cache)
+        stats.allocatedBytes += cache->bytes();
+    return stats;
+}
 
-    Node *current = root;
-    while (!current->isLeaf) {
-        auto it = ranges::upper_bound(current->keys, low);
-        const uint32_t idx = it - current->keys.begin();
-        current = current->children[idx];
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+FrozenBPlusTree<Key, Value, Compare> BPlusTree<Key, Value, Compare, NodeBytes>::freeze() const {
+    std::vector<Entry> entries;
+    const Node *current = root.load();
+    if (current) {
+        while (!current->isLeaf)
+            current = static_cast<const Inner *>(current)->children[0];
+        for (auto leaf = static_cast<const Leaf *>(current); leaf; leaf = leaf->next) {
+            const auto view = leaf->view();
+            for (int i = 0; i < view.count; ++i)
+                entries.emplace_back(view.key(i), view.value(i));
+        }
     }
+    return FrozenBPlusTree<Key, Value, Compare>(entries);
+}
 
-    while (current) {
-        for (size_t i = 0; i < current->keys.size(); ++i) {
-            uint32_t key = current->keys[i];
-            if (key > high)
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+std::vector<typename BPlusTree<Key, Value, Compare, NodeBytes>::Entry>
+BPlusTree<Key, Value, Compare, NodeBytes>::range(const Key &low, const Key &high) const {
+    EpochManager::Guard guard(*epochs);
+    std::vector<Entry> result;
+
+    // Leaves are validated one at a time. When one changed while it was read, its entries are dropped and the scan
+    // descends again from the last key already returned, taking only the keys after it.
+    Key from = low;
+    bool after = false;
+    const Leaf *leaf = nullptr;
+    uint64_t version = 0;
+    while (true) {
+        if (!leaf) {
+            if (!descend(from, leaf, version))
+                continue;
+            if (!leaf)
                 return result;
-            if (key >= low) {
-                result.push_back(std::make_pair(key, current->values[i]));
+        }
+
+        const size_t mark = result.size();
+        bool done = false;
+        const auto entries = leaf->view();
+        for (int i = 0; i < entries.count; ++i) {
+            const Key key = entries.key(i);
+            if (less(high, key)) {
+                done = true;
+                break;
+            }
+            if (after ? less(from, key) : !less(key, from)) {
+                result.push_back(std::make_pair(key, entries.value(i)));
             }
         }
-        current = current->next;
+        // The next leaf's version is read before this one is validated. An erase that moves the lowest entries of
+        // the next leaf into this one changes both, so it either fails this validation or the next one's, and a
+        // leaf whose check fails is looked up again from the last key returned.
+        const Leaf *next = leaf->next;
+        uint64_t nextVersion = 0;
+        if ((next && !next->lock.readLock(nextVersion)) || !leaf->lock.validate(version)) {
+            result.resize(mark);
+            leaf = nullptr;
+            continue;
+        }
+        if (done || !next)
+            return result;
+        if (result.size() > mark) {
+            from = result.back().first;
+            after = true;
+        }
+
+        leaf = next;
+        version = nextVersion;
+    }
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>::Cursor::Cursor(const BPlusTree *tree, const Key &low, const Key &high) :
+    tree(tree), from(low), high(high), exhausted(less(high, low)) {
+    if (!exhausted)
+        refill();
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::Cursor::refill() {
+    index = 0;
+    filled = 0;
+    // Nodes may be reclaimed between two refills, so every refill starts from the root again. Within one, it is the
+    // same validation scheme as range: a leaf that changed while it was copied is dropped and looked up again from
+    // where the refill started.
+    EpochManager::Guard guard(*tree->epochs);
+    const Leaf *leaf = nullptr;
+    uint64_t version = 0;
+    while (true) {
+        if (!leaf) {
+            if (!tree->descend(from, leaf, version))
+                continue;
+            if (!leaf) {
+                exhausted = true;
+                return;
+            }
+        }
+
+        int count = 0;
+        bool pastHigh = false;
+        const auto entries = leaf->view();
+        int i = started ? entries.upperBound(tree->search, from) : entries.lowerBound(tree->search, from);
+        for (; i < entries.count && count < bufferSize; i++) {
+            const Key key = entries.key(i);
+            if (less(high, key)) {
+                pastHigh = true;
+                break;
+            }
+            buffer[count++] = {key, entries.value(i)};
+        }
+        const bool leafDone = i >= entries.count;
+        // Same order as in range: the next leaf's version first, then this one's validation
+        const Leaf *next = leaf->next;
+        uint64_t nextVersion = 0;
+        if ((next && !next->lock.readLock(nextVersion)) || !leaf->lock.validate(version)) {
+            leaf = nullptr;
+            continue;
+        }
+
+        if (pastHigh || (leafDone && !next))
+            exhausted = true;
+
+        if (count > 0) {
+            filled = count;
+            from = buffer[count - 1].first;
+            started = true;
+            return;
+        }
+        if (exhausted)
+            return;
+        leaf = next;
+        version = nextVersion;
+    }
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::Cursor
+BPlusTree<Key, Value, Compare, NodeBytes>::scan(const Key &low, const Key &high) const {
+    return Cursor(this, low, high);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+size_t BPlusTree<Key, Value, Compare, NodeBytes>::rangeCount(const Key &low, const Key &high) const {
+    if (less(high, low))
+        return 0;
+
+    EpochManager::Guard guard(*epochs);
+    size_t total = 0;
+    Key from = low;
+    bool after = false; // whether from itself was counted already
+    const Leaf *leaf = nullptr;
+    uint64_t version = 0;
+    while (true) {
+        if (!leaf) {
+            if (!descend(from, leaf, version))
+                continue;
+            if (!leaf)
+                return total;
+        }
+
+        const auto entries = leaf->view();
+        const int first = after ? entries.upperBound(search, from) : entries.lowerBound(search, from);
+        const int last = entries.upperBound(search, high);
+        const int count = std::max(last - first, 0);
+        const Key lastKey = count > 0 ? entries.key(last - 1) : Key{};
+        const bool done = last < entries.count;
+        // Same order as in range: the next leaf's version first, then this one's validation
+        const Leaf *next = leaf->next;
+        uint64_t nextVersion = 0;
+        if ((next && !next->lock.readLock(nextVersion)) || !leaf->lock.validate(version)) {
+            leaf = nullptr;
+            continue;
+        }
+        total += count;
+        if (done || !next)
+            return total;
+        if (count > 0) {
+            from = lastKey;
+            after = true;
+        }
+
+        leaf = next;
+        version = nextVersion;
     }
+}
 
-    return result;
+static std::vector<size_t> chunkSizes(const size_t count, const size_t perNode) {
+    std::vector<size_t> sizes((count + perNode - 1) / perNode, perNode);
+    sizes.back() = count - (sizes.size() - 1) * perNode;
+
+    // Share a short tail with its neighbour so no node ends up less than half full
+    if (sizes.size() > 1 && sizes.back() < (perNode + 1) / 2) {
+        const size_t pair = sizes[sizes.size() - 2] + sizes.back();
+        sizes[sizes.size() - 2] = pair - pair / 2;
+        sizes.back() = pair / 2;
+    }
+    return sizes;
 }
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::bulkLoad(std::span<const Entry> sorted, const double fillFactor,
+                                                         const unsigned threads) {
+    if (root.load()) {
+        for (const auto &[key, value]: sorted)
+            insert(key, value);
+        return;
+    }
+
+    // Equal keys keep their last occurrence
+    std::vector<Key> keys;
+    std::vector<Value> values;
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (i + 1 == sorted.size() || less(sorted[i].first, sorted[i + 1].first)) {
+            keys.push_back(sorted[i].first);
+            values.push_back(sorted[i].second);
+        }
+    }
+    if (keys.empty())
+        return;
+
+    const int maxKeys = Leaf::capacity;
+    const int maxChildren = Inner::capacity + 1;
+    const size_t perLeaf = std::clamp(static_cast<int>(maxKeys * fillFactor), 1, maxKeys);
+    const size_t perInner = std::clamp(static_cast<int>(maxChildren * fillFactor), 3, maxChildren);
+
+    // Pack the leaves left to right, keeping the lowest key of every node for the level above
+    const auto sizes = compress ? Leaf::packedSizes(keys.data(), values.data(), keys.size(), fillFactor)
+                                : chunkSizes(keys.size(), perLeaf);
+    std::vector<size_t> starts(sizes.size());
+    for (size_t i = 1; i < sizes.size(); i++)
+        starts[i] = starts[i - 1] + sizes[i - 1];
+    std::vector<Node *> level(sizes.size());
+    std::vector<Key> lowKeys(sizes.size());
+    parallelFor(sizes.size(), threads, [&](const size_t begin, const size_t end) {
+        // Each run's leaves are taken from the arena at once, so the runs do not contend for its lock and every run
+        // lies back to back in memory
+        std::vector<void *> blocks(end - begin);
+        arena->allocateRun(sizeof(Leaf), blocks);
+        for (size_t i = begin; i < end; i++) {
+            const Key *first = keys.data() + starts[i];
+            const Value *firstValue = values.data() + starts[i];
+            const auto leaf = new (blocks[i - begin]) Leaf();
+            leaf->encode(first, firstValue, sizes[i], Leaf::formatFor(first, firstValue, sizes[i], compress));
+            level[i] = leaf;
+            lowKeys[i] = *first;
+        }
+    });
+    for (size_t i = 1; i < level.size(); i++)
+        static_cast<Leaf *>(level[i - 1])->next = static_cast<Leaf *>(level[i]);
+
+    // Build each inner level from the one below until a single root remains
+    while (level.size() > 1) {
+        std::vector<Node *> parents;
+        std::vector<Key> parentLowKeys;
+        size_t first = 0;
+        for (const size_t size: chunkSizes(level.size(), perInner)) {
+            const auto node = arena->create<Inner>();
+            std::copy_n(level.begin() + first, size, node->children);
+            std::copy_n(lowKeys.begin() + first + 1, size - 1, node->keys);
+            node->count = size - 1;
+            parents.push_back(node);
+            parentLowKeys.push_back(lowKeys[first]);
+            first += size;
+        }
+        level = std::move(parents);
+        lowKeys = std::move(parentLowKeys);
+    }
+
+    root.store(level[0], memory_order_release);
+    // Misses cached while the tree was empty
+    if (cache)
+        cache->clear();
+}
+
+template class BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, 256>;
+template class BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, 1024>;
+template class BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, 4096>;
+template class BPlusTree<uint64_t, uint64_t, std::less<uint64_t>, 1024>;
+template class BPlusTree<ByteKey<16>, uint64_t, std::less<ByteKey<16>>, 1024>;
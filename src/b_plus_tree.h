@@ -1,26 +1,157 @@
 #ifndef BPLUS_TREE_H
 #define BPLUS_TREE_H
 
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
 #include <utility>
 #include <vector>
 
+#include "arena.h"
+#include "epoch.h"
+#include "hot_key_cache.h"
+#include "index_stats.h"
+#include "key_search.h"
+#include "key_traits.h"
+#include "optimistic_lock.h"
+#include "scan_iterator.h"
+
+template<typename Key, typename Value, typename Compare>
+class FrozenBPlusTree;
+
+// Maps Key to Value in the order of Compare. Node capacities are derived from NodeBytes and sizeof(Key) at compile
+// time: every node is a single NodeBytes-sized block with a header line followed by cache-line aligned key and
+// payload arrays. Keys and values are copied around as plain bytes, so both have to be trivially copyable. 32- and
+// 64-bit unsigned keys in their natural order are searched with the vector kernels, any other key type by binary
+// search. Instantiated for uint32_t keys and values with 256, 1024 and 4096 bytes, and with 1024 bytes for uint64_t
+// keys and values and for ByteKey<16> keys with uint64_t values.
+//
+// insert, erase, query, queryBatch and range may run concurrently from any number of threads. Every node carries an
+// optimistic version lock: readers never write shared memory and retry when a node they read changed underneath them,
+// while writers only write-lock the leaf they modify, plus the parent (and for erase a sibling) when a node has to
+// split, borrow or merge. display, stats, freeze, bulkLoad, setKeySearch, setLeafCompression and setHotKeyCache are not
+// synchronized.
+//
+// All nodes come from the tree's own arena and are released together with it, so destroying a tree (or assigning
+// another one to it) does not walk the nodes. Nodes that erase unlinks go back to the arena through the tree's epoch
+// manager once no operation can still be reading them.
+template<typename Key = uint32_t, typename Value = uint32_t, typename Compare = std::less<Key>,
+         size_t NodeBytes = 1024>
 class BPlusTree {
 public:
-    explicit BPlusTree(int degree);
-    void insert(uint32_t key, uint32_t value);
-    uint32_t query(uint32_t key) const;
+    using Entry = std::pair<Key, Value>;
+
+    // Forward cursor over the entries of one key range, returned by scan. Entries are copied out of a leaf a few dozen
+    // at a time while its version is checked, so the cursor never holds on to tree memory and needs no allocation.
+    // Like range, it may run alongside writers and sees every key that was in the range throughout the scan, but not
+    // one point in time; VersionedBPlusTree snapshots give that.
+    class Cursor {
+    public:
+        ScanIterator<Cursor, Entry> begin() { return ScanIterator<Cursor, Entry>(this); }
+        std::default_sentinel_t end() const { return {}; }
+
+        bool done() const { return index == filled; }
+        const Entry &current() const { return buffer[index]; }
+        void advance() {
+            if (++index == filled && !exhausted)
+                refill();
+        }
+
+    private:
+        friend class BPlusTree;
+        static constexpr int bufferSize = 64;
+
+        const BPlusTree *tree;
+        Key from; // where the next refill starts: at from itself, or after it once it was handed out
+        bool started = false;
+        Key high;
+        bool exhausted = false;
+        int index = 0;
+        int filled = 0;
+        Entry buffer[bufferSize];
+
+        Cursor(const BPlusTree *tree, const Key &low, const Key &high);
+        void refill();
+    };
+
+    BPlusTree();
+    BPlusTree(const BPlusTree &) = delete;
+    BPlusTree &operator=(const BPlusTree &) = delete;
+    BPlusTree(BPlusTree &&other) noexcept;
+    BPlusTree &operator=(BPlusTree &&other) noexcept;
+    void insert(const Key &key, const Value &value);
+    // Removes key, returning false if it was not there. Nodes on the way down that are down to a quarter of their
+    // capacity first borrow entries from a neighbour, or merge with it when both fit into one node, so the leaf
+    // never underflows and parents always have a separator to spare.
+    bool erase(const Key &key);
+    // The value of key, or Value{} (0) if it is missing.
+    Value query(const Key &key) const;
+    // Looks up every key at once, writing its value (Value{} if missing) to the same position of out, which must be
+    // at least as long as keys. Keys are walked down the tree in small groups one level at a time, prefetching each
+    // key's next node before any of them is read, so the cache misses of a group overlap instead of queueing up.
+    void queryBatch(std::span<const Key> keys, std::span<Value> out) const;
     void display() const;
-    std::vector<std::pair<uint32_t, uint32_t>> range(uint32_t low, uint32_t high) const;
+    // Node counts per level, fill, bytes per key and allocator overhead, from a walk over every node. Like display, it
+    // reads nodes without validating them, so no writers may run meanwhile.
+    IndexStats stats() const;
+    std::vector<Entry> range(const Key &low, const Key &high) const;
+    // Streams the entries with keys in [low, high] in key order: for (auto [key, value]: tree.scan(low, high)).
+    Cursor scan(const Key &low, const Key &high) const;
+    // Calls fn(key, value) for the entries with keys in [low, high] in key order until fn returns false.
+    template<typename Fn>
+    void scan(const Key &low, const Key &high, Fn &&fn) const {
+        for (const auto &[key, value]: scan(low, high)) {
+            if (!fn(key, value))
+                return;
+        }
+    }
+    // Number of keys in [low, high], counted per leaf without copying any entries out.
+    size_t rangeCount(const Key &low, const Key &high) const;
+    // Builds the tree bottom-up from entries sorted by key, packing every node to fillFactor of its capacity. Equal
+    // keys keep their last occurrence. A tree that already holds keys gets the entries inserted one by one instead.
+    // With threads > 1 the leaves are split into that many runs that are encoded concurrently, then linked up and
+    // stitched together under the inner levels, which hold a fraction of a percent of the nodes, on the calling thread.
+    void bulkLoad(std::span<const Entry> sorted, double fillFactor = 1.0, unsigned threads = 1);
+    // Selects how nodes are searched; defaults to KeySearch::Vector.
+    void setKeySearch(KeySearch mode);
+    // Lets leaves store keys as narrow offsets from their smallest key and values as small differences to their keys,
+    // packing several times as many entries into a node when keys are dense. Applies to leaves that bulkLoad builds
+    // or that get re-encoded when they split, merge or outgrow their encoding; off by default. Only unsigned integer
+    // keys in their natural order with integer values can be compressed, for any others this does nothing.
+    void setLeafCompression(bool enabled);
+    // Puts a HotKeyCache with room for about entries keys in front of query, or removes it for 0. insert, erase and
+    // bulkLoad keep it up to date. Off by default.
+    void setHotKeyCache(size_t entries);
+    // The cache set by setHotKeyCache, for its hit and miss counts; nullptr if there is none.
+    const HotKeyCache<Key, Value> *hotKeyCache() const { return cache.get(); }
+    // A read-only copy of the entries in a pointer-free layout searched faster than the tree (see FrozenBPlusTree).
+    // Like display, it walks the leaves without validating them, so no writers may run meanwhile.
+    FrozenBPlusTree<Key, Value, Compare> freeze() const;
 
 private:
     class Node;
-    Node *root;
-    int degree;
-    void insertInternal(uint32_t key, Node *parent, Node *child);
-    void splitInternal(Node *node);
-    void splitLeaf(Node *leaf);
-    static Node *findParent(Node *current, Node *child);
+    class Leaf;
+    class Inner;
+    std::atomic<Node *> root;
+    KeySearch search;
+    bool compress;
+    std::unique_ptr<HotKeyCache<Key, Value>> cache;
+    // Declared before epochs, so nodes still waiting for reclamation outlive the epoch manager
+    std::unique_ptr<Arena> arena;
+    std::unique_ptr<EpochManager> epochs;
+    // Each returns false when a concurrent writer invalidated what it read; the caller then starts over.
+    bool tryInsert(const Key &key, const Value &value);
+    bool tryErase(const Key &key, bool &erased);
+    bool descend(const Key &key, const Leaf *&leaf, uint64_t &version) const;
+    void splitChild(Node *node, Inner *parent);
+    Node *rebalance(Inner *parent, int idx, Node *left, Node *right);
+    static void reclaim(void *node, void *arena);
+    static void prefetch(const Node *node);
+    // Compare is stateless and default-constructed wherever two keys are compared.
+    static bool less(const Key &a, const Key &b) { return Compare{}(a, b); }
 };
 
 #endif
@@ -0,0 +1,27 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "cpu_affinity.h"
+
+using namespace std;
+
+vector<int> allowedCpus() {
+    vector<int> cpus;
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty())
+        cpus.push_back(0);
+    return cpus;
+}
+
+void pinThread(const int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
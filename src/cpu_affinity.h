@@ -0,0 +1,12 @@
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <vector>
+
+// The CPUs this process may run on, in order; at least one.
+std::vector<int> allowedCpus();
+// Restricts the calling thread to cpu. Best effort: if the CPU is not available the thread keeps running wherever the
+// scheduler puts it.
+void pinThread(int cpu);
+
+#endif // CPU_AFFINITY_H
@@ -0,0 +1,233 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "b_plus_tree.h"
+#include "durable_index.h"
+#include "file_io.h"
+#include "index_adapters.h"
+#include "trie.h"
+
+using namespace std;
+
+static constexpr char snapshotMagic[8] = {'S', 'N', 'A', 'P', 'S', 'H', 'O', 'T'};
+static constexpr uint32_t snapshotVersion = 1;
+static constexpr char segmentPrefix[] = "wal-";
+
+// A snapshot is this header followed by count (key, value) pairs in key order.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t firstSegment; // oldest log segment not contained in the snapshot
+    uint64_t count;
+};
+
+// The wrapper-specific half of how DurableIndex reaches into each kind of index.
+namespace {
+    using index_adapters::drop;
+    using index_adapters::load;
+    using index_adapters::lookup;
+    using index_adapters::put;
+    using index_adapters::Tree;
+
+    void put(Trie<> &trie, const uint32_t key, const uint32_t value) { insert(&trie, key, value); }
+
+    uint32_t lookup(Trie<> &trie, const uint32_t key) { return query(&trie, key); }
+
+    template<size_t NodeBytes, typename Fn>
+    void forEach(Tree<NodeBytes> &tree, Fn &&fn) {
+        tree.scan(0, UINT32_MAX, fn);
+    }
+
+    template<typename Fn>
+    void forEach(Trie<> &trie, Fn &&fn) {
+        scan(&trie, 0, UINT32_MAX, fn);
+    }
+
+    // Segment numbers of the log files in directory, oldest first.
+    vector<uint64_t> listSegments(const string &directory) {
+        vector<uint64_t> segments;
+        for (const auto &entry: filesystem::directory_iterator(directory)) {
+            const string name = entry.path().filename().string();
+            if (!name.starts_with(segmentPrefix))
+                continue;
+            uint64_t number;
+            const char *first = name.data() + strlen(segmentPrefix);
+            const auto [last, error] = from_chars(first, name.data() + name.size(), number);
+            if (error == errc() && last == name.data() + name.size())
+                segments.push_back(number);
+        }
+        sort(segments.begin(), segments.end());
+        return segments;
+    }
+} // namespace
+
+template<typename Index>
+DurableIndex<Index>::DurableIndex(const std::string &directory, const size_t groupSize) :
+    directory(directory), groupSize(groupSize) {
+    filesystem::create_directories(directory);
+    filesystem::remove(snapshotPath() + ".tmp");
+
+    uint64_t firstSegment = 0;
+    const File snapshot(open(snapshotPath().c_str(), O_RDONLY));
+    if (snapshot.fd >= 0) {
+        SnapshotHeader header{};
+        const size_t got = readAll(snapshot.fd, reinterpret_cast<char *>(&header), sizeof(header), 0, snapshotPath());
+        if (got != sizeof(header) || memcmp(header.magic, snapshotMagic, sizeof(snapshotMagic)) != 0 ||
+            header.version != snapshotVersion)
+            throw runtime_error(snapshotPath() + " is not a snapshot");
+        // Size the entries from the file rather than trusting count, which a damaged header could blow up
+        struct stat status{};
+        if (fstat(snapshot.fd, &status) != 0)
+            throw system_error(errno, generic_category(), "stat " + snapshotPath());
+        const uint64_t body = static_cast<uint64_t>(status.st_size) - sizeof(header);
+        if (body % (2 * sizeof(uint32_t)) != 0 || body / (2 * sizeof(uint32_t)) != header.count)
+            throw runtime_error(snapshotPath() + " is truncated");
+
+        vector<uint32_t> raw(header.count * 2);
+        const size_t bytes = raw.size() * sizeof(uint32_t);
+        if (readAll(snapshot.fd, reinterpret_cast<char *>(raw.data()), bytes, sizeof(header), snapshotPath()) != bytes)
+            throw runtime_error(snapshotPath() + " is truncated");
+        vector<pair<uint32_t, uint32_t>> entries(header.count);
+        for (size_t i = 0; i < entries.size(); i++)
+            entries[i] = {raw[2 * i], raw[2 * i + 1]};
+        load(data, entries);
+        firstSegment = header.firstSegment;
+    } else if (errno != ENOENT) {
+        throw system_error(errno, generic_category(), "open " + snapshotPath());
+    }
+
+    const vector<uint64_t> segments = listSegments(directory);
+    for (const uint64_t number: segments) {
+        // Older segments are left over from a checkpoint that died before deleting them
+        if (number < firstSegment) {
+            filesystem::remove(segmentPath(number));
+            continue;
+        }
+        replayed += WriteAheadLog::replay(segmentPath(number), [&](const LogOp op, const uint32_t key,
+                                                                   const uint32_t value) {
+            if (op == LogOp::Insert)
+                put(data, key, value);
+            else
+                drop(data, key);
+        });
+    }
+
+    // Segments that were replayed may end in a torn record, so never append to them
+    segment = std::max(firstSegment, segments.empty() ? 0 : segments.back() + 1);
+    log = make_unique<WriteAheadLog>(segmentPath(segment), groupSize);
+    syncDirectory(directory);
+}
+
+template<typename Index>
+void DurableIndex<Index>::insert(const uint32_t key, const uint32_t value) {
+    lock_guard lock(stripe(key));
+    log->append(LogOp::Insert, key, value);
+    put(data, key, value);
+}
+
+template<typename Index>
+bool DurableIndex<Index>::erase(const uint32_t key) {
+    lock_guard lock(stripe(key));
+    log->append(LogOp::Erase, key, 0);
+    return drop(data, key);
+}
+
+template<typename Index>
+uint32_t DurableIndex<Index>::query(const uint32_t key) {
+    return lookup(data, key);
+}
+
+template<typename Index>
+void DurableIndex<Index>::sync() {
+    // Any stripe keeps checkpoint() from swapping the log out from under us
+    lock_guard lock(stripe(0));
+    log->sync();
+}
+
+template<typename Index>
+void DurableIndex<Index>::checkpoint() {
+    lock_guard checkpointLock(checkpointMutex);
+
+    // Switch to a new segment once the operations in flight are done, so every operation is either applied before
+    // the snapshot starts or logged to a segment that outlives it
+    auto next = make_unique<WriteAheadLog>(segmentPath(segment + 1), groupSize);
+    syncDirectory(directory);
+    {
+        vector<unique_lock<std::mutex>> locks;
+        locks.reserve(stripeCount);
+        for (int i = 0; i < stripeCount; i++)
+            locks.emplace_back(stripes[i].mutex);
+        swap(log, next);
+        segment++;
+    }
+    next.reset();
+
+    const string temporary = snapshotPath() + ".tmp";
+    const File file(open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    if (file.fd < 0)
+        throw system_error(errno, generic_category(), "open " + temporary);
+
+    constexpr size_t bufferEntries = 1 << 17;
+    vector<uint32_t> buffer;
+    buffer.reserve(2 * bufferEntries);
+    off_t offset = sizeof(SnapshotHeader);
+    uint64_t count = 0;
+    const auto flush = [&] {
+        writeAll(file.fd, reinterpret_cast<const char *>(buffer.data()), buffer.size() * sizeof(uint32_t), offset,
+                 temporary);
+        offset += buffer.size() * sizeof(uint32_t);
+        buffer.clear();
+    };
+    forEach(data, [&](const uint32_t key, const uint32_t value) {
+        buffer.push_back(key);
+        buffer.push_back(value);
+        count++;
+        if (buffer.size() == buffer.capacity())
+            flush();
+        return true;
+    });
+    flush();
+
+    SnapshotHeader header{{}, snapshotVersion, 0, segment, count};
+    memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    writeAll(file.fd, reinterpret_cast<const char *>(&header), sizeof(header), 0, temporary);
+    syncData(file.fd, temporary);
+    if (rename(temporary.c_str(), snapshotPath().c_str()) != 0)
+        throw system_error(errno, generic_category(), "rename " + temporary);
+    syncDirectory(directory);
+
+    for (const uint64_t number: listSegments(directory)) {
+        if (number < segment)
+            filesystem::remove(segmentPath(number));
+    }
+}
+
+template<typename Index>
+std::string DurableIndex<Index>::segmentPath(const uint64_t number) const {
+    // Zero-padded, so the directory lists segments in order
+    char name[32];
+    snprintf(name, sizeof(name), "%s%020llu", segmentPrefix, static_cast<unsigned long long>(number));
+    return (filesystem::path(directory) / name).string();
+}
+
+template<typename Index>
+std::string DurableIndex<Index>::snapshotPath() const {
+    return (filesystem::path(directory) / "snapshot").string();
+}
+
+template class DurableIndex<BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, 256>>;
+template class DurableIndex<BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, 1024>>;
+template class DurableIndex<BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, 4096>>;
+template class DurableIndex<Trie<>>;
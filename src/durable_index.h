@@ -0,0 +1,67 @@
+#ifndef DURABLE_INDEX_H
+#define DURABLE_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "write_ahead_log.h"
+
+// Makes an index (a BPlusTree or a Trie, with uint32_t keys and values) survive crashes by keeping it in a directory as
+// the latest snapshot plus the log segments written since. Every insert and erase is logged before it is applied;
+// checkpoint() starts a new segment, writes a snapshot of the index and then deletes the segments it covers. Opening
+// the directory loads the snapshot and replays the segments after it, so the index comes back with every operation
+// that was durable when the process died. How many operations that is depends on groupSize, see WriteAheadLog.
+//
+// The snapshot is taken while writers keep going, so it may or may not contain the operations logged to the new
+// segment; replaying those on top of it gives the same result either way, as inserting or erasing a key twice does
+// not change it. Operations on the same key are logged and applied under one lock, so log order matches the order
+// they hit the index.
+//
+// insert, erase and query follow the concurrency rules of the index: a durable BPlusTree may be used from any number
+// of threads, including checkpoint(), a durable Trie from one thread at a time.
+template<typename Index>
+class DurableIndex {
+public:
+    // Opens the index stored in directory, creating the directory if it does not exist yet.
+    explicit DurableIndex(const std::string &directory, size_t groupSize = 1);
+    DurableIndex(const DurableIndex &) = delete;
+    DurableIndex &operator=(const DurableIndex &) = delete;
+
+    void insert(uint32_t key, uint32_t value);
+    bool erase(uint32_t key);
+    uint32_t query(uint32_t key);
+    // Returns once every earlier insert and erase is durable.
+    void sync();
+    // Writes a snapshot of the index and drops the log it makes redundant.
+    void checkpoint();
+
+    // The recovered index, for reads the wrapper does not forward. Writing to it directly bypasses the log.
+    Index &index() { return data; }
+    // Operations replayed from the log when the directory was opened.
+    size_t recovered() const { return replayed; }
+
+private:
+    static constexpr int stripeCount = 64;
+
+    struct alignas(64) Stripe {
+        std::mutex mutex;
+    };
+
+    std::string directory;
+    size_t groupSize;
+    Index data;
+    size_t replayed = 0;
+    uint64_t segment; // number of the segment being appended to
+    std::unique_ptr<WriteAheadLog> log;
+    std::unique_ptr<Stripe[]> stripes = std::make_unique<Stripe[]>(stripeCount);
+    std::mutex checkpointMutex;
+
+    std::string segmentPath(uint64_t number) const;
+    std::string snapshotPath() const;
+    std::mutex &stripe(uint32_t key) const { return stripes[key % stripeCount].mutex; }
+};
+
+#endif // DURABLE_INDEX_H
@@ -0,0 +1,111 @@
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "epoch.h"
+
+// Every thread borrows a process-wide index into the per-manager slot arrays and gives it back when it exits.
+static std::atomic<bool> indexTaken[EpochManager::maxThreads];
+
+namespace {
+    struct ThreadIndex {
+        int value = 0;
+
+        ThreadIndex() {
+            for (;; value = (value + 1) % EpochManager::maxThreads) {
+                bool expected = false;
+                if (!indexTaken[value].load(std::memory_order_relaxed) &&
+                    indexTaken[value].compare_exchange_strong(expected, true))
+                    break;
+            }
+        }
+
+        ~ThreadIndex() { indexTaken[value].store(false, std::memory_order_release); }
+    };
+} // namespace
+
+int threadIndex() {
+    thread_local ThreadIndex index;
+    return index.value;
+}
+
+// Pinning has to order the epoch store before the reads that follow it, which takes a full fence on x86 and stalls the
+// pipeline on every operation. Where the kernel offers private expedited membarrier, the fence moves to collect
+// instead: it forces a barrier on every running thread of the process before the slots are read, and pinning only has
+// to stop the compiler from reordering.
+static bool registerMembarrier() {
+#ifdef __NR_membarrier
+    return syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+#else
+    return false;
+#endif
+}
+
+static const bool asymmetricFences = registerMembarrier();
+
+static void heavyFence() {
+#ifdef __NR_membarrier
+    if (asymmetricFences) {
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        return;
+    }
+#endif
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+// Retirements between two attempts to advance the epoch and free what is safe
+static constexpr size_t collectInterval = 64;
+
+EpochManager::EpochManager() : slots(std::make_unique<Slot[]>(maxThreads)) {}
+
+EpochManager::~EpochManager() {
+    for (int i = 0; i < maxThreads; i++) {
+        for (const Retired &r: slots[i].retired)
+            r.deleter(r.ptr, r.context);
+    }
+}
+
+EpochManager::Slot &EpochManager::localSlot() { return slots[threadIndex()]; }
+
+EpochManager::Guard::Guard(EpochManager &manager) : slot(manager.localSlot()) {
+    if (slot.nesting++ == 0) {
+        slot.epoch.store(manager.global.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        if (asymmetricFences)
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        else
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+EpochManager::Guard::~Guard() {
+    if (--slot.nesting == 0)
+        slot.epoch.store(0, std::memory_order_release);
+}
+
+void EpochManager::retire(void *ptr, void (*deleter)(void *, void *), void *context) {
+    Slot &slot = localSlot();
+    slot.retired.push_back({ptr, deleter, context, global.load(std::memory_order_seq_cst)});
+    if (slot.retired.size() % collectInterval == 0)
+        collect(slot);
+}
+
+void EpochManager::collect(Slot &slot) {
+    // The epoch only moves on once every pinned thread has observed the current one
+    heavyFence();
+    uint64_t current = global.load(std::memory_order_seq_cst);
+    bool advance = true;
+    for (int i = 0; i < maxThreads && advance; i++) {
+        const uint64_t pinned = slots[i].epoch.load(std::memory_order_seq_cst);
+        advance = pinned == 0 || pinned == current;
+    }
+    if (advance && global.compare_exchange_strong(current, current + 1))
+        current++;
+
+    // Anything retired two epochs ago can no longer be reached by a pinned thread
+    std::erase_if(slot.retired, [&](const Retired &r) {
+        if (r.epoch + 2 > current)
+            return false;
+        r.deleter(r.ptr, r.context);
+        return true;
+    });
+}
@@ -0,0 +1,63 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Epoch-based reclamation for memory that was unlinked while lock-free readers may still be looking at it. Threads
+// pin the current epoch with a Guard for the duration of an operation; retired memory is handed to its deleter once
+// every thread that could have seen it has unpinned. Supports up to maxThreads threads alive at the same time.
+class EpochManager {
+    struct Slot;
+
+public:
+    static constexpr int maxThreads = 256;
+
+    class Guard {
+    public:
+        explicit Guard(EpochManager &manager);
+        ~Guard();
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+    private:
+        Slot &slot;
+    };
+
+    EpochManager();
+    // Frees everything still waiting; no thread may be pinned any more.
+    ~EpochManager();
+    EpochManager(const EpochManager &) = delete;
+    EpochManager &operator=(const EpochManager &) = delete;
+
+    // Schedules deleter(ptr, context) for when no pinned thread can still reach ptr. The calling thread must be
+    // pinned.
+    void retire(void *ptr, void (*deleter)(void *, void *), void *context);
+
+private:
+    struct Retired {
+        void *ptr;
+        void (*deleter)(void *, void *);
+        void *context;
+        uint64_t epoch;
+    };
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0}; // 0 while the thread is not pinned
+        int nesting = 0;
+        std::vector<Retired> retired;
+    };
+
+    std::atomic<uint64_t> global{1};
+    std::unique_ptr<Slot[]> slots;
+
+    Slot &localSlot();
+    void collect(Slot &slot);
+};
+
+// Index of the calling thread below EpochManager::maxThreads, unique among the threads alive at the same time.
+int threadIndex();
+
+#endif // EPOCH_H
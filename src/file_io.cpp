@@ -0,0 +1,58 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+
+#include "file_io.h"
+
+using namespace std;
+
+File::~File() {
+    if (fd >= 0)
+        close(fd);
+}
+
+void writeAll(const int fd, const char *data, size_t size, off_t offset, const string &path) {
+    while (size > 0) {
+        const ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw system_error(errno, generic_category(), "write " + path);
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+}
+
+size_t readAll(const int fd, char *data, const size_t size, off_t offset, const string &path) {
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t got = pread(fd, data + done, size - done, offset);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            throw system_error(errno, generic_category(), "read " + path);
+        }
+        if (got == 0)
+            break;
+        done += got;
+        offset += got;
+    }
+    return done;
+}
+
+void syncData(const int fd, const string &path) {
+    if (fdatasync(fd) != 0)
+        throw system_error(errno, generic_category(), "fsync " + path);
+}
+
+void syncDirectory(const string &path) {
+    const File directory(open(path.c_str(), O_RDONLY | O_DIRECTORY));
+    if (directory.fd < 0)
+        throw system_error(errno, generic_category(), "open " + path);
+    if (fsync(directory.fd) != 0)
+        throw system_error(errno, generic_category(), "fsync " + path);
+}
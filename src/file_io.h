@@ -0,0 +1,28 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+
+// Owns a POSIX file descriptor, closing it when it goes out of scope.
+struct File {
+    int fd;
+
+    explicit File(int fd) : fd(fd) {}
+    ~File();
+    File(const File &) = delete;
+    File &operator=(const File &) = delete;
+};
+
+// Writes all of data at offset, retrying short writes. Throws std::system_error naming path on failure.
+void writeAll(int fd, const char *data, size_t size, off_t offset, const std::string &path);
+// Reads all of size bytes at offset, returning how many there were before the end of the file.
+size_t readAll(int fd, char *data, size_t size, off_t offset, const std::string &path);
+// Flushes file data (not necessarily metadata) to stable storage.
+void syncData(int fd, const std::string &path);
+// Makes entries created, renamed or removed in a directory durable.
+void syncDirectory(const std::string &path);
+
+#endif // FILE_IO_H
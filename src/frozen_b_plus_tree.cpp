@@ -0,0 +1,199 @@
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include "frozen_b_plus_tree.h"
+#include "key_search.h"
+#include "key_traits.h"
+
+using namespace std;
+
+// Keys looked up together by queryBatch, as in BPlusTree::queryBatch.
+static constexpr size_t batchGroup = 16;
+
+template<typename Key, typename Value, typename Compare>
+FrozenBPlusTree<Key, Value, Compare>::FrozenBPlusTree(const span<const Entry> sorted) {
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (i + 1 == sorted.size() || less(sorted[i].first, sorted[i + 1].first))
+            count++;
+    }
+    if (count == 0)
+        return;
+
+    // Node counts from the bottom level up, until one node is left
+    nodes.push_back((count + nodeKeys - 1) / nodeKeys);
+    while (nodes.back() > 1)
+        nodes.push_back((nodes.back() + fanout - 1) / fanout);
+    reverse(nodes.begin(), nodes.end());
+
+    size_t keyBytes = 0;
+    for (const size_t n: nodes)
+        keyBytes += n * cacheLine;
+    storageBytes = keyBytes + lines(count * sizeof(Value));
+    storage = mmap(nullptr, storageBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (storage == MAP_FAILED) {
+        storage = nullptr;
+        throw bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(storage, storageBytes, MADV_HUGEPAGE);
+#endif
+
+    char *cursor = static_cast<char *>(storage);
+    vector<Key *> writable;
+    for (const size_t n: nodes) {
+        writable.push_back(reinterpret_cast<Key *>(cursor));
+        levels.push_back(writable.back());
+        cursor += n * cacheLine;
+    }
+    auto *valueArray = reinterpret_cast<Value *>(cursor);
+    values = valueArray;
+
+    // The bottom level and the values, keeping the last of equal keys
+    size_t position = 0;
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (i + 1 < sorted.size() && !less(sorted[i].first, sorted[i + 1].first))
+            continue;
+        memcpy(&writable.back()[position], &sorted[i].first, sizeof(Key));
+        memcpy(&valueArray[position], &sorted[i].second, sizeof(Value));
+        position++;
+    }
+
+    // Each level above: slot j of node k holds the smallest key of child k * fanout + j + 1, which is the first key
+    // of the bottom-level span that child covers
+    const Key *bottom = levels.back();
+    size_t childSpan = nodeKeys; // keys below one node of the level being filled's child level
+    for (size_t level = levels.size() - 1; level-- > 0;) {
+        for (size_t node = 0; node < nodes[level]; node++) {
+            const int filled = keysIn(level, node);
+            for (int slot = 0; slot < filled; slot++)
+                memcpy(&writable[level][node * nodeKeys + slot], &bottom[(node * fanout + slot + 1) * childSpan],
+                       sizeof(Key));
+        }
+        childSpan *= fanout;
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+FrozenBPlusTree<Key, Value, Compare>::~FrozenBPlusTree() {
+    if (storage)
+        munmap(storage, storageBytes);
+}
+
+template<typename Key, typename Value, typename Compare>
+FrozenBPlusTree<Key, Value, Compare>::FrozenBPlusTree(FrozenBPlusTree &&other) noexcept :
+    count(other.count), levels(std::move(other.levels)), nodes(std::move(other.nodes)), values(other.values),
+    storage(other.storage), storageBytes(other.storageBytes) {
+    other.count = 0;
+    other.levels.clear();
+    other.nodes.clear();
+    other.values = nullptr;
+    other.storage = nullptr;
+    other.storageBytes = 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+FrozenBPlusTree<Key, Value, Compare> &
+FrozenBPlusTree<Key, Value, Compare>::operator=(FrozenBPlusTree &&other) noexcept {
+    swap(count, other.count);
+    swap(levels, other.levels);
+    swap(nodes, other.nodes);
+    swap(values, other.values);
+    swap(storage, other.storage);
+    swap(storageBytes, other.storageBytes);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+int FrozenBPlusTree<Key, Value, Compare>::keysIn(const size_t level, const size_t node) const {
+    if (level + 1 == levels.size())
+        return static_cast<int>(min<size_t>(nodeKeys, count - node * nodeKeys));
+    // One separator fewer than the node has children
+    return static_cast<int>(min<size_t>(fanout, nodes[level + 1] - node * fanout)) - 1;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool upper>
+size_t FrozenBPlusTree<Key, Value, Compare>::position(const Key &key) const {
+    size_t node = 0;
+    for (size_t level = 0; level + 1 < levels.size(); level++) {
+        const Key *keys = levels[level] + node * nodeKeys;
+        const int n = keysIn(level, node);
+        const int slot = upper ? upperBound(KeySearch::Vector, keys, n, key, Compare{})
+                               : lowerBound(KeySearch::Vector, keys, n, key, Compare{});
+        node = node * fanout + slot;
+    }
+    // Past the last key of the node is the first key of the next one, which is where the search was headed
+    const Key *keys = levels.back() + node * nodeKeys;
+    const int n = keysIn(levels.size() - 1, node);
+    return node * nodeKeys + (upper ? upperBound(KeySearch::Vector, keys, n, key, Compare{})
+                                    : lowerBound(KeySearch::Vector, keys, n, key, Compare{}));
+}
+
+template<typename Key, typename Value, typename Compare>
+Value FrozenBPlusTree<Key, Value, Compare>::query(const Key &key) const {
+    if (count == 0)
+        return Value{};
+    const size_t at = position<false>(key);
+    if (at < count && !less(key, levels.back()[at]))
+        return values[at];
+    return Value{};
+}
+
+template<typename Key, typename Value, typename Compare>
+void FrozenBPlusTree<Key, Value, Compare>::queryBatch(const span<const Key> keys, const span<Value> out) const {
+    if (count == 0) {
+        fill_n(out.begin(), keys.size(), Value{});
+        return;
+    }
+    for (size_t first = 0; first < keys.size(); first += batchGroup) {
+        const size_t size = min(batchGroup, keys.size() - first);
+        const Key *groupKeys = keys.data() + first;
+        size_t at[batchGroup] = {};
+
+        // One level per pass: pick every key's child and prefetch it before any of the children is searched
+        for (size_t level = 0; level < levels.size(); level++) {
+            const bool bottom = level + 1 == levels.size();
+            for (size_t i = 0; i < size; i++) {
+                const int slot = lowerBound(KeySearch::Vector, levels[level] + at[i] * nodeKeys, keysIn(level, at[i]),
+                                            groupKeys[i], Compare{});
+                if (bottom) {
+                    at[i] = at[i] * nodeKeys + slot;
+                } else {
+                    at[i] = at[i] * fanout + slot;
+                    __builtin_prefetch(levels[level + 1] + at[i] * nodeKeys);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < size; i++) {
+            const bool found = at[i] < count && !less(groupKeys[i], levels.back()[at[i]]);
+            out[first + i] = found ? values[at[i]] : Value{};
+        }
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+vector<typename FrozenBPlusTree<Key, Value, Compare>::Entry>
+FrozenBPlusTree<Key, Value, Compare>::range(const Key &low, const Key &high) const {
+    vector<Entry> result;
+    if (count == 0 || less(high, low))
+        return result;
+    const size_t end = position<true>(high);
+    for (size_t i = position<false>(low); i < end; i++)
+        result.emplace_back(levels.back()[i], values[i]);
+    return result;
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t FrozenBPlusTree<Key, Value, Compare>::rangeCount(const Key &low, const Key &high) const {
+    if (count == 0 || less(high, low))
+        return 0;
+    return position<true>(high) - position<false>(low);
+}
+
+template class FrozenBPlusTree<uint32_t, uint32_t, std::less<uint32_t>>;
+template class FrozenBPlusTree<uint64_t, uint64_t, std::less<uint64_t>>;
+template class FrozenBPlusTree<ByteKey<16>, uint64_t, std::less<ByteKey<16>>>;
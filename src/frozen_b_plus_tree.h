@@ -0,0 +1,71 @@
+#ifndef FROZEN_B_PLUS_TREE_H
+#define FROZEN_B_PLUS_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "node_layout.h"
+
+// Immutable search tree over sorted entries, made by BPlusTree::freeze for indexes that are built once and then only
+// read. There are no pointers: every node is one cache line of keys, and the children of node k of a level are nodes
+// k * (fanout) ... k * (fanout) + fanout - 1 of the level below, like an Eytzinger layout with a node per line. The
+// bottom level is simply all keys in order, so a range is a slice of it, and the values sit in a separate array at
+// the same positions. The levels are stored root first in one block backed by huge pages where available, which
+// puts the upper levels all a lookup touches on the first few pages.
+//
+// Keys separating the children of a node are the smallest keys of the children after the first, and each level is
+// searched like the nodes of a BPlusTree: 32- and 64-bit unsigned keys in their natural order with the vector kernels,
+// others by binary search. With 32-bit keys a node has 17 children, so a million keys take five node reads.
+//
+// Nothing changes after construction, so any number of threads may read a frozen tree at once. Instantiated for the
+// key and value types BPlusTree is instantiated for.
+template<typename Key = uint32_t, typename Value = uint32_t, typename Compare = std::less<Key>>
+class FrozenBPlusTree {
+public:
+    using Entry = std::pair<Key, Value>;
+
+    FrozenBPlusTree() = default;
+    // Entries sorted by key; equal keys keep their last occurrence.
+    explicit FrozenBPlusTree(std::span<const Entry> sorted);
+    ~FrozenBPlusTree();
+    FrozenBPlusTree(const FrozenBPlusTree &) = delete;
+    FrozenBPlusTree &operator=(const FrozenBPlusTree &) = delete;
+    FrozenBPlusTree(FrozenBPlusTree &&other) noexcept;
+    FrozenBPlusTree &operator=(FrozenBPlusTree &&other) noexcept;
+
+    // The value of key, or Value{} if it is missing.
+    Value query(const Key &key) const;
+    // Looks up keys in groups one level at a time with the next node of each prefetched, like BPlusTree::queryBatch.
+    void queryBatch(std::span<const Key> keys, std::span<Value> out) const;
+    std::vector<Entry> range(const Key &low, const Key &high) const;
+    // Number of keys in [low, high], from the positions of the two bounds alone.
+    size_t rangeCount(const Key &low, const Key &high) const;
+    size_t size() const { return count; }
+    // Bytes of the key levels and values together.
+    size_t bytes() const { return storageBytes; }
+
+private:
+    static constexpr int nodeKeys = static_cast<int>(sizeof(Key) < cacheLine ? cacheLine / sizeof(Key) : 1);
+    static constexpr size_t fanout = nodeKeys + 1;
+
+    size_t count = 0;
+    // levels[0] is the root, levels.back() the keys in order; each entry points at the level's first node
+    std::vector<const Key *> levels;
+    std::vector<size_t> nodes; // per level
+    const Value *values = nullptr;
+    void *storage = nullptr;
+    size_t storageBytes = 0;
+
+    // Position of the first key not less than key (upper = false) or greater than key (upper = true), or size().
+    template<bool upper>
+    size_t position(const Key &key) const;
+    // Keys in node of level, all but the last node of a level being full.
+    int keysIn(size_t level, size_t node) const;
+    static bool less(const Key &a, const Key &b) { return Compare{}(a, b); }
+};
+
+#endif // FROZEN_B_PLUS_TREE_H
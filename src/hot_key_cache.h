@@ -0,0 +1,190 @@
+#ifndef HOT_KEY_CACHE_H
+#define HOT_KEY_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+#include "epoch.h"
+#include "node_layout.h"
+
+// Small cache of query results in front of a B+ tree or trie, for lookups that keep coming back to the same few keys.
+// A key hashes to one set, and every set is a single cache line holding a sequence word and as many key/value pairs as
+// fit next to it (7 for 32-bit keys and values), so a hit reads one line and writes nothing shared. Each set evicts by
+// CLOCK: hits mark their way as referenced, and a fill takes the first unmarked way from the set's hand on, clearing
+// the marks it passes.
+//
+// Any number of threads may look up, fill and invalidate at once. Writers make a set's sequence odd while they change
+// it; readers check it before and after reading the set and take a change as a miss. A miss hands out the sequence it
+// saw as a ticket, and fill only stores the value looked up next if the set still has that sequence. The structures
+// invalidate a key after every write to it, which moves its set's sequence on, so a value read before a write can
+// never be cached after it.
+template<typename Key = uint32_t, typename Value = uint32_t>
+class HotKeyCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    // Room for at least entries keys, in a power of two of sets.
+    explicit HotKeyCache(const size_t entries) :
+        mask(std::bit_ceil(std::max<size_t>(1, (entries + ways - 1) / ways)) - 1),
+        sets(std::make_unique<Set[]>(mask + 1)), counters(std::make_unique<Counters[]>(EpochManager::maxThreads)) {}
+
+    // True with value set if key is cached; otherwise ticket is what fill needs to cache the value looked up next.
+    bool lookup(const Key &key, Value &value, uint32_t &ticket) {
+        Set &set = setFor(key);
+        ticket = set.sequence.load(std::memory_order_acquire);
+        int way = -1;
+        if (!(ticket & 1)) {
+            for (int i = 0; i < ways; i++) {
+                if (set.used >> i & 1 && set.keys[i] == key) {
+                    value = set.values[i];
+                    way = i;
+                    break;
+                }
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (set.sequence.load(std::memory_order_relaxed) != ticket)
+                way = -1;
+        }
+
+        Counters &local = counters[threadIndex()];
+        if (way < 0) {
+            // Only every admitInterval-th miss of a thread may fill, which keeps keys that come up once from churning
+            // the sets while hot keys still get in after a few lookups. An odd ticket makes fill do nothing.
+            if (count(local.misses) % admitInterval != 0)
+                ticket = 1;
+            return false;
+        }
+        // Only written when it changes, so the line of a hot set stays shared between the cores reading it
+        if (!(set.referenced.load(std::memory_order_relaxed) >> way & 1))
+            set.referenced.fetch_or(static_cast<uint8_t>(1 << way), std::memory_order_relaxed);
+        count(local.hits);
+        return true;
+    }
+
+    // Caches value for key, unless its set changed since lookup handed out ticket.
+    void fill(const Key &key, const Value &value, uint32_t ticket) {
+        Set &set = setFor(key);
+        if (ticket & 1 || !set.sequence.compare_exchange_strong(ticket, ticket + 1, std::memory_order_acquire))
+            return;
+        std::atomic_thread_fence(std::memory_order_release);
+
+        int way = std::countr_one(set.used);
+        if (way >= ways) {
+            // Readers may mark ways again behind the hand, so one round is all it gets
+            for (int step = 0; step < ways && set.referenced.load(std::memory_order_relaxed) >> set.hand & 1;
+                 step++) {
+                set.referenced.fetch_and(static_cast<uint8_t>(~(1 << set.hand)), std::memory_order_relaxed);
+                set.hand = (set.hand + 1) % ways;
+            }
+            way = set.hand;
+            set.hand = (set.hand + 1) % ways;
+        }
+        set.keys[way] = key;
+        set.values[way] = value;
+        set.used |= 1 << way;
+        set.referenced.fetch_and(static_cast<uint8_t>(~(1 << way)), std::memory_order_relaxed);
+        set.sequence.store(ticket + 2, std::memory_order_release);
+    }
+
+    // Drops key and fails every fill of its set holding an older ticket. Called after each write to key.
+    void invalidate(const Key &key) {
+        Set &set = setFor(key);
+        const uint32_t sequence = lock(set);
+        for (int i = 0; i < ways; i++) {
+            if (set.used >> i & 1 && set.keys[i] == key)
+                set.used &= ~(1 << i);
+        }
+        set.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // Drops every key, for writes that replace the whole structure.
+    void clear() {
+        for (size_t i = 0; i <= mask; i++) {
+            const uint32_t sequence = lock(sets[i]);
+            sets[i].used = 0;
+            sets[i].sequence.store(sequence + 2, std::memory_order_release);
+        }
+    }
+
+    // Hits and misses of all threads so far; exact once no lookups are running.
+    Stats stats() const {
+        Stats total;
+        for (int i = 0; i < EpochManager::maxThreads; i++) {
+            total.hits += counters[i].hits.load(std::memory_order_relaxed);
+            total.misses += counters[i].misses.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // Bytes of the sets and the per-thread counters.
+    size_t bytes() const { return (mask + 1) * sizeof(Set) + EpochManager::maxThreads * sizeof(Counters); }
+
+private:
+    static constexpr size_t setHeader = 8;
+    static constexpr uint64_t admitInterval = 8;
+    static constexpr int ways =
+            static_cast<int>(std::min<size_t>(8, (cacheLine - setHeader) / (sizeof(Key) + sizeof(Value))));
+    static_assert(ways >= 1, "a key and its value have to fit into a cache line next to the set header");
+
+    struct alignas(cacheLine) Set {
+        std::atomic<uint32_t> sequence{0}; // odd while a writer changes the set
+        std::atomic<uint8_t> referenced{0}; // CLOCK marks, a bit per way
+        uint8_t used = 0; // a bit per way holding an entry
+        uint8_t hand = 0;
+        Key keys[ways];
+        Value values[ways];
+    };
+    static_assert(sizeof(Set) == cacheLine);
+
+    // Each thread only counts into the slot of its threadIndex, so the counters need no atomic increments
+    struct alignas(cacheLine) Counters {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+
+    size_t mask; // sets - 1
+    std::unique_ptr<Set[]> sets;
+    std::unique_ptr<Counters[]> counters;
+
+    Set &setFor(const Key &key) const {
+        uint64_t word = 0;
+        if constexpr (std::is_integral_v<Key>) {
+            word = key;
+        } else {
+            for (size_t i = 0; i < sizeof(Key); i += 8) {
+                uint64_t part = 0;
+                memcpy(&part, reinterpret_cast<const char *>(&key) + i, std::min<size_t>(8, sizeof(Key) - i));
+                word = (word ^ part) * 0x9e3779b97f4a7c15ull;
+            }
+        }
+        return sets[(word * 0x9e3779b97f4a7c15ull) >> 32 & mask];
+    }
+
+    static uint32_t lock(Set &set) {
+        uint32_t sequence = set.sequence.load(std::memory_order_relaxed);
+        while (sequence & 1 ||
+               !set.sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire)) {
+            if (sequence & 1)
+                sequence = set.sequence.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return sequence;
+    }
+
+    static uint64_t count(std::atomic<uint64_t> &counter) {
+        const uint64_t value = counter.load(std::memory_order_relaxed) + 1;
+        counter.store(value, std::memory_order_relaxed);
+        return value;
+    }
+};
+
+#endif // HOT_KEY_CACHE_H
@@ -0,0 +1,44 @@
+#ifndef INDEX_ADAPTERS_H
+#define INDEX_ADAPTERS_H
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <utility>
+
+#include "b_plus_tree.h"
+#include "trie.h"
+
+// How the index wrappers (DurableIndex, ShardedIndex) reach into each kind of index. Only the calls every wrapper makes
+// the same way live here; a wrapper brings them in with using-declarations and adds its own overloads next to them,
+// e.g. the concurrent trie insert and lookup ShardedIndex needs.
+namespace index_adapters {
+    template<size_t NodeBytes>
+    using Tree = BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, NodeBytes>;
+
+    template<size_t NodeBytes>
+    void put(Tree<NodeBytes> &tree, const uint32_t key, const uint32_t value) {
+        tree.insert(key, value);
+    }
+
+    template<size_t NodeBytes>
+    bool drop(Tree<NodeBytes> &tree, const uint32_t key) {
+        return tree.erase(key);
+    }
+
+    inline bool drop(Trie<> &trie, const uint32_t key) { return erase(&trie, key); }
+
+    template<size_t NodeBytes>
+    uint32_t lookup(Tree<NodeBytes> &tree, const uint32_t key) {
+        return tree.query(key);
+    }
+
+    template<size_t NodeBytes>
+    void load(Tree<NodeBytes> &tree, std::span<const std::pair<uint32_t, uint32_t>> sorted) {
+        tree.bulkLoad(sorted);
+    }
+
+    inline void load(Trie<> &trie, std::span<const std::pair<uint32_t, uint32_t>> sorted) { bulk_load(&trie, sorted); }
+} // namespace index_adapters
+
+#endif // INDEX_ADAPTERS_H
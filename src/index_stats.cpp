@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <bit>
+
+#include "index_stats.h"
+
+using namespace std;
+
+size_t IndexStats::nodes() const {
+    size_t total = 0;
+    for (const size_t n: nodesPerLevel)
+        total += n;
+    return total;
+}
+
+double IndexStats::bytesPerKey() const {
+    return keys == 0 ? 0 : static_cast<double>(allocatedBytes) / static_cast<double>(keys);
+}
+
+void IndexStats::addNode(const size_t level, const size_t bytes, const int count, const int capacity,
+                         const int children) {
+    if (nodesPerLevel.size() <= level)
+        nodesPerLevel.resize(level + 1);
+    nodesPerLevel[level]++;
+    nodeBytes += bytes;
+    fill[min<size_t>(fillBuckets - 1, static_cast<size_t>(count) * fillBuckets / max(capacity, 1))]++;
+    if (children > 0)
+        fanOut[min<int>(fanOutBuckets, bit_width(static_cast<unsigned>(children))) - 1]++;
+}
+
+IndexStats &IndexStats::operator+=(const IndexStats &other) {
+    keys += other.keys;
+    if (nodesPerLevel.size() < other.nodesPerLevel.size())
+        nodesPerLevel.resize(other.nodesPerLevel.size());
+    for (size_t level = 0; level < other.nodesPerLevel.size(); level++)
+        nodesPerLevel[level] += other.nodesPerLevel[level];
+    for (int i = 0; i < fillBuckets; i++)
+        fill[i] += other.fill[i];
+    for (int i = 0; i < fanOutBuckets; i++)
+        fanOut[i] += other.fanOut[i];
+    nodeBytes += other.nodeBytes;
+    allocatedBytes += other.allocatedBytes;
+    freeBytes += other.freeBytes;
+    return *this;
+}
+
+ostream &operator<<(ostream &out, const IndexStats &stats) {
+    out << stats.keys << " keys, " << stats.bytesPerKey() << " bytes per key, height " << stats.height() << "\n";
+    out << "  nodes per level:";
+    for (const size_t n: stats.nodesPerLevel)
+        out << " " << n;
+    out << "\n  fill:";
+    for (int i = 0; i < IndexStats::fillBuckets; i++)
+        out << " " << i * 10 << "%: " << stats.fill[i];
+    if (any_of(stats.fanOut.begin(), stats.fanOut.end(), [](const size_t n) { return n > 0; })) {
+        out << "\n  fan-out:";
+        for (int i = 0; i < IndexStats::fanOutBuckets; i++) {
+            const int low = 1 << i;
+            out << " " << low;
+            if (i > 0 && i + 1 < IndexStats::fanOutBuckets)
+                out << "-" << 2 * low - 1;
+            out << ": " << stats.fanOut[i];
+        }
+    }
+    return out << "\n  bytes: " << stats.nodeBytes << " in nodes, " << stats.allocatedBytes << " allocated, "
+               << stats.overheadBytes() << " overhead (" << stats.freeBytes << " free)\n";
+}
@@ -0,0 +1,50 @@
+#ifndef INDEX_STATS_H
+#define INDEX_STATS_H
+
+#include <array>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// Shape and memory footprint of an index, as returned by BPlusTree::stats, stats(Trie *) and ShardedIndex::stats.
+// Levels count from the root down; a trie node's level is the number of nodes above it, whatever key byte it branches
+// on, so the levels of a trie are ragged where paths are compressed.
+struct IndexStats {
+    static constexpr int fillBuckets = 10;
+    static constexpr int fanOutBuckets = 9;
+
+    size_t keys = 0;
+    std::vector<size_t> nodesPerLevel;
+    // Nodes by how full they are: fill[i] counts those holding i / 10 up to (i + 1) / 10 of their capacity, fill[9]
+    // the full ones as well. A compressed B+ tree leaf's capacity is that of its own encoding, a trie node's that of
+    // its layout (4, 16, 48 or 256).
+    std::array<size_t, fillBuckets> fill{};
+    // Trie nodes by their number of children (values on the last level): fanOut[i] counts those with 2^i up to
+    // 2^(i + 1) - 1, so fanOut[8] holds the nodes with all 256. Zero for B+ trees.
+    std::array<size_t, fanOutBuckets> fanOut{};
+    // Bytes of the nodes reachable from the root.
+    size_t nodeBytes = 0;
+    // Everything the index holds on to: the arena chunks it mapped plus side structures such as a hot-key cache.
+    size_t allocatedBytes = 0;
+    // Of allocatedBytes, arena memory not handed out to any node: freed blocks kept for reuse and the unused rest of
+    // the last chunk.
+    size_t freeBytes = 0;
+
+    size_t height() const { return nodesPerLevel.size(); }
+    size_t nodes() const;
+    // Allocated bytes per key, which is what a host has to provide; 0 for an empty index.
+    double bytesPerKey() const;
+    // Bytes allocated beyond the nodes themselves: free arena memory, rounding nodes up to whole cache lines, nodes
+    // still waiting for epoch reclamation and side structures.
+    size_t overheadBytes() const { return allocatedBytes - nodeBytes; }
+
+    // Counts a node of level with count of capacity entries; children is its fan-out, or 0 to leave it out of fanOut.
+    void addNode(size_t level, size_t bytes, int count, int capacity, int children = 0);
+    // Sums the statistics of two indexes, level by level.
+    IndexStats &operator+=(const IndexStats &other);
+};
+
+// A few lines summing up stats.
+std::ostream &operator<<(std::ostream &out, const IndexStats &stats);
+
+#endif // INDEX_STATS_H
@@ -0,0 +1,243 @@
+#include <immintrin.h>
+
+#include "key_search.h"
+
+template<typename Key>
+static int scalarUpperBound(const Key *keys, const int count, const Key key) {
+    int n = 0;
+    for (int i = 0; i < count; i++)
+        n += keys[i] <= key;
+    return n;
+}
+
+template<typename Key>
+static int scalarLowerBound(const Key *keys, const int count, const Key key) {
+    int n = 0;
+    for (int i = 0; i < count; i++)
+        n += keys[i] < key;
+    return n;
+}
+
+// The SIMD compares are signed, so keys and probe get their sign bit flipped to compare as unsigned.
+
+__attribute__((target("sse4.2,popcnt"))) static int sseCount(const uint32_t *keys, const int count,
+                                                               const uint32_t key, const bool orEqual) {
+    const __m128i flip = _mm_set1_epi32(INT32_MIN);
+    const __m128i probe = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(key)), flip);
+    int n = 0;
+    for (int i = 0; i < count; i += 4) {
+        const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i)), flip);
+        // orEqual counts !(v > probe), otherwise probe > v
+        const __m128i hit = orEqual ? _mm_xor_si128(_mm_cmpgt_epi32(v, probe), _mm_set1_epi32(-1))
+                                    : _mm_cmpgt_epi32(probe, v);
+        const int valid = count - i >= 4 ? 0xf : (1 << (count - i)) - 1;
+        n += _mm_popcnt_u32(_mm_movemask_ps(_mm_castsi128_ps(hit)) & valid);
+    }
+    return n;
+}
+
+__attribute__((target("avx2,popcnt"))) static int avx2Count(const uint32_t *keys, const int count,
+                                                              const uint32_t key, const bool orEqual) {
+    const __m256i flip = _mm256_set1_epi32(INT32_MIN);
+    const __m256i probe = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(key)), flip);
+    int n = 0;
+    for (int i = 0; i < count; i += 8) {
+        const __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)), flip);
+        const __m256i hit = orEqual ? _mm256_xor_si256(_mm256_cmpgt_epi32(v, probe), _mm256_set1_epi32(-1))
+                                    : _mm256_cmpgt_epi32(probe, v);
+        const int valid = count - i >= 8 ? 0xff : (1 << (count - i)) - 1;
+        n += _mm_popcnt_u32(_mm256_movemask_ps(_mm256_castsi256_ps(hit)) & valid);
+    }
+    return n;
+}
+
+__attribute__((target("sse4.2,popcnt"))) static int sseCount64(const uint64_t *keys, const int count,
+                                                                 const uint64_t key, const bool orEqual) {
+    const __m128i flip = _mm_set1_epi64x(INT64_MIN);
+    const __m128i probe = _mm_xor_si128(_mm_set1_epi64x(static_cast<long long>(key)), flip);
+    int n = 0;
+    for (int i = 0; i < count; i += 2) {
+        const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i)), flip);
+        const __m128i hit = orEqual ? _mm_xor_si128(_mm_cmpgt_epi64(v, probe), _mm_set1_epi32(-1))
+                                    : _mm_cmpgt_epi64(probe, v);
+        const int valid = count - i >= 2 ? 0x3 : 0x1;
+        n += _mm_popcnt_u32(_mm_movemask_pd(_mm_castsi128_pd(hit)) & valid);
+    }
+    return n;
+}
+
+__attribute__((target("avx2,popcnt"))) static int avx2Count64(const uint64_t *keys, const int count,
+                                                                const uint64_t key, const bool orEqual) {
+    const __m256i flip = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i probe = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(key)), flip);
+    int n = 0;
+    for (int i = 0; i < count; i += 4) {
+        const __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)), flip);
+        const __m256i hit = orEqual ? _mm256_xor_si256(_mm256_cmpgt_epi64(v, probe), _mm256_set1_epi32(-1))
+                                    : _mm256_cmpgt_epi64(probe, v);
+        const int valid = count - i >= 4 ? 0xf : (1 << (count - i)) - 1;
+        n += _mm_popcnt_u32(_mm256_movemask_pd(_mm256_castsi256_pd(hit)) & valid);
+    }
+    return n;
+}
+
+// The narrow kernels get one movemask bit per key byte, so 16-bit keys count twice.
+
+__attribute__((target("sse4.2,popcnt"))) static int sseCount16(const uint16_t *keys, const int count,
+                                                                 const uint16_t key, const bool orEqual) {
+    const __m128i flip = _mm_set1_epi16(INT16_MIN);
+    const __m128i probe = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(key)), flip);
+    int n = 0;
+    for (int i = 0; i < count; i += 8) {
+        const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i)), flip);
+        const __m128i hit = orEqual ? _mm_xor_si128(_mm_cmpgt_epi16(v, probe), _mm_set1_epi32(-1))
+                                    : _mm_cmpgt_epi16(probe, v);
+        const int valid = count - i >= 8 ? 0xffff : (1 << 2 * (count - i)) - 1;
+        n += _mm_popcnt_u32(_mm_movemask_epi8(hit) & valid);
+    }
+    return n / 2;
+}
+
+__attribute__((target("sse4.2,popcnt"))) static int sseCount8(const uint8_t *keys, const int count, const uint8_t key,
+                                                                const bool orEqual) {
+    const __m128i flip = _mm_set1_epi8(INT8_MIN);
+    const __m128i probe = _mm_xor_si128(_mm_set1_epi8(static_cast<char>(key)), flip);
+    int n = 0;
+    for (int i = 0; i < count; i += 16) {
+        const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i)), flip);
+        const __m128i hit = orEqual ? _mm_xor_si128(_mm_cmpgt_epi8(v, probe), _mm_set1_epi32(-1))
+                                    : _mm_cmpgt_epi8(probe, v);
+        const int valid = count - i >= 16 ? 0xffff : (1 << (count - i)) - 1;
+        n += _mm_popcnt_u32(_mm_movemask_epi8(hit) & valid);
+    }
+    return n;
+}
+
+__attribute__((target("avx2,popcnt"))) static int avx2Count16(const uint16_t *keys, const int count,
+                                                                const uint16_t key, const bool orEqual) {
+    const __m256i flip = _mm256_set1_epi16(INT16_MIN);
+    const __m256i probe = _mm256_xor_si256(_mm256_set1_epi16(static_cast<short>(key)), flip);
+    int n = 0;
+    for (int i = 0; i < count; i += 16) {
+        const __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)), flip);
+        const __m256i hit = orEqual ? _mm256_xor_si256(_mm256_cmpgt_epi16(v, probe), _mm256_set1_epi32(-1))
+                                    : _mm256_cmpgt_epi16(probe, v);
+        const unsigned valid = count - i >= 16 ? ~0u : (1u << 2 * (count - i)) - 1;
+        n += _mm_popcnt_u32(static_cast<unsigned>(_mm256_movemask_epi8(hit)) & valid);
+    }
+    return n / 2;
+}
+
+__attribute__((target("avx2,popcnt"))) static int avx2Count8(const uint8_t *keys, const int count, const uint8_t key,
+                                                               const bool orEqual) {
+    const __m256i flip = _mm256_set1_epi8(INT8_MIN);
+    const __m256i probe = _mm256_xor_si256(_mm256_set1_epi8(static_cast<char>(key)), flip);
+    int n = 0;
+    for (int i = 0; i < count; i += 32) {
+        const __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)), flip);
+        const __m256i hit = orEqual ? _mm256_xor_si256(_mm256_cmpgt_epi8(v, probe), _mm256_set1_epi32(-1))
+                                    : _mm256_cmpgt_epi8(probe, v);
+        const unsigned valid = count - i >= 32 ? ~0u : (1u << (count - i)) - 1;
+        n += _mm_popcnt_u32(static_cast<unsigned>(_mm256_movemask_epi8(hit)) & valid);
+    }
+    return n;
+}
+
+static int sseUpperBound(const uint32_t *keys, const int count, const uint32_t key) {
+    return sseCount(keys, count, key, true);
+}
+
+static int sseLowerBound(const uint32_t *keys, const int count, const uint32_t key) {
+    return sseCount(keys, count, key, false);
+}
+
+static int avx2UpperBound(const uint32_t *keys, const int count, const uint32_t key) {
+    return avx2Count(keys, count, key, true);
+}
+
+static int avx2LowerBound(const uint32_t *keys, const int count, const uint32_t key) {
+    return avx2Count(keys, count, key, false);
+}
+
+static int sseUpperBound64(const uint64_t *keys, const int count, const uint64_t key) {
+    return sseCount64(keys, count, key, true);
+}
+
+static int sseLowerBound64(const uint64_t *keys, const int count, const uint64_t key) {
+    return sseCount64(keys, count, key, false);
+}
+
+static int avx2UpperBound64(const uint64_t *keys, const int count, const uint64_t key) {
+    return avx2Count64(keys, count, key, true);
+}
+
+static int avx2LowerBound64(const uint64_t *keys, const int count, const uint64_t key) {
+    return avx2Count64(keys, count, key, false);
+}
+
+static int sseUpperBound16(const uint16_t *keys, const int count, const uint16_t key) {
+    return sseCount16(keys, count, key, true);
+}
+
+static int sseLowerBound16(const uint16_t *keys, const int count, const uint16_t key) {
+    return sseCount16(keys, count, key, false);
+}
+
+static int sseUpperBound8(const uint8_t *keys, const int count, const uint8_t key) {
+    return sseCount8(keys, count, key, true);
+}
+
+static int sseLowerBound8(const uint8_t *keys, const int count, const uint8_t key) {
+    return sseCount8(keys, count, key, false);
+}
+
+static int avx2UpperBound16(const uint16_t *keys, const int count, const uint16_t key) {
+    return avx2Count16(keys, count, key, true);
+}
+
+static int avx2LowerBound16(const uint16_t *keys, const int count, const uint16_t key) {
+    return avx2Count16(keys, count, key, false);
+}
+
+static int avx2UpperBound8(const uint8_t *keys, const int count, const uint8_t key) {
+    return avx2Count8(keys, count, key, true);
+}
+
+static int avx2LowerBound8(const uint8_t *keys, const int count, const uint8_t key) {
+    return avx2Count8(keys, count, key, false);
+}
+
+enum class Isa { Scalar, Sse, Avx2 };
+
+static Isa detectIsa() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        return Isa::Avx2;
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        return Isa::Sse;
+    return Isa::Scalar;
+}
+
+static const Isa isa = detectIsa();
+
+int (*vectorUpperBound)(const uint32_t *, int, uint32_t) =
+        isa == Isa::Avx2 ? avx2UpperBound : isa == Isa::Sse ? sseUpperBound : scalarUpperBound<uint32_t>;
+int (*vectorLowerBound)(const uint32_t *, int, uint32_t) =
+        isa == Isa::Avx2 ? avx2LowerBound : isa == Isa::Sse ? sseLowerBound : scalarLowerBound<uint32_t>;
+int (*vectorUpperBound64)(const uint64_t *, int, uint64_t) =
+        isa == Isa::Avx2 ? avx2UpperBound64 : isa == Isa::Sse ? sseUpperBound64 : scalarUpperBound<uint64_t>;
+int (*vectorLowerBound64)(const uint64_t *, int, uint64_t) =
+        isa == Isa::Avx2 ? avx2LowerBound64 : isa == Isa::Sse ? sseLowerBound64 : scalarLowerBound<uint64_t>;
+int (*vectorUpperBound16)(const uint16_t *, int, uint16_t) =
+        isa == Isa::Avx2 ? avx2UpperBound16 : isa == Isa::Sse ? sseUpperBound16 : scalarUpperBound<uint16_t>;
+int (*vectorLowerBound16)(const uint16_t *, int, uint16_t) =
+        isa == Isa::Avx2 ? avx2LowerBound16 : isa == Isa::Sse ? sseLowerBound16 : scalarLowerBound<uint16_t>;
+int (*vectorUpperBound8)(const uint8_t *, int, uint8_t) =
+        isa == Isa::Avx2 ? avx2UpperBound8 : isa == Isa::Sse ? sseUpperBound8 : scalarUpperBound<uint8_t>;
+int (*vectorLowerBound8)(const uint8_t *, int, uint8_t) =
+        isa == Isa::Avx2 ? avx2LowerBound8 : isa == Isa::Sse ? sseLowerBound8 : scalarLowerBound<uint8_t>;
+
+const char *vectorSearchIsa() {
+    static const char *names[] = {"scalar", "sse4.2", "avx2"};
+    return names[static_cast<int>(isa)];
+}
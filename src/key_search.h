@@ -0,0 +1,100 @@
+#ifndef KEY_SEARCH_H
+#define KEY_SEARCH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+// How a node locates a probe among its sorted keys. Binary uses std::upper_bound/lower_bound. Vector compares every
+// key against the probe in SIMD registers and counts the hits, which needs no data-dependent branches; the kernel
+// (AVX2, SSE or plain scalar) is picked once at startup from what the CPU supports.
+enum class KeySearch { Binary, Vector };
+
+// Vector kernels read whole 32-byte groups of keys, so key arrays must stay readable up to the next multiple of 32
+// bytes. The 64-bit variants search 64-bit keys, the 8- and 16-bit ones the narrow key offsets of compressed nodes.
+extern int (*vectorUpperBound)(const uint32_t *keys, int count, uint32_t key);
+extern int (*vectorLowerBound)(const uint32_t *keys, int count, uint32_t key);
+extern int (*vectorUpperBound64)(const uint64_t *keys, int count, uint64_t key);
+extern int (*vectorLowerBound64)(const uint64_t *keys, int count, uint64_t key);
+extern int (*vectorUpperBound16)(const uint16_t *keys, int count, uint16_t key);
+extern int (*vectorLowerBound16)(const uint16_t *keys, int count, uint16_t key);
+extern int (*vectorUpperBound8)(const uint8_t *keys, int count, uint8_t key);
+extern int (*vectorLowerBound8)(const uint8_t *keys, int count, uint8_t key);
+const char *vectorSearchIsa();
+
+// Number of keys <= key, i.e. the child to descend into.
+inline int upperBound(const KeySearch mode, const uint32_t *keys, const int count, const uint32_t key) {
+    if (mode == KeySearch::Vector)
+        return vectorUpperBound(keys, count, key);
+    return static_cast<int>(std::upper_bound(keys, keys + count, key) - keys);
+}
+
+// Number of keys < key, i.e. where key is or would be stored.
+inline int lowerBound(const KeySearch mode, const uint32_t *keys, const int count, const uint32_t key) {
+    if (mode == KeySearch::Vector)
+        return vectorLowerBound(keys, count, key);
+    return static_cast<int>(std::lower_bound(keys, keys + count, key) - keys);
+}
+
+inline int upperBound(const KeySearch mode, const uint64_t *keys, const int count, const uint64_t key) {
+    if (mode == KeySearch::Vector)
+        return vectorUpperBound64(keys, count, key);
+    return static_cast<int>(std::upper_bound(keys, keys + count, key) - keys);
+}
+
+inline int lowerBound(const KeySearch mode, const uint64_t *keys, const int count, const uint64_t key) {
+    if (mode == KeySearch::Vector)
+        return vectorLowerBound64(keys, count, key);
+    return static_cast<int>(std::lower_bound(keys, keys + count, key) - keys);
+}
+
+inline int upperBound(const KeySearch mode, const uint16_t *keys, const int count, const uint16_t key) {
+    if (mode == KeySearch::Vector)
+        return vectorUpperBound16(keys, count, key);
+    return static_cast<int>(std::upper_bound(keys, keys + count, key) - keys);
+}
+
+inline int lowerBound(const KeySearch mode, const uint16_t *keys, const int count, const uint16_t key) {
+    if (mode == KeySearch::Vector)
+        return vectorLowerBound16(keys, count, key);
+    return static_cast<int>(std::lower_bound(keys, keys + count, key) - keys);
+}
+
+inline int upperBound(const KeySearch mode, const uint8_t *keys, const int count, const uint8_t key) {
+    if (mode == KeySearch::Vector)
+        return vectorUpperBound8(keys, count, key);
+    return static_cast<int>(std::upper_bound(keys, keys + count, key) - keys);
+}
+
+inline int lowerBound(const KeySearch mode, const uint8_t *keys, const int count, const uint8_t key) {
+    if (mode == KeySearch::Vector)
+        return vectorLowerBound8(keys, count, key);
+    return static_cast<int>(std::lower_bound(keys, keys + count, key) - keys);
+}
+
+// Whether keys of type Key ordered by Compare can use the vector kernels: 32- and 64-bit unsigned keys in their
+// natural order.
+template<typename Key, typename Compare>
+inline constexpr bool vectorSearchable =
+        (std::is_same_v<Key, uint32_t> || std::is_same_v<Key, uint64_t>) &&
+        (std::is_same_v<Compare, std::less<Key>> || std::is_same_v<Compare, std::less<>>);
+
+// Any other key type or order is searched by binary search under compare, whatever the mode.
+template<typename Key, typename Compare>
+int upperBound(const KeySearch mode, const Key *keys, const int count, const Key &key, const Compare &compare) {
+    if constexpr (vectorSearchable<Key, Compare>)
+        return upperBound(mode, keys, count, key);
+    else
+        return static_cast<int>(std::upper_bound(keys, keys + count, key, compare) - keys);
+}
+
+template<typename Key, typename Compare>
+int lowerBound(const KeySearch mode, const Key *keys, const int count, const Key &key, const Compare &compare) {
+    if constexpr (vectorSearchable<Key, Compare>)
+        return lowerBound(mode, keys, count, key);
+    else
+        return static_cast<int>(std::lower_bound(keys, keys + count, key, compare) - keys);
+}
+
+#endif // KEY_SEARCH_H
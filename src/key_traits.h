@@ -0,0 +1,93 @@
+#ifndef KEY_TRAITS_H
+#define KEY_TRAITS_H
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Fixed-length byte string key, ordered like memcmp. Shorter strings are padded with zero bytes, so strings without
+// zero bytes keep their order. Trailing zero bytes are not significant: "ab" and "ab\0" are the same key.
+template<size_t N>
+struct ByteKey {
+    uint8_t bytes[N] = {};
+
+    // Throws std::length_error for strings longer than N bytes instead of cutting them off, which would make
+    // different strings the same key.
+    static ByteKey from(const std::string_view text) {
+        if (text.size() > N)
+            throw std::length_error("key of " + std::to_string(text.size()) + " bytes is longer than " +
+                                    std::to_string(N));
+        ByteKey key;
+        memcpy(key.bytes, text.data(), text.size());
+        return key;
+    }
+
+    // The string without its padding.
+    std::string_view view() const {
+        size_t length = N;
+        while (length > 0 && bytes[length - 1] == 0)
+            length--;
+        return {reinterpret_cast<const char *>(bytes), length};
+    }
+
+    friend bool operator==(const ByteKey &a, const ByteKey &b) { return memcmp(a.bytes, b.bytes, N) == 0; }
+    friend std::strong_ordering operator<=>(const ByteKey &a, const ByteKey &b) {
+        return memcmp(a.bytes, b.bytes, N) <=> 0;
+    }
+    friend std::ostream &operator<<(std::ostream &out, const ByteKey &key) { return out << key.view(); }
+};
+
+// How a key splits into bytes, most significant first, so byte order is key order. The trie walks keys through
+// these; unsigned integers and ByteKey have them.
+template<typename Key>
+struct KeyTraits {
+    static_assert(std::is_unsigned_v<Key>, "keys are unsigned integers or ByteKey");
+    static constexpr int bytes = sizeof(Key);
+
+    static uint8_t byteAt(const Key key, const int i) { return static_cast<uint8_t>(key >> 8 * (bytes - 1 - i)); }
+
+    // The bytes of key before i, then byte, then zero bytes: the smallest key below the prefix ending in byte.
+    static Key withByte(const Key key, const int i, const uint8_t byte) {
+        const int shift = 8 * (bytes - 1 - i);
+        const auto above = static_cast<Key>(~uint64_t{0} << shift << 8);
+        return static_cast<Key>((key & above) | static_cast<uint64_t>(byte) << shift);
+    }
+};
+
+template<size_t N>
+struct KeyTraits<ByteKey<N>> {
+    static constexpr int bytes = N;
+
+    static uint8_t byteAt(const ByteKey<N> &key, const int i) { return key.bytes[i]; }
+
+    static ByteKey<N> withByte(ByteKey<N> key, const int i, const uint8_t byte) {
+        key.bytes[i] = byte;
+        memset(key.bytes + i + 1, 0, N - i - 1);
+        return key;
+    }
+};
+
+// Compressed nodes of both structures store a value next to an integer key as its difference to the key when that
+// is small. The difference is taken in the wider of the two types and wraps around like it.
+template<typename Key, typename Value>
+using DeltaWord = std::conditional_t<(sizeof(Key) > sizeof(Value)), Key, Value>;
+
+template<typename Key, typename Value>
+int64_t valueDelta(const Key key, const Value value) {
+    using Word = DeltaWord<Key, Value>;
+    return static_cast<std::make_signed_t<Word>>(static_cast<Word>(value) - static_cast<Word>(key));
+}
+
+template<typename Key, typename Value>
+Value addDelta(const Key key, const int64_t delta) {
+    using Word = DeltaWord<Key, Value>;
+    return static_cast<Value>(static_cast<Word>(static_cast<Word>(key) + static_cast<Word>(delta)));
+}
+
+#endif // KEY_TRAITS_H
@@ -0,0 +1,45 @@
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#include "latency_histogram.h"
+
+using namespace std;
+
+uint64_t LatencyHistogram::percentile(const double fraction) const {
+    if (total == 0)
+        return 0;
+    const auto rank = max<uint64_t>(1, static_cast<uint64_t>(ceil(fraction * static_cast<double>(total))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen < rank)
+            continue;
+        if (i < subBuckets)
+            return i;
+        // Bucket i covers [base, base + width) with base = (subBuckets + sub) << shift and width = 1 << shift
+        const int shift = static_cast<int>(i / subBuckets) - 1;
+        const uint64_t sub = i % subBuckets;
+        return ((subBuckets + sub + 1) << shift) - 1;
+    }
+    return UINT64_MAX;
+}
+
+static double calibrate() {
+#if defined(__x86_64__)
+    const auto start = chrono::steady_clock::now();
+    const uint64_t startTicks = readTicks();
+    this_thread::sleep_for(chrono::milliseconds(20));
+    const uint64_t endTicks = readTicks();
+    const auto end = chrono::steady_clock::now();
+    return static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(end - start).count()) /
+           static_cast<double>(endTicks - startTicks);
+#else
+    return 1e9 * chrono::steady_clock::period::num / chrono::steady_clock::period::den;
+#endif
+}
+
+double nanosecondsPerTick() {
+    static const double perTick = calibrate();
+    return perTick;
+}
@@ -0,0 +1,63 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Log-linear histogram of operation latencies in nanoseconds: exact below 16, above that 16 buckets per power of two,
+// so every percentile comes out within 1/16 of its true value. Threads record into histograms of their own, which
+// are merged afterwards.
+class LatencyHistogram {
+public:
+    void record(const uint64_t nanoseconds) {
+        buckets[bucketOf(nanoseconds)]++;
+        total++;
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < buckets.size(); i++)
+            buckets[i] += other.buckets[i];
+        total += other.total;
+    }
+
+    uint64_t count() const { return total; }
+
+    // The latency that fraction (0.99 for p99) of the recorded ones do not exceed, rounded up to the end of its
+    // bucket; 0 if nothing was recorded.
+    uint64_t percentile(double fraction) const;
+
+private:
+    static constexpr int subBits = 4;
+    static constexpr int subBuckets = 1 << subBits;
+
+    std::array<uint64_t, 64 * subBuckets> buckets{};
+    uint64_t total = 0;
+
+    static int bucketOf(const uint64_t value) {
+        if (value < subBuckets)
+            return static_cast<int>(value);
+        const int exponent = 63 - std::countl_zero(value);
+        const int sub = static_cast<int>(value >> (exponent - subBits) & (subBuckets - 1));
+        return (exponent - subBits + 1) * subBuckets + sub;
+    }
+};
+
+// Timestamps for timing single operations, cheaper to take than steady_clock: the TSC on x86-64, steady_clock
+// elsewhere. nanosecondsPerTick converts their differences; it is measured against steady_clock on first use.
+inline uint64_t readTicks() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+double nanosecondsPerTick();
+
+#endif // LATENCY_HISTOGRAM_H
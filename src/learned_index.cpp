@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <limits>
+
+#include "key_search.h"
+#include "learned_index.h"
+#include "node_layout.h"
+
+using namespace std;
+
+// Keys predicted together by queryBatch.
+static constexpr size_t batchGroup = 16;
+
+// Vector kernels may read up to 32 bytes past the last key of a window.
+template<typename Key>
+static constexpr size_t padding = 32 / sizeof(Key);
+
+template<typename Key, typename Value>
+LearnedIndex<Key, Value>::LearnedIndex(const span<const Entry> sorted) {
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (i + 1 == sorted.size() || sorted[i].first < sorted[i + 1].first) {
+            keys.push_back(sorted[i].first);
+            values.push_back(sorted[i].second);
+        }
+    }
+    count = keys.size();
+    if (count == 0)
+        return;
+    keys.resize(count + padding<Key>);
+
+    levels.push_back(fit(keys.data(), count, epsilon));
+    while (levels.back().segments.size() > 1) {
+        const Level &below = levels.back();
+        levels.push_back(fit(below.firstKeys.data(), below.segments.size(), innerEpsilon));
+    }
+}
+
+template<typename Key, typename Value>
+typename LearnedIndex<Key, Value>::Level LearnedIndex<Key, Value>::fit(const Key *points, const size_t n,
+                                                                        const int error) {
+    // The cone is kept a position narrower than error, which leaves room for rounding the predictions
+    const double bound = error - 1;
+    Level level;
+    size_t i = 0;
+    while (i < n) {
+        const size_t start = i;
+        const auto first = static_cast<double>(points[start]);
+        double low = -numeric_limits<double>::infinity();
+        double high = numeric_limits<double>::infinity();
+        for (i++; i < n; i++) {
+            const double dx = static_cast<double>(points[i]) - first;
+            const auto dy = static_cast<double>(i - start);
+            const double newLow = max(low, (dy - bound) / dx);
+            const double newHigh = min(high, (dy + bound) / dx);
+            if (newLow > newHigh)
+                break;
+            low = newLow;
+            high = newHigh;
+        }
+        // high is positive once the segment has two points, so a slope of at least 0 is always in the cone
+        const double slope = i - start == 1 ? 0 : max(0.0, (low + high) / 2);
+        level.firstKeys.push_back(points[start]);
+        level.segments.push_back({slope, start});
+    }
+    level.firstKeys.resize(level.firstKeys.size() + padding<Key>);
+    return level;
+}
+
+template<typename Key, typename Value>
+size_t LearnedIndex<Key, Value>::predict(const Level &level, const size_t segment, const Key &key,
+                                         const size_t below) {
+    const Segment &s = level.segments[segment];
+    const double offset = static_cast<double>(key) - static_cast<double>(level.firstKeys[segment]);
+    const double predicted = static_cast<double>(s.start) + s.slope * offset + 0.5;
+    if (!(predicted > 0))
+        return 0;
+    return predicted >= static_cast<double>(below) ? below : static_cast<size_t>(predicted);
+}
+
+template<typename Key, typename Value>
+size_t LearnedIndex<Key, Value>::predictPosition(const Key &key) const {
+    size_t segment = 0;
+    for (size_t level = levels.size() - 1; level > 0; level--) {
+        const Level &below = levels[level - 1];
+        const size_t n = below.segments.size();
+        const size_t at = searchNear<true>(below.firstKeys.data(), n, predict(levels[level], segment, key, n),
+                                           innerEpsilon, key);
+        // The last segment starting at or below key; keys below the first one are predicted by it as well
+        segment = at == 0 ? 0 : at - 1;
+    }
+    return predict(levels[0], segment, key, count);
+}
+
+template<typename Key, typename Value>
+template<bool upper>
+size_t LearnedIndex<Key, Value>::searchNear(const Key *points, const size_t n, const size_t predicted,
+                                            const int error, const Key &key) {
+    const size_t low = predicted > static_cast<size_t>(error) + 1 ? predicted - error - 1 : 0;
+    const size_t high = min(n, predicted + error + 2);
+    // Whether a point comes before the position searched for
+    auto before = [&](const Key &point) { return upper ? !(key < point) : point < key; };
+    if (low < high && (low == 0 || before(points[low - 1])) && (high == n || !before(points[high]))) {
+        const int window = static_cast<int>(high - low);
+        return low + (upper ? upperBound(KeySearch::Vector, points + low, window, key)
+                            : lowerBound(KeySearch::Vector, points + low, window, key));
+    }
+    return upper ? upper_bound(points, points + n, key) - points : lower_bound(points, points + n, key) - points;
+}
+
+template<typename Key, typename Value>
+template<bool upper>
+size_t LearnedIndex<Key, Value>::position(const Key &key) const {
+    return searchNear<upper>(keys.data(), count, predictPosition(key), epsilon, key);
+}
+
+template<typename Key, typename Value>
+Value LearnedIndex<Key, Value>::query(const Key &key) const {
+    if (count == 0)
+        return Value{};
+    const size_t at = position<false>(key);
+    return at < count && keys[at] == key ? values[at] : Value{};
+}
+
+template<typename Key, typename Value>
+void LearnedIndex<Key, Value>::queryBatch(const span<const Key> batch, const span<Value> out) const {
+    if (count == 0) {
+        fill_n(out.begin(), batch.size(), Value{});
+        return;
+    }
+    for (size_t first = 0; first < batch.size(); first += batchGroup) {
+        const size_t size = min(batchGroup, batch.size() - first);
+        size_t predicted[batchGroup];
+        for (size_t i = 0; i < size; i++) {
+            predicted[i] = predictPosition(batch[first + i]);
+            // The window spans a few lines around the prediction
+            const size_t low = predicted[i] > epsilon ? predicted[i] - epsilon : 0;
+            for (size_t at = low; at < min(count, predicted[i] + epsilon + 1); at += cacheLine / sizeof(Key))
+                __builtin_prefetch(keys.data() + at);
+            __builtin_prefetch(values.data() + min(predicted[i], count - 1));
+        }
+        for (size_t i = 0; i < size; i++) {
+            const Key &key = batch[first + i];
+            const size_t at = searchNear<false>(keys.data(), count, predicted[i], epsilon, key);
+            out[first + i] = at < count && keys[at] == key ? values[at] : Value{};
+        }
+    }
+}
+
+template<typename Key, typename Value>
+vector<typename LearnedIndex<Key, Value>::Entry> LearnedIndex<Key, Value>::range(const Key &low,
+                                                                                 const Key &high) const {
+    vector<Entry> result;
+    if (count == 0 || high < low)
+        return result;
+    const size_t end = position<true>(high);
+    for (size_t i = position<false>(low); i < end; i++)
+        result.emplace_back(keys[i], values[i]);
+    return result;
+}
+
+template<typename Key, typename Value>
+size_t LearnedIndex<Key, Value>::rangeCount(const Key &low, const Key &high) const {
+    if (count == 0 || high < low)
+        return 0;
+    return position<true>(high) - position<false>(low);
+}
+
+template<typename Key, typename Value>
+size_t LearnedIndex<Key, Value>::bytes() const {
+    size_t total = keys.size() * sizeof(Key) + values.size() * sizeof(Value);
+    for (const Level &level: levels)
+        total += level.firstKeys.size() * sizeof(Key) + level.segments.size() * sizeof(Segment);
+    return total;
+}
+
+template class LearnedIndex<uint32_t, uint32_t>;
+template class LearnedIndex<uint64_t, uint64_t>;
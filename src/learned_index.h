@@ -0,0 +1,77 @@
+#ifndef LEARNED_INDEX_H
+#define LEARNED_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Read-only index over sorted integer keys that predicts where a key sits instead of searching for it, in the manner
+// of the PGM-index (Ferragina and Vinciguerra, "The PGM-index"). The keys are covered by linear segments, each mapping
+// the keys from its first one up to the next segment's to positions with an error of at most epsilon, fitted in one
+// pass by shrinking the cone of slopes that keep every key of the segment within bounds. The first keys of the
+// segments are covered the same way with innerEpsilon, and so on until one segment is left. A lookup evaluates one
+// segment per level and searches the window of about 2 * epsilon keys around each prediction with the vector kernels.
+//
+// Dense keys take a single segment. Windows are checked against the keys just outside them, and a prediction that
+// rounding pushed too far falls back to binary search over the level, so lookups are exact whatever the input.
+//
+// Nothing changes after construction, so any number of threads may read at once. Instantiated for uint32_t and
+// uint64_t keys with values of the same type.
+template<typename Key = uint32_t, typename Value = uint32_t>
+class LearnedIndex {
+public:
+    static_assert(std::is_unsigned_v<Key>, "learned indexes need keys they can do arithmetic on");
+    using Entry = std::pair<Key, Value>;
+    static constexpr int epsilon = 16;
+    static constexpr int innerEpsilon = 4;
+
+    LearnedIndex() = default;
+    // Entries sorted by key; equal keys keep their last occurrence.
+    explicit LearnedIndex(std::span<const Entry> sorted);
+
+    // The value of key, or Value{} if it is missing.
+    Value query(const Key &key) const;
+    // Predicts the positions of a group of keys and prefetches them before searching any of their windows, so the
+    // misses on the key array overlap.
+    void queryBatch(std::span<const Key> keys, std::span<Value> out) const;
+    std::vector<Entry> range(const Key &low, const Key &high) const;
+    size_t rangeCount(const Key &low, const Key &high) const;
+    size_t size() const { return count; }
+    // Number of segments fitted over the keys, the lowest level.
+    size_t segments() const { return levels.empty() ? 0 : levels[0].segments.size(); }
+    // Bytes of the keys, values and every level of segments.
+    size_t bytes() const;
+
+private:
+    // Maps key >= first to position start + slope * (key - first) of the level below.
+    struct Segment {
+        double slope;
+        size_t start;
+    };
+    struct Level {
+        std::vector<Key> firstKeys; // padded like keys
+        std::vector<Segment> segments;
+    };
+
+    size_t count = 0;
+    std::vector<Key> keys; // padded past count, as the vector kernels read whole 32-byte groups
+    std::vector<Value> values;
+    std::vector<Level> levels; // levels[0] covers keys, the last one has a single segment
+
+    // Segments covering points, which are sorted and distinct, with at most error positions off.
+    static Level fit(const Key *points, size_t n, int error);
+    // Position of key in the level below, of size below, as predicted by segment of level.
+    static size_t predict(const Level &level, size_t segment, const Key &key, size_t below);
+    // Position of key in keys as predicted by the segments of every level on the way down.
+    size_t predictPosition(const Key &key) const;
+    // Number of points less than key (upper = false) or not greater than key (upper = true), searched around predicted.
+    template<bool upper>
+    static size_t searchNear(const Key *points, size_t n, size_t predicted, int error, const Key &key);
+    template<bool upper>
+    size_t position(const Key &key) const;
+};
+
+#endif // LEARNED_INDEX_H
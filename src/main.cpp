@@ -1,33 +1,138 @@
 #include <unistd.h>
 #include <cassert>
+#include <cmath>
 #include <cstring>
 #include <chrono>
 #include <ctime>
+#include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <mutex>
+#include <optional>
 #include <ostream>
 #include <random>
+#include <sstream>
 #include <thread>
 #include <atomic>
 #include <ranges>
+#include <span>
+#include <variant>
 #include "b_plus_tree.h"
+#include "cpu_affinity.h"
+#include "frozen_b_plus_tree.h"
+#include "hot_key_cache.h"
+#include "latency_histogram.h"
+#include "learned_index.h"
+#include "mapped_b_plus_tree.h"
+#include "parallel_sort.h"
+#include "perf_counters.h"
+#include "sharded_index.h"
 #include "trie.h"
-
-const int inserts_for_each_size = 500000;
-const int num_queries = 1000000;
-const int num_runs = 5;
-const double skew_degree = 0.00001;
+#include "versioned_b_plus_tree.h"
+#include "workload.h"
+
+// Settings of the benchmark suite; the command line can change these (see print_usage)
+int inserts_for_each_size = 500000;
+int num_queries = 1000000;
+int num_runs = 5;
+int warmup_runs = 1;
+double skew_degree = 0.00001;
+bool pin_threads = false;
+bool count_events = false; // hardware counters for every timed run
+int perf_ctl_fd = -1; // control and ack FIFOs of a perf stat --control run, -1 without one
+int perf_ctl_ack_fd = -1;
 const int window_size = 100;
+const int write_percent = 10;
+const int batch_size = 256;
+const int churn_percent = 50; // operations of the churn workload that erase or insert, half each
+const size_t hot_key_cache_entries = 1 << 16;
+// Threads every structure is bulk-loaded with
+const unsigned build_threads = std::max(1u, std::thread::hardware_concurrency());
+
+const char *const results_header = "structure,size,query_type,thread_level,time,p50,p99,p999,cycles,instructions,"
+                                   "l1d_misses,llc_misses,dtlb_misses,branch_misses,bytes_per_key";
+
+// What one benchmark row reports: the mean time of a run in nanoseconds per million operations, which graph.py turns
+// into throughput, where single operations were timed their latency percentiles in nanoseconds, with count_events
+// set the hardware events per operation, and the memory the structure held afterwards per key.
+struct Measurement {
+    long time = 0;
+    bool has_latency = false;
+    uint64_t p50 = 0;
+    uint64_t p99 = 0;
+    uint64_t p999 = 0;
+    bool has_counters = false;
+    PerfCounts counters; // all threads together
+    std::vector<PerfCounts> thread_counters; // each thread's events per operation of its own share
+    double bytes_per_key = std::nan(""); // NaN for structures that cannot tell
+};
+
+std::ostream &operator<<(std::ostream &out, const Measurement &measurement) { return out << measurement.time; }
+
+// One line of results.csv. Percentiles, events and footprints that were not measured are left empty.
+void write_row(std::ofstream &out, const std::string &structure, long size, const std::string &query_type,
+               int thread_level, const Measurement &measurement) {
+    out << structure << "," << size << "," << query_type << "," << thread_level << "," << measurement.time << ",";
+    if (measurement.has_latency)
+        out << measurement.p50 << "," << measurement.p99 << "," << measurement.p999;
+    else
+        out << ",,";
+    for (const double count: measurement.counters.counts) {
+        out << ",";
+        if (measurement.has_counters && !std::isnan(count))
+            out << count;
+    }
+    out << ",";
+    if (!std::isnan(measurement.bytes_per_key))
+        out << measurement.bytes_per_key;
+    out << "\n";
+}
 
+// Memory a structure holds per key, from its stats where it has them and its bytes otherwise; NaN for those that
+// keep no account, such as mapped trees. Walks every node, so it has to run while no benchmark threads do.
+template<typename Structure>
+double bytes_per_key(Structure &structure) {
+    if constexpr (requires { structure.stats(); })
+        return structure.stats().bytesPerKey();
+    else if constexpr (requires { stats(&structure); })
+        return stats(&structure).bytesPerKey();
+    else if constexpr (requires { structure.bytes(); })
+        return structure.size() ? static_cast<double>(structure.bytes()) / static_cast<double>(structure.size()) : 0;
+    else
+        return std::nan("");
+}
 
-template<typename Structure, typename QueryFn>
-long run_parallel_queries(Structure &data_structure, QueryFn query_fn, int num_queries, int num_threads,
-                         std::function<uint32_t()> key_gen) {
+// Hands the timed parts of the benchmark to a perf stat run started with --control and --delay=-1, so its counts
+// leave out building the structures.
+void start_perf(int perf_ctl_fd, int perf_ctl_ack_fd) {
+    write(perf_ctl_fd, "enable\n", 7);
+    char ack[5] = {};
+    read(perf_ctl_ack_fd, ack, 5);
+    assert(strcmp(ack, "ack\n") == 0);
+}
+
+void stop_perf(int perf_ctl_fd, int perf_ctl_ack_fd) {
+    write(perf_ctl_fd, "disable\n", 8);
+    char ack[5] = {};
+    read(perf_ctl_ack_fd, ack, 5);
+    assert(strcmp(ack, "ack\n") == 0);
+}
+
+// Times thread_fn over runs rounds of freshly generated keys, after warmups untimed ones. Every thread gets an equal
+// share of the keys, the first num_queries % num_threads threads one more, and with pin_threads set thread t runs on
+// the t-th CPU the process may use. With count_events set every thread counts hardware events around its share of the
+// timed runs. The keys have whatever type key_gen returns.
+template<typename ThreadFn, typename KeyGen>
+Measurement time_parallel(ThreadFn thread_fn, int num_queries, int num_threads, KeyGen key_gen, int runs = num_runs,
+                          int warmups = warmup_runs) {
+    using Key = decltype(key_gen());
+    const std::vector<int> cpus = allowedCpus();
     long total_time = 0;
+    std::vector<PerfCounts> thread_counts(num_threads);
 
-    for (int run = 0; run < num_runs; ++run) {
-        std::vector<uint32_t> keys(num_queries);
+    for (int run = -warmups; run < runs; ++run) {
+        std::vector<Key> keys(num_queries);
 
         // Generate all keys up front
         for (int i = 0; i < num_queries; ++i) {
@@ -35,24 +140,35 @@ long run_parallel_queries(Structure &data_structure, QueryFn query_fn, int num_q
         }
 
         std::vector<std::thread> threads;
-        int queries_per_thread = num_queries / num_threads;
+        const int queries_per_thread = num_queries / num_threads;
+        const int remainder = num_queries % num_threads;
         std::atomic<bool> start_flag(false);
 
         for (int t = 0; t < num_threads; ++t) {
-            threads.emplace_back([&, t]() {
-                int start_idx = t * queries_per_thread;
-                int end_idx = (t + 1) * queries_per_thread;
+            const int start_idx = t * queries_per_thread + std::min(t, remainder);
+            const int count = queries_per_thread + (t < remainder ? 1 : 0);
+            threads.emplace_back([&, t, start_idx, count]() {
+                if (pin_threads)
+                    pinThread(cpus[t % cpus.size()]);
+                std::optional<PerfCounters> counters;
+                if (count_events && run >= 0)
+                    counters.emplace();
 
                 // Wait until the start flag is set
                 while (!start_flag.load(std::memory_order_acquire));
 
-                for (int i = start_idx; i < end_idx; ++i) {
-                    uint32_t key = keys[i];
-                    volatile auto val = query_fn(data_structure, key);
+                if (counters)
+                    counters->start();
+                thread_fn(std::span<const Key>(keys).subspan(start_idx, count));
+                if (counters) {
+                    counters->stop();
+                    thread_counts[t] += counters->read();
                 }
             });
         }
 
+        if (perf_ctl_fd >= 0 && run >= 0)
+            start_perf(perf_ctl_fd, perf_ctl_ack_fd);
         auto start = std::chrono::high_resolution_clock::now();
         start_flag.store(true, std::memory_order_release);
 
@@ -61,44 +177,134 @@ long run_parallel_queries(Structure &data_structure, QueryFn query_fn, int num_q
         }
 
         auto end = std::chrono::high_resolution_clock::now();
+        if (perf_ctl_fd >= 0 && run >= 0)
+            stop_perf(perf_ctl_fd, perf_ctl_ack_fd);
         auto diff = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
-        total_time += static_cast<long>(diff.count());
+        if (run >= 0)
+            total_time += static_cast<long>(diff.count());
+    }
+
+    Measurement measurement;
+    measurement.time = static_cast<long>(static_cast<double>(total_time) / runs * 1e6 / num_queries);
+    if (count_events) {
+        measurement.has_counters = true;
+        for (int t = 0; t < num_threads; ++t) {
+            measurement.counters += thread_counts[t];
+            const int count = num_queries / num_threads + (t < num_queries % num_threads ? 1 : 0);
+            measurement.thread_counters.push_back(thread_counts[t] / (static_cast<double>(runs) * std::max(count, 1)));
+        }
+        measurement.counters = measurement.counters / (static_cast<double>(runs) * num_queries);
     }
+    return measurement;
+}
+
+// Times query_fn over the keys of key_gen. Workloads that write use this on its own, so that only the timed runs
+// write to the structure and nothing outside them changes what later rows measure.
+template<typename Structure, typename QueryFn, typename KeyGen>
+Measurement time_queries(Structure &data_structure, QueryFn query_fn, int num_queries, int num_threads,
+                         KeyGen key_gen) {
+    Measurement measurement = time_parallel(
+            [&](auto keys) {
+                for (const auto &key: keys) {
+                    [[maybe_unused]] volatile auto val = query_fn(data_structure, key);
+                }
+            },
+            num_queries, num_threads, key_gen);
+    measurement.bytes_per_key = bytes_per_key(data_structure);
+    return measurement;
+}
+
+// Runs the queries once more with each one timed on its own and adds their percentiles to measurement. That run is kept
+// apart, so reading the clock does not count against the throughput of the timed runs; it repeats every operation, so
+// it is only for read-only queries.
+template<typename Structure, typename QueryFn, typename KeyGen>
+void add_latencies(Measurement &measurement, Structure &data_structure, QueryFn query_fn, int num_queries,
+                   int num_threads, KeyGen key_gen) {
+    const double ns_per_tick = nanosecondsPerTick();
+    LatencyHistogram latencies;
+    std::mutex latencies_mutex;
+    time_parallel(
+            [&](auto keys) {
+                LatencyHistogram local;
+                for (const auto &key: keys) {
+                    const uint64_t start = readTicks();
+                    [[maybe_unused]] volatile auto val = query_fn(data_structure, key);
+                    local.record(static_cast<uint64_t>(static_cast<double>(readTicks() - start) * ns_per_tick));
+                }
+                std::lock_guard lock(latencies_mutex);
+                latencies.merge(local);
+            },
+            num_queries, num_threads, key_gen, 1, 0);
+
+    measurement.has_latency = true;
+    measurement.p50 = latencies.percentile(0.5);
+    measurement.p99 = latencies.percentile(0.99);
+    measurement.p999 = latencies.percentile(0.999);
+}
 
-    return total_time / num_runs; // Return the mean time
+// Read-only queries: the timed runs, then the latency pass.
+template<typename Structure, typename QueryFn, typename KeyGen>
+Measurement run_parallel_queries(Structure &data_structure, QueryFn query_fn, int num_queries, int num_threads,
+                                 KeyGen key_gen) {
+    Measurement measurement = time_queries(data_structure, query_fn, num_queries, num_threads, key_gen);
+    add_latencies(measurement, data_structure, query_fn, num_queries, num_threads, key_gen);
+    return measurement;
 }
 
-void measure_random_queries_tries(std::vector<Trie> &tries, const std::string &label, const std::vector<int> &threads,
+// Like run_parallel_queries, but every thread hands its keys to batch_fn batch_size at a time.
+template<typename Structure, typename BatchFn>
+Measurement run_parallel_batches(Structure &data_structure, BatchFn batch_fn, int num_queries, int num_threads,
+                                 std::function<uint32_t()> key_gen) {
+    Measurement measurement = time_parallel(
+            [&](std::span<const uint32_t> keys) {
+                std::vector<uint32_t> values(batch_size);
+                for (size_t first = 0; first < keys.size(); first += batch_size) {
+                    const size_t count = std::min<size_t>(batch_size, keys.size() - first);
+                    batch_fn(data_structure, keys.subspan(first, count), std::span(values).first(count));
+                }
+            },
+            num_queries, num_threads, key_gen);
+    measurement.bytes_per_key = bytes_per_key(data_structure);
+    return measurement;
+}
+
+// Prints the share of the lookups between two readings of a cache's counters that it answered.
+void print_hit_rate(const HotKeyCache<>::Stats &before, const HotKeyCache<>::Stats &after) {
+    const uint64_t hits = after.hits - before.hits;
+    const uint64_t lookups = hits + after.misses - before.misses;
+    std::cout << "  hot-key cache hit rate: " << (lookups ? 100.0 * hits / lookups : 0.0) << "%\n";
+}
+
+void measure_random_queries_tries(std::vector<Trie<>> &tries, const std::string &label, const std::vector<int> &threads,
                                   std::ofstream &out) {
     for (auto thread_count: threads) {
         std::cout << "\n[" << label << "] Thread level: " << thread_count << "\n";
 
         for (size_t i = 0; i < tries.size(); i++) {
-            Trie &trie = tries[i];
+            Trie<> &trie = tries[i];
 
             std::mt19937 rng(static_cast<unsigned>(i + thread_count));
             std::uniform_int_distribution<uint32_t> dist(0, static_cast<uint32_t>((i + 1) * inserts_for_each_size - 1));
 
             auto time_sec = run_parallel_queries(
-                    trie, [](Trie &t, uint32_t key) { return query(&t, key); }, num_queries, thread_count,
+                    trie, [](Trie<> &t, uint32_t key) { return query(&t, key); }, num_queries, thread_count,
                     [&]() { return dist(rng); });
 
 
             std::cout << label << " Trie size " << (i + 1) * inserts_for_each_size << ": " << time_sec << "ns\n";
-            out << label << "," << (i + 1) * inserts_for_each_size << ",random," << thread_count << "," << time_sec
-                << "\n";
+            write_row(out, label, (i + 1) * inserts_for_each_size, "random", thread_count, time_sec);
         }
     }
 }
 
 
-void measure_skewed_queries_tries(std::vector<Trie> &tries, const std::string &label, const std::vector<int> &threads,
+void measure_skewed_queries_tries(std::vector<Trie<>> &tries, const std::string &label, const std::vector<int> &threads,
                                   std::ofstream &out) {
     for (auto thread_count: threads) {
         std::cout << "\n[Skewed Query Test: " << label << "] Thread level: " << thread_count << "\n";
 
         for (size_t i = 0; i < tries.size(); i++) {
-            Trie &trie = tries[i];
+            Trie<> &trie = tries[i];
             std::mt19937 rng(static_cast<unsigned>(i + 999 + thread_count));
             std::exponential_distribution<> skew(skew_degree);
 
@@ -106,24 +312,28 @@ void measure_skewed_queries_tries(std::vector<Trie> &tries, const std::string &l
 
             auto key_gen = [=]() mutable { return static_cast<uint32_t>(skew(rng)) % max_key; };
 
-            auto time_sec = run_parallel_queries(
-                    trie, [](Trie &t, uint32_t key) -> uint32_t { return query(&t, key); }, num_queries, thread_count,
-                    key_gen);
+            // The hit rate covers the timed runs only, not the latency pass after them
+            auto query_fn = [](Trie<> &t, uint32_t key) -> uint32_t { return query(&t, key); };
+            const auto before = trie.cache ? trie.cache->stats() : HotKeyCache<>::Stats{};
+            auto time_sec = time_queries(trie, query_fn, num_queries, thread_count, key_gen);
+            const auto after = trie.cache ? trie.cache->stats() : HotKeyCache<>::Stats{};
+            add_latencies(time_sec, trie, query_fn, num_queries, thread_count, key_gen);
 
             std::cout << label << " Trie size " << (i + 1) * inserts_for_each_size << ": " << time_sec << "ns\n";
-            out << label << "," << (i + 1) * inserts_for_each_size << ",skewed," << thread_count << "," << time_sec
-                << "\n";
+            if (trie.cache)
+                print_hit_rate(before, after);
+            write_row(out, label, (i + 1) * inserts_for_each_size, "skewed", thread_count, time_sec);
         }
     }
 }
 
-void measure_range_queries_tries(std::vector<Trie> &tries, const std::string &label, const std::vector<int> &threads,
+void measure_range_queries_tries(std::vector<Trie<>> &tries, const std::string &label, const std::vector<int> &threads,
                                  std::ofstream &out) {
     for (auto thread_count: threads) {
         std::cout << "\n[Range Query Test: " << label << "] Thread level: " << thread_count << "\n";
 
         for (size_t i = 0; i < tries.size(); i++) {
-            Trie &trie = tries[i];
+            Trie<> &trie = tries[i];
             int max_key = (i + 1) * inserts_for_each_size;
 
             std::mt19937 rng(static_cast<unsigned>(i + thread_count));
@@ -131,7 +341,7 @@ void measure_range_queries_tries(std::vector<Trie> &tries, const std::string &la
 
             auto time_sec = run_parallel_queries(
                 trie,
-                [&](Trie &t, uint32_t key) -> uint32_t {
+                [&](Trie<> &t, uint32_t key) -> uint32_t {
                     uint32_t low = key;
                     uint32_t high = std::min(key + window_size, static_cast<uint32_t>(max_key));
                     return range(&t, low, high).size();
@@ -142,41 +352,174 @@ void measure_range_queries_tries(std::vector<Trie> &tries, const std::string &la
             );
 
             std::cout << label << " Trie size " << max_key << ": " << time_sec << "ns\n";
-            out << label << "," << max_key << ",range," << thread_count << "," << time_sec << "\n";
+            write_row(out, label, max_key, "range", thread_count, time_sec);
+        }
+    }
+}
+
+// Same windows as measure_range_queries_tries, streamed through a cursor instead of collected into a vector.
+void measure_range_scans_tries(std::vector<Trie<>> &tries, const std::string &label, const std::vector<int> &threads,
+                               std::ofstream &out) {
+    for (auto thread_count: threads) {
+        std::cout << "\n[Range Scan Test: " << label << "] Thread level: " << thread_count << "\n";
+
+        for (size_t i = 0; i < tries.size(); i++) {
+            Trie<> &trie = tries[i];
+            int max_key = (i + 1) * inserts_for_each_size;
+
+            std::mt19937 rng(static_cast<unsigned>(i + thread_count));
+            std::uniform_int_distribution<uint32_t> dist(0, max_key - 1);
+
+            auto time_sec = run_parallel_queries(
+                trie,
+                [&](Trie<> &t, uint32_t key) -> uint32_t {
+                    uint32_t sum = 0;
+                    for (const auto &[k, v]: scan(&t, key, std::min(key + window_size, static_cast<uint32_t>(max_key))))
+                        sum += v;
+                    return sum;
+                },
+                num_queries,
+                thread_count,
+                [&]() { return dist(rng); }
+            );
+
+            std::cout << label << " Trie size " << max_key << ": " << time_sec << "ns\n";
+            write_row(out, label, max_key, "range", thread_count, time_sec);
         }
     }
 }
 
-void measure_random_queries_bplus(const std::vector<BPlusTree> &trees, const std::string &label,
+// Works for both BPlusTree and MappedBPlusTree.
+template<typename Tree>
+void measure_random_queries_bplus(const std::vector<Tree> &trees, const std::string &label,
                                   const std::vector<int> &threads, std::ofstream &out) {
     for (auto thread_count: threads) {
         std::cout << "\n[" << label << "] Thread level: " << thread_count << "\n";
 
         for (size_t i = 0; i < trees.size(); i++) {
-            const BPlusTree &tree = trees[i];
+            const Tree &tree = trees[i];
+
+            std::mt19937 rng(static_cast<unsigned>(i + thread_count));
+            std::uniform_int_distribution<uint32_t> dist(0, static_cast<uint32_t>((i + 1) * inserts_for_each_size - 1));
+
+            auto time_sec = run_parallel_queries(
+                    tree, [](const Tree &t, uint32_t key) { return t.query(key); }, num_queries, thread_count,
+                    [&]() { return dist(rng); });
+
+
+            std::cout << label << " B+Tree size " << (i + 1) * inserts_for_each_size << ": " << time_sec << "ns\n";
+            write_row(out, label, (i + 1) * inserts_for_each_size, "random", thread_count, time_sec);
+        }
+    }
+}
+
+template<typename Sharded>
+void measure_random_queries_sharded(std::vector<Sharded> &indexes, const std::string &label,
+                                    const std::vector<int> &threads, std::ofstream &out) {
+    for (auto thread_count: threads) {
+        std::cout << "\n[" << label << "] Thread level: " << thread_count << "\n";
+
+        for (size_t i = 0; i < indexes.size(); i++) {
+            Sharded &index = indexes[i];
 
             std::mt19937 rng(static_cast<unsigned>(i + thread_count));
             std::uniform_int_distribution<uint32_t> dist(0, static_cast<uint32_t>((i + 1) * inserts_for_each_size - 1));
 
             auto time_sec = run_parallel_queries(
-                    tree, [](const BPlusTree &t, uint32_t key) { return t.query(key); }, num_queries, thread_count,
+                    index, [](Sharded &s, uint32_t key) { return s.query(key); }, num_queries, thread_count,
                     [&]() { return dist(rng); });
 
+            std::cout << label << " size " << (i + 1) * inserts_for_each_size << " (" << index.shardCount()
+                      << " shards): " << time_sec << "ns\n";
+            write_row(out, label, (i + 1) * inserts_for_each_size, "random", thread_count, time_sec);
+        }
+    }
+}
+
+// Times thread_count threads inserting num_queries random keys into a structure that make creates empty, once per
+// thread level.
+template<typename Make, typename InsertFn>
+void measure_parallel_inserts(Make make, InsertFn insert_fn, const std::string &label, const std::vector<int> &threads,
+                              std::ofstream &out) {
+    std::cout << "\n[Parallel Insert Test: " << label << "]\n";
+    for (auto thread_count: threads) {
+        auto structure = make();
+        std::mt19937 rng(static_cast<unsigned>(thread_count));
+
+        auto time_sec = time_parallel(
+                [&](std::span<const uint32_t> keys) {
+                    for (const uint32_t key: keys)
+                        insert_fn(structure, key, key);
+                },
+                num_queries, thread_count, [&]() { return static_cast<uint32_t>(rng()); });
+        time_sec.bytes_per_key = bytes_per_key(structure);
+
+        std::cout << label << " threads " << thread_count << ": " << time_sec << "ns\n";
+        write_row(out, label, num_queries, "insert", thread_count, time_sec);
+    }
+}
+
+// Same keys as measure_random_queries_tries, looked up batch_size at a time through query_batch.
+void measure_batched_queries_tries(std::vector<Trie<>> &tries, const std::string &label,
+                                   const std::vector<int> &threads, std::ofstream &out) {
+    for (auto thread_count: threads) {
+        std::cout << "\n[Batched Query Test: " << label << "] Thread level: " << thread_count << "\n";
+
+        for (size_t i = 0; i < tries.size(); i++) {
+            Trie<> &trie = tries[i];
+
+            std::mt19937 rng(static_cast<unsigned>(i + thread_count));
+            std::uniform_int_distribution<uint32_t> dist(0, static_cast<uint32_t>((i + 1) * inserts_for_each_size - 1));
+
+            auto time_sec = run_parallel_batches(
+                    trie,
+                    [](Trie<> &t, std::span<const uint32_t> keys, std::span<uint32_t> values) {
+                        query_batch(&t, keys, values);
+                    },
+                    num_queries, thread_count, [&]() { return dist(rng); });
+
+            std::cout << label << " Trie size " << (i + 1) * inserts_for_each_size << ": " << time_sec << "ns\n";
+            write_row(out, label, (i + 1) * inserts_for_each_size, "random", thread_count, time_sec);
+        }
+    }
+}
+
+// Same keys as measure_random_queries_bplus, looked up batch_size at a time through queryBatch. Works for both
+// BPlusTree and FrozenBPlusTree.
+template<typename Tree>
+void measure_batched_queries_bplus(const std::vector<Tree> &trees, const std::string &label,
+                                   const std::vector<int> &threads, std::ofstream &out) {
+    for (auto thread_count: threads) {
+        std::cout << "\n[Batched Query Test: " << label << "] Thread level: " << thread_count << "\n";
+
+        for (size_t i = 0; i < trees.size(); i++) {
+            const Tree &tree = trees[i];
+
+            std::mt19937 rng(static_cast<unsigned>(i + thread_count));
+            std::uniform_int_distribution<uint32_t> dist(0, static_cast<uint32_t>((i + 1) * inserts_for_each_size - 1));
+
+            auto time_sec = run_parallel_batches(
+                    tree,
+                    [](const Tree &t, std::span<const uint32_t> keys, std::span<uint32_t> values) {
+                        t.queryBatch(keys, values);
+                    },
+                    num_queries, thread_count, [&]() { return dist(rng); });
 
             std::cout << label << " B+Tree size " << (i + 1) * inserts_for_each_size << ": " << time_sec << "ns\n";
-            out << label << "," << (i + 1) * inserts_for_each_size << ",random," << thread_count << "," << time_sec
-                << "\n";
+            write_row(out, label, (i + 1) * inserts_for_each_size, "random", thread_count, time_sec);
         }
     }
 }
 
-void measure_skewed_queries_bplus(const std::vector<BPlusTree> &trees, const std::string &label,
+// Works for BPlusTree, with or without its hot-key cache, and for the read-only structures.
+template<typename Tree>
+void measure_skewed_queries_bplus(const std::vector<Tree> &trees, const std::string &label,
                                   const std::vector<int> &threads, std::ofstream &out) {
     for (auto thread_count: threads) {
         std::cout << "\n[Skewed Query Test: " << label << "] Thread level: " << thread_count << "\n";
 
         for (size_t i = 0; i < trees.size(); i++) {
-            const BPlusTree &tree = trees[i];
+            const Tree &tree = trees[i];
             std::mt19937 rng(static_cast<unsigned>(i + 999 + thread_count));
             std::exponential_distribution<> skew(skew_degree);
 
@@ -184,24 +527,33 @@ void measure_skewed_queries_bplus(const std::vector<BPlusTree> &trees, const std
 
             auto key_gen = [=]() mutable { return static_cast<uint32_t>(skew(rng)) % max_key; };
 
-            auto time_sec = run_parallel_queries(
-                    tree, [](const BPlusTree &t, uint32_t key) -> uint32_t { return t.query(key); }, num_queries,
-                    thread_count, key_gen);
+            const HotKeyCache<> *cache = nullptr;
+            if constexpr (requires { tree.hotKeyCache(); })
+                cache = tree.hotKeyCache();
+            // As for the tries, the hit rate covers the timed runs only
+            auto query_fn = [](const Tree &t, uint32_t key) -> uint32_t { return t.query(key); };
+            const auto before = cache ? cache->stats() : HotKeyCache<>::Stats{};
+            auto time_sec = time_queries(tree, query_fn, num_queries, thread_count, key_gen);
+            const auto after = cache ? cache->stats() : HotKeyCache<>::Stats{};
+            add_latencies(time_sec, tree, query_fn, num_queries, thread_count, key_gen);
 
             std::cout << label << " B+Tree size " << (i + 1) * inserts_for_each_size << ": " << time_sec << "ns\n";
-            out << label << "," << (i + 1) * inserts_for_each_size << ",skewed," << thread_count << "," << time_sec
-                << "\n";
+            if (cache)
+                print_hit_rate(before, after);
+            write_row(out, label, (i + 1) * inserts_for_each_size, "skewed", thread_count, time_sec);
         }
     }
 }
 
-void measure_range_queries_bplus(const std::vector<BPlusTree> &trees, const std::string &label, const std::vector<int> &threads,
+// Works for both BPlusTree and FrozenBPlusTree.
+template<typename Tree>
+void measure_range_queries_bplus(const std::vector<Tree> &trees, const std::string &label, const std::vector<int> &threads,
                                  std::ofstream &out) {
     for (auto thread_count: threads) {
         std::cout << "\n[Range Query Test: " << label << "] Thread level: " << thread_count << "\n";
 
         for (size_t i = 0; i < trees.size(); i++) {
-            const BPlusTree &tree = trees[i];
+            const Tree &tree = trees[i];
             int max_key = (i + 1) * inserts_for_each_size;
 
             std::mt19937 rng(static_cast<unsigned>(i + thread_count));
@@ -209,7 +561,7 @@ void measure_range_queries_bplus(const std::vector<BPlusTree> &trees, const std:
 
             auto time_sec = run_parallel_queries(
                 tree,
-                [&](const BPlusTree &t, uint32_t key) -> uint32_t {
+                [&](const Tree &t, uint32_t key) -> uint32_t {
                     uint32_t low = key;
                     uint32_t high = std::min(key + window_size, static_cast<uint32_t>(max_key));
                     return t.range(low, high).size();
@@ -220,95 +572,852 @@ void measure_range_queries_bplus(const std::vector<BPlusTree> &trees, const std:
             );
 
             std::cout << label << " B+ Tree size " << max_key << ": " << time_sec << "ns\n";
-            out << label << "," << max_key << ",range," << thread_count << "," << time_sec << "\n";
+            write_row(out, label, max_key, "range", thread_count, time_sec);
         }
     }
 }
 
-void start_perf(int perf_ctl_fd, int perf_ctl_ack_fd) {
-    write(perf_ctl_fd, "enable\n", 7);
-    char ack[5] = {};
-    read(perf_ctl_ack_fd, ack, 5);
-    assert(strcmp(ack, "ack\n") == 0);
+// Same windows as measure_range_queries_bplus, streamed through a cursor instead of collected into a vector.
+void measure_range_scans_bplus(const std::vector<BPlusTree<>> &trees, const std::string &label,
+                               const std::vector<int> &threads, std::ofstream &out) {
+    for (auto thread_count: threads) {
+        std::cout << "\n[Range Scan Test: " << label << "] Thread level: " << thread_count << "\n";
+
+        for (size_t i = 0; i < trees.size(); i++) {
+            const BPlusTree<> &tree = trees[i];
+            int max_key = (i + 1) * inserts_for_each_size;
+
+            std::mt19937 rng(static_cast<unsigned>(i + thread_count));
+            std::uniform_int_distribution<uint32_t> dist(0, max_key - 1);
+
+            auto time_sec = run_parallel_queries(
+                tree,
+                [&](const BPlusTree<> &t, uint32_t key) -> uint32_t {
+                    uint32_t sum = 0;
+                    for (const auto &[k, v]: t.scan(key, std::min(key + window_size, static_cast<uint32_t>(max_key))))
+                        sum += v;
+                    return sum;
+                },
+                num_queries,
+                thread_count,
+                [&]() { return dist(rng); }
+            );
+
+            std::cout << label << " B+ Tree size " << max_key << ": " << time_sec << "ns\n";
+            write_row(out, label, max_key, "range", thread_count, time_sec);
+        }
+    }
 }
 
-void stop_perf(int perf_ctl_fd, int perf_ctl_ack_fd) {
-    write(perf_ctl_fd, "disable\n", 8);
-    char ack[5] = {};
-    read(perf_ctl_ack_fd, ack, 5);
-    assert(strcmp(ack, "ack\n") == 0);
+// Picks the operation of a mixed or churn step independently of its key, as a percentage, so reads and writes land on
+// the same keys and every key gets written over time.
+uint32_t draw_op() {
+    thread_local std::minstd_rand rng(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    return rng() % 100;
+}
+
+// Concurrent-mode lookups with write_percent of the operations replaced by inserts, over the same keys as
+// measure_mixed_queries_bplus. Grows the tries, so it has to run after the read-only measurements.
+void measure_mixed_queries_tries(std::vector<Trie<>> &tries, const std::string &label, const std::vector<int> &threads,
+                                 std::ofstream &out) {
+    for (auto thread_count: threads) {
+        std::cout << "\n[Mixed Read/Write Test: " << label << "] Thread level: " << thread_count << "\n";
+
+        for (size_t i = 0; i < tries.size(); i++) {
+            Trie<> &trie = tries[i];
+            int max_key = (i + 1) * inserts_for_each_size;
+
+            std::mt19937 rng(static_cast<unsigned>(i + thread_count));
+            std::uniform_int_distribution<uint32_t> dist(0, 2 * max_key - 1);
+
+            auto time_sec = time_queries(
+                trie,
+                [](Trie<> &t, uint32_t key) -> uint32_t {
+                    if (draw_op() < write_percent) {
+                        insert_concurrent(&t, key, key);
+                        return 0;
+                    }
+                    return query_concurrent(&t, key);
+                },
+                num_queries,
+                thread_count,
+                [&]() { return dist(rng); }
+            );
+
+            std::cout << label << " Trie size " << max_key << ": " << time_sec << "ns\n";
+            write_row(out, label, max_key, "mixed", thread_count, time_sec);
+        }
+    }
+}
+
+// Lookups with write_percent of the operations replaced by inserts. Keys come from twice the loaded range, so inserts
+// add new keys until the upper half has filled up and overwrite after that, while lookups hit the keys being written.
+// Grows the trees, so it has to run after the read-only measurements.
+void measure_mixed_queries_bplus(std::vector<BPlusTree<>> &trees, const std::string &label,
+                                 const std::vector<int> &threads, std::ofstream &out) {
+    for (auto thread_count: threads) {
+        std::cout << "\n[Mixed Read/Write Test: " << label << "] Thread level: " << thread_count << "\n";
+
+        for (size_t i = 0; i < trees.size(); i++) {
+            BPlusTree<> &tree = trees[i];
+            int max_key = (i + 1) * inserts_for_each_size;
+
+            std::mt19937 rng(static_cast<unsigned>(i + thread_count));
+            std::uniform_int_distribution<uint32_t> dist(0, 2 * max_key - 1);
+
+            auto time_sec = time_queries(
+                tree,
+                [](BPlusTree<> &t, uint32_t key) -> uint32_t {
+                    if (draw_op() < write_percent) {
+                        t.insert(key, key);
+                        return 0;
+                    }
+                    return t.query(key);
+                },
+                num_queries,
+                thread_count,
+                [&]() { return dist(rng); }
+            );
+
+            std::cout << label << " B+ Tree size " << max_key << ": " << time_sec << "ns\n";
+            write_row(out, label, max_key, "mixed", thread_count, time_sec);
+        }
+    }
+}
+
+// Steady-state churn: churn_percent of the operations erase or insert a key, in equal shares over the same key space,
+// and the rest look keys up, so the tree keeps its size while nodes keep merging and splitting. Runs after everything
+// else, since it rewrites the trees.
+void measure_churn_queries_bplus(std::vector<BPlusTree<>> &trees, const std::string &label,
+                                 const std::vector<int> &threads, std::ofstream &out) {
+    for (auto thread_count: threads) {
+        std::cout << "\n[Churn Test: " << label << "] Thread level: " << thread_count << "\n";
+
+        for (size_t i = 0; i < trees.size(); i++) {
+            BPlusTree<> &tree = trees[i];
+            int max_key = (i + 1) * inserts_for_each_size;
+
+            std::mt19937 rng(static_cast<unsigned>(i + thread_count));
+            std::uniform_int_distribution<uint32_t> dist(0, 2 * max_key - 1);
+
+            auto time_sec = time_queries(
+                tree,
+                [](BPlusTree<> &t, uint32_t key) -> uint32_t {
+                    const uint32_t op = draw_op();
+                    if (op < churn_percent / 2)
+                        return t.erase(key);
+                    if (op < churn_percent) {
+                        t.insert(key, key);
+                        return 0;
+                    }
+                    return t.query(key);
+                },
+                num_queries,
+                thread_count,
+                [&]() { return dist(rng); }
+            );
+
+            std::cout << label << " B+ Tree size " << max_key << ": " << time_sec << "ns\n";
+            write_row(out, label, max_key, "churn", thread_count, time_sec);
+        }
+    }
+}
+
+// Same workload as measure_churn_queries_bplus. erase is not part of the trie's concurrent mode, so only run this
+// with a single thread.
+void measure_churn_queries_tries(std::vector<Trie<>> &tries, const std::string &label, std::ofstream &out) {
+    std::cout << "\n[Churn Test: " << label << "] Thread level: 1\n";
+
+    for (size_t i = 0; i < tries.size(); i++) {
+        Trie<> &trie = tries[i];
+        int max_key = (i + 1) * inserts_for_each_size;
+
+        std::mt19937 rng(static_cast<unsigned>(i + 1));
+        std::uniform_int_distribution<uint32_t> dist(0, 2 * max_key - 1);
+
+        auto time_sec = time_queries(
+            trie,
+            [](Trie<> &t, uint32_t key) -> uint32_t {
+                const uint32_t op = draw_op();
+                if (op < churn_percent / 2)
+                    return erase(&t, key);
+                if (op < churn_percent) {
+                    insert(&t, key, key);
+                    return 0;
+                }
+                return query(&t, key);
+            },
+            num_queries,
+            1,
+            [&]() { return dist(rng); }
+        );
+
+        std::cout << label << " Trie size " << max_key << ": " << time_sec << "ns\n";
+        write_row(out, label, max_key, "churn", 1, time_sec);
+    }
+}
+
+// Ingest into a versioned B+ tree bulk-loaded with the dense keys: one thread inserts random keys, alone, batch_size
+// at a time as one version each, and while another thread keeps taking snapshots and counting every key in them,
+// which has to come out at the snapshot's size however many inserts land meanwhile. Writers are serialized, so there
+// is no thread level to vary.
+void measure_snapshot_ingest(const std::string &label, int number_of_sizes, std::ofstream &out) {
+    std::cout << "\n[Snapshot Ingest Test: " << label << "]\n";
+    using Tree = VersionedBPlusTree<>;
+
+    for (int i = 1; i <= number_of_sizes; i++) {
+        const int max_key = i * inserts_for_each_size;
+        std::vector<Tree::Entry> entries(max_key);
+        for (int j = 0; j < max_key; j++)
+            entries[j] = {j, j};
+        std::mt19937 rng(static_cast<unsigned>(i));
+        std::uniform_int_distribution<uint32_t> dist(0, 2 * max_key - 1);
+
+        for (const std::string mode: {"insert", "insert batch", "insert under scans"}) {
+            Tree tree;
+            tree.bulkLoad(entries);
+            std::atomic<bool> stop{false};
+            long scans = 0;
+            bool consistent = true;
+            std::thread scanner;
+            if (mode == "insert under scans") {
+                scanner = std::thread([&] {
+                    while (!stop.load(std::memory_order_relaxed)) {
+                        const auto snapshot = tree.snapshot();
+                        consistent &= snapshot.rangeCount(0, UINT32_MAX) == snapshot.size();
+                        scans++;
+                    }
+                });
+            }
+
+            auto time_sec = time_parallel(
+                    [&](std::span<const uint32_t> keys) {
+                        if (mode != "insert batch") {
+                            for (const uint32_t key: keys)
+                                tree.insert(key, key);
+                            return;
+                        }
+                        std::vector<Tree::Entry> batch;
+                        for (size_t first = 0; first < keys.size(); first += batch_size) {
+                            batch.clear();
+                            const size_t count = std::min<size_t>(batch_size, keys.size() - first);
+                            for (const uint32_t key: keys.subspan(first, count))
+                                batch.emplace_back(key, key);
+                            tree.insertBatch(batch);
+                        }
+                    },
+                    num_queries, 1, [&]() { return dist(rng); });
+            stop = true;
+            if (scanner.joinable())
+                scanner.join();
+            time_sec.bytes_per_key = bytes_per_key(tree);
+
+            std::cout << label << " (" << mode << ") size " << max_key << ": " << time_sec << "ns";
+            if (mode == "insert under scans")
+                std::cout << ", " << scans << " snapshot scans, " << (consistent ? "all" : "NOT all") << " consistent";
+            std::cout << "\n";
+            write_row(out, label + " (" + mode + ")", max_key, "insert", 1, time_sec);
+        }
+    }
+}
+
+// Random lookups on a trie and a B+ tree over key_of(0), ..., key_of(size - 1) with 64-bit values. Each size is built,
+// measured and dropped before the next, as these keys take more memory than the 32-bit ones above.
+template<typename Key, typename KeyOf>
+void measure_random_queries_keyed(KeyOf key_of, const std::string &label, const std::vector<int> &threads,
+                                  int number_of_sizes, std::ofstream &out) {
+    for (int i = 1; i <= number_of_sizes; i++) {
+        const int size = i * inserts_for_each_size;
+        std::vector<std::pair<Key, uint64_t>> entries(size);
+        for (int j = 0; j < size; j++) {
+            entries[j] = {key_of(j), j};
+        }
+        parallelSort(std::span(entries));
+        Trie<Key, uint64_t> trie;
+        BPlusTree<Key, uint64_t> tree;
+        bulk_load(&trie, entries, build_threads);
+        tree.bulkLoad(entries, 1.0, build_threads);
+        // Only integer keys can be learned
+        std::conditional_t<std::is_integral_v<Key>, LearnedIndex<Key, uint64_t>, std::monostate> learned;
+        if constexpr (std::is_integral_v<Key>)
+            learned = LearnedIndex<Key, uint64_t>(entries);
+
+        for (auto thread_count: threads) {
+            std::mt19937 rng(static_cast<unsigned>(i + thread_count));
+            std::uniform_int_distribution<int> dist(0, size - 1);
+
+            auto trie_time = run_parallel_queries(
+                    trie, [](Trie<Key, uint64_t> &t, const Key &key) { return query(&t, key); }, num_queries,
+                    thread_count, [&]() { return key_of(dist(rng)); });
+            std::cout << "Trie (" << label << ") size " << size << ", " << thread_count << " threads: " << trie_time
+                      << "ns\n";
+            write_row(out, "Trie (" + label + ")", size, "random", thread_count, trie_time);
+
+            auto tree_time = run_parallel_queries(
+                    tree, [](const BPlusTree<Key, uint64_t> &t, const Key &key) { return t.query(key); }, num_queries,
+                    thread_count, [&]() { return key_of(dist(rng)); });
+            std::cout << "B+ Tree (" << label << ") size " << size << ", " << thread_count << " threads: " << tree_time
+                      << "ns\n";
+            write_row(out, "B+ Tree (" + label + ")", size, "random", thread_count, tree_time);
+
+            if constexpr (std::is_integral_v<Key>) {
+                auto learned_time = run_parallel_queries(
+                        learned, [](const LearnedIndex<Key, uint64_t> &l, const Key &key) { return l.query(key); },
+                        num_queries, thread_count, [&]() { return key_of(dist(rng)); });
+                std::cout << "Learned Index (" << label << ") size " << size << ", " << thread_count
+                          << " threads: " << learned_time << "ns\n";
+                write_row(out, "Learned Index (" + label + ")", size, "random", thread_count, learned_time);
+            }
+        }
+    }
+}
+
+// The operations of a workload on each kind of structure. Tries are written in their concurrent mode.
+uint32_t range_end(const Operation &op, uint32_t range_length) {
+    return op.key > UINT32_MAX - (range_length - 1) ? UINT32_MAX : op.key + (range_length - 1);
+}
+
+uint32_t apply(BPlusTree<> &tree, const Operation &op, uint32_t range_length) {
+    switch (op.kind) {
+        case OperationKind::Read:
+            return tree.query(op.key);
+        case OperationKind::Write:
+            tree.insert(op.key, op.key);
+            return 0;
+        default:
+            return tree.rangeCount(op.key, range_end(op, range_length));
+    }
+}
+
+uint32_t apply(Trie<> &trie, const Operation &op, uint32_t range_length) {
+    switch (op.kind) {
+        case OperationKind::Read:
+            return query_concurrent(&trie, op.key);
+        case OperationKind::Write:
+            insert_concurrent(&trie, op.key, op.key);
+            return 0;
+        default:
+            return range_count(&trie, op.key, range_end(op, range_length));
+    }
+}
+
+template<typename Index>
+uint32_t apply(ShardedIndex<Index> &index, const Operation &op, uint32_t range_length) {
+    switch (op.kind) {
+        case OperationKind::Read:
+            return index.query(op.key);
+        case OperationKind::Write:
+            index.insert(op.key, op.key);
+            return 0;
+        default:
+            return index.rangeCount(op.key, range_end(op, range_length));
+    }
+}
+
+// A learned index never sees writes, which WorkloadSpec::validate rules out.
+uint32_t apply(LearnedIndex<> &index, const Operation &op, uint32_t range_length) {
+    if (op.kind == OperationKind::Read)
+        return index.query(op.key);
+    return index.rangeCount(op.key, range_end(op, range_length));
+}
+
+// One line of events per operation, leaving out those that could not be counted.
+void print_counts(const std::string &what, const PerfCounts &counts) {
+    std::cout << what << ":";
+    for (int i = 0; i < perfEventCount; i++) {
+        if (!std::isnan(counts.counts[i]))
+            std::cout << " " << perfEventNames[i] << " " << counts.counts[i];
+    }
+    std::cout << " per op\n";
+}
+
+template<typename Structure>
+void run_workload_on(Structure &structure, const WorkloadSpec &spec, uint32_t key_space, std::ofstream &out) {
+    for (const int thread_count: spec.threads) {
+        OperationGenerator operations(spec, key_space, static_cast<uint64_t>(thread_count));
+        auto apply_fn = [&](Structure &s, const Operation &op) { return apply(s, op, spec.range_length); };
+        auto operation_gen = [&]() { return operations(); };
+        // The latency pass would apply every write a second time, so workloads that write report no percentiles
+        Measurement measurement = time_queries(structure, apply_fn, spec.operations, thread_count, operation_gen);
+        if (spec.write == 0)
+            add_latencies(measurement, structure, apply_fn, spec.operations, thread_count, operation_gen);
+
+        std::cout << spec.label() << " threads " << thread_count << ": " << measurement << "ns per million ops";
+        if (measurement.has_latency)
+            std::cout << ", p50 " << measurement.p50 << "ns, p99 " << measurement.p99 << "ns, p999 "
+                      << measurement.p999 << "ns";
+        std::cout << "\n";
+        if (measurement.has_counters) {
+            for (size_t t = 0; t < measurement.thread_counters.size(); t++)
+                print_counts("  thread " + std::to_string(t), measurement.thread_counters[t]);
+        }
+        write_row(out, spec.label(), spec.size, spec.mix(), thread_count, measurement);
+    }
+}
+
+// Runs build to load a workload's structure and, with count_events set, writes the load as a phase of its own: a row
+// named after the workload with " (build)" added, its time per million keys and its events per key, counting the
+// threads build starts as well.
+template<typename Build>
+auto build_for_workload(const WorkloadSpec &spec, std::ofstream &out, Build build) {
+    if (!count_events)
+        return build();
+
+    PerfCounters counters(true);
+    counters.start();
+    const auto start = std::chrono::high_resolution_clock::now();
+    auto structure = build();
+    const auto end = std::chrono::high_resolution_clock::now();
+    counters.stop();
+
+    Measurement measurement;
+    measurement.time = static_cast<long>(
+            static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) * 1e6 /
+            spec.size);
+    measurement.has_counters = true;
+    measurement.counters = counters.read() / spec.size;
+    measurement.bytes_per_key = bytes_per_key(structure);
+    print_counts("build", measurement.counters);
+    write_row(out, spec.label() + " (build)", spec.size, "build", 1, measurement);
+    return structure;
+}
+
+// Builds the workload's structure and runs its operations at every thread count, one results.csv row each. The
+// structure is shared across the thread counts, so writes of one count are still there for the next.
+void run_workload(const WorkloadSpec &spec, std::ofstream &out) {
+    num_runs = spec.runs;
+    warmup_runs = spec.warmup;
+    pin_threads = spec.pin;
+
+    const uint32_t key_space = spec.sparse ? 2 * spec.size : spec.size;
+    std::vector<std::pair<uint32_t, uint32_t>> entries(spec.size);
+    if (spec.sparse) {
+        std::mt19937 rng(spec.size);
+        std::uniform_int_distribution<uint32_t> dist(0, key_space - 1);
+        for (auto &entry: entries) {
+            const uint32_t key = dist(rng);
+            entry = {key, key};
+        }
+        parallelSort(std::span(entries));
+    } else {
+        for (uint32_t j = 0; j < spec.size; j++)
+            entries[j] = {j, j};
+    }
+
+    std::cout << "\n[Workload: " << spec.label() << "]\n";
+    if (spec.structure == "bplus") {
+        auto tree = build_for_workload(spec, out, [&] {
+            BPlusTree<> tree;
+            tree.bulkLoad(entries, 1.0, build_threads);
+            return tree;
+        });
+        run_workload_on(tree, spec, key_space, out);
+    } else if (spec.structure == "trie") {
+        auto trie = build_for_workload(spec, out, [&] {
+            Trie<> trie;
+            bulk_load(&trie, entries, build_threads);
+            return trie;
+        });
+        run_workload_on(trie, spec, key_space, out);
+    } else if (spec.structure == "sharded_bplus") {
+        auto index = build_for_workload(spec, out, [&] { return ShardedIndex<BPlusTree<>>(entries); });
+        run_workload_on(index, spec, key_space, out);
+    } else if (spec.structure == "learned") {
+        auto index = build_for_workload(spec, out, [&] { return LearnedIndex<>(entries); });
+        run_workload_on(index, spec, key_space, out);
+    } else {
+        auto index = build_for_workload(spec, out, [&] { return ShardedIndex<Trie<>>(entries); });
+        run_workload_on(index, spec, key_space, out);
+    }
+}
+
+void print_usage(const char *program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "Without --workload or --spec, runs the full benchmark suite.\n"
+              << "  --sizes N          number of index sizes in the suite (10)\n"
+              << "  --size-step N      keys added per size (500000); default size of workloads\n"
+              << "  --queries N        operations per run (1000000)\n"
+              << "  --runs N           timed runs per measurement (5)\n"
+              << "  --warmup N         untimed runs before them (1)\n"
+              << "  --threads LIST     thread counts, comma-separated (1,2,4,8,16,32)\n"
+              << "  --skew RATE        rate of the exponential skewed-key distribution (0.00001)\n"
+              << "  --pin              pin benchmark thread i to the i-th CPU\n"
+              << "  --counters         count cycles, instructions, L1d, LLC and dTLB misses and branch misses of\n"
+              << "                     each thread with perf_event_open, per operation in results.csv\n"
+              << "  --perf-control C,A enable perf stat --control fd:C,A only around the timed runs\n"
+              << "  --out FILE         CSV file to append to (results.csv)\n"
+              << "  --workload SPEC    run a workload given as key=value pairs, e.g.\n"
+              << "                     'structure=trie distribution=zipf theta=0.99 read=90 write=10 threads=1,8'\n"
+              << "  --spec FILE        run the workloads in a JSON file (an object or an array of objects\n"
+              << "                     with the same keys as --workload)\n"
+              << "Workload keys: name, structure (bplus, trie, sharded_bplus, sharded_trie, learned), size,\n"
+              << "keys (dense, sparse), distribution (uniform, zipf, exponential), theta, skew,\n"
+              << "read, write, range (percentages), range_length, threads, operations, runs, warmup, pin.\n"
+              << "Unset keys default to the options above.\n";
+}
+
+std::vector<int> parse_thread_list(const std::string &text) {
+    std::vector<int> threads;
+    std::stringstream list(text);
+    for (std::string item; std::getline(list, item, ',');) {
+        threads.push_back(std::stoi(item));
+        if (threads.back() <= 0)
+            throw std::invalid_argument("thread counts have to be positive");
+    }
+    return threads;
+}
+
+// Opens path to append rows to, writing the header if the file is new. Refuses a file with other columns, such as
+// one written before the percentile columns, as graph.py could not read it with the new rows added.
+bool open_results(const std::string &path, std::ofstream &out) {
+    std::ifstream existing(path);
+    std::string header;
+    if (existing && std::getline(existing, header) && header != results_header) {
+        std::cerr << "error: " << path << " has the columns " << header << ", not " << results_header
+                  << "; pass another file with --out\n";
+        return false;
+    }
+    out.open(path, std::ios::app);
+    if (out.tellp() == 0)
+        out << results_header << "\n";
+    return static_cast<bool>(out);
 }
 
 int main(int argc, char *argv[]) {
     std::vector<int> threads = {1, 2, 4, 8, 16, 32};
-
-    std::vector<Trie> dense_tries;
-    std::vector<Trie> sparse_tries;
-    std::vector<BPlusTree> dense_bp_trees;
-    std::vector<BPlusTree> sparse_bp_trees;
     int number_of_sizes = 10;
-    int bp_degree = 64; // so each node fits in a cache line of 64 bytes. Each key is 4 bytes
+    std::string results_path = "results.csv";
+    std::vector<WorkloadSpec> workloads;
+
+    try {
+        std::vector<std::string> workload_texts;
+        std::vector<std::string> workload_files;
+        for (int i = 1; i < argc; i++) {
+            const std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc)
+                    throw std::invalid_argument(arg + " needs a value");
+                return argv[++i];
+            };
+            if (arg == "--help" || arg == "-h") {
+                print_usage(argv[0]);
+                return 0;
+            } else if (arg == "--sizes") {
+                number_of_sizes = std::stoi(value());
+            } else if (arg == "--size-step") {
+                inserts_for_each_size = std::stoi(value());
+            } else if (arg == "--queries") {
+                num_queries = std::stoi(value());
+            } else if (arg == "--runs") {
+                num_runs = std::stoi(value());
+            } else if (arg == "--warmup") {
+                warmup_runs = std::stoi(value());
+            } else if (arg == "--threads") {
+                threads = parse_thread_list(value());
+            } else if (arg == "--skew") {
+                skew_degree = std::stod(value());
+            } else if (arg == "--pin") {
+                pin_threads = true;
+            } else if (arg == "--counters") {
+                count_events = true;
+            } else if (arg == "--perf-control") {
+                const std::string fds = value();
+                const size_t comma = fds.find(',');
+                if (comma == std::string::npos)
+                    throw std::invalid_argument("--perf-control takes CTL_FD,ACK_FD");
+                perf_ctl_fd = std::stoi(fds.substr(0, comma));
+                perf_ctl_ack_fd = std::stoi(fds.substr(comma + 1));
+            } else if (arg == "--out") {
+                results_path = value();
+            } else if (arg == "--workload") {
+                workload_texts.push_back(value());
+            } else if (arg == "--spec") {
+                workload_files.push_back(value());
+            } else {
+                throw std::invalid_argument("unknown option " + arg);
+            }
+        }
+        if (number_of_sizes <= 0 || inserts_for_each_size <= 0 || num_queries <= 0 || num_runs <= 0 ||
+            warmup_runs < 0 || threads.empty())
+            throw std::invalid_argument("sizes, counts and thread lists have to be positive");
+        if (!(skew_degree > 0))
+            throw std::invalid_argument("--skew has to be positive");
+
+        WorkloadSpec defaults;
+        defaults.size = inserts_for_each_size;
+        defaults.skew = skew_degree;
+        defaults.threads = threads;
+        defaults.operations = num_queries;
+        defaults.runs = num_runs;
+        defaults.warmup = warmup_runs;
+        defaults.pin = pin_threads;
+        for (const auto &text: workload_texts)
+            workloads.push_back(parse_workload(text, defaults));
+        for (const auto &file: workload_files) {
+            for (auto &spec: load_workloads(file, defaults))
+                workloads.push_back(spec);
+        }
+    } catch (const std::exception &error) {
+        std::cerr << "error: " << error.what() << "\n";
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::ofstream out;
+    if (!open_results(results_path, out))
+        return 1;
+    if (count_events && !PerfCounters().available())
+        std::cerr << "warning: no hardware events can be counted here (perf_event_paranoid or no PMU exposed), "
+                     "the counter columns stay empty\n";
+
+    if (!workloads.empty()) {
+        for (const auto &spec: workloads)
+            run_workload(spec, out);
+        return 0;
+    }
+
+    const auto setup_start = std::chrono::high_resolution_clock::now();
+    std::vector<Trie<>> dense_tries;
+    std::vector<Trie<>> sparse_tries;
+    std::vector<BPlusTree<>> dense_bp_trees;
+    std::vector<BPlusTree<>> sparse_bp_trees;
+    // Same entries again with compressed leaves
+    std::vector<Trie<>> packed_dense_tries;
+    std::vector<Trie<>> packed_sparse_tries;
+    std::vector<BPlusTree<>> packed_dense_bp_trees;
+    std::vector<BPlusTree<>> packed_sparse_bp_trees;
+    std::vector<LearnedIndex<>> dense_learned;
+    std::vector<LearnedIndex<>> sparse_learned;
 
     for (int i = 1; i <= number_of_sizes; i++) {
-        Trie trie;
-        trie.node.value = 0;
-        trie.node.key = 0;
-        BPlusTree tree(bp_degree);
+        Trie<> trie;
+        BPlusTree<> tree;
         int number_of_inserts = i * inserts_for_each_size;
+        std::vector<std::pair<uint32_t, uint32_t>> entries(number_of_inserts);
         for (int j = 0; j < number_of_inserts; j++) {
-            insert(&trie, j, j);
-            tree.insert(j, j);
+            entries[j] = {j, j};
         }
-
-        dense_tries.push_back(trie);
-        dense_bp_trees.push_back(tree);
-        std::cout << "Created one dense trie and tree of size " << number_of_inserts << std::endl;
+        bulk_load(&trie, entries, build_threads);
+        tree.bulkLoad(entries, 1.0, build_threads);
+
+        Trie<> packed_trie;
+        BPlusTree<> packed_tree;
+        packed_trie.compress_leaves = true;
+        packed_tree.setLeafCompression(true);
+        bulk_load(&packed_trie, entries, build_threads);
+        packed_tree.bulkLoad(entries, 1.0, build_threads);
+
+        dense_tries.push_back(std::move(trie));
+        dense_bp_trees.push_back(std::move(tree));
+        packed_dense_tries.push_back(std::move(packed_trie));
+        dense_learned.emplace_back(entries);
+        packed_dense_bp_trees.push_back(std::move(packed_tree));
+        std::cout << "Created one dense trie, tree and learned index (" << dense_learned.back().segments()
+                  << " segments) of size " << number_of_inserts << std::endl;
     }
 
     for (int i = 1; i <= number_of_sizes; i++) {
-        Trie trie;
-        trie.node.value = 0;
-        trie.node.key = 0;
-        BPlusTree tree(bp_degree);
+        Trie<> trie;
+        BPlusTree<> tree;
 
         int max_key_size = i * inserts_for_each_size * 2;
 
         std::mt19937 rng(i);
         std::uniform_int_distribution<uint32_t> dist(0, max_key_size - 1);
 
-        for (int j = 0; j < max_key_size / 2; j++) {
+        std::vector<std::pair<uint32_t, uint32_t>> entries(max_key_size / 2);
+        for (auto &entry: entries) {
             uint32_t key = dist(rng);
-            insert(&trie, key, key);
-            tree.insert(key, key);
+            entry = {key, key};
         }
+        parallelSort(std::span(entries));
+        bulk_load(&trie, entries, build_threads);
+        tree.bulkLoad(entries, 1.0, build_threads);
+
+        Trie<> packed_trie;
+        BPlusTree<> packed_tree;
+        packed_trie.compress_leaves = true;
+        packed_tree.setLeafCompression(true);
+        bulk_load(&packed_trie, entries, build_threads);
+        packed_tree.bulkLoad(entries, 1.0, build_threads);
+
+        sparse_tries.push_back(std::move(trie));
+        sparse_bp_trees.push_back(std::move(tree));
+        packed_sparse_tries.push_back(std::move(packed_trie));
+        sparse_learned.emplace_back(entries);
+        packed_sparse_bp_trees.push_back(std::move(packed_tree));
+        std::cout << "Created one sparse trie, tree and learned index (" << sparse_learned.back().segments()
+                  << " segments) of size " << max_key_size / 2 << std::endl;
+    }
+
+    // Round-trip the dense trees through their file format. The files are unlinked right after mapping them, which
+    // keeps their pages alive until the mapped trees go away.
+    std::vector<MappedBPlusTree<>> mapped_bp_trees;
+    for (size_t i = 0; i < dense_bp_trees.size(); i++) {
+        const auto path = std::filesystem::temp_directory_path() /
+                          ("dense_bplus_" + std::to_string(getpid()) + "_" + std::to_string(i) + ".bpt");
+        auto start = std::chrono::high_resolution_clock::now();
+        MappedBPlusTree<>::write(dense_bp_trees[i], path);
+        auto written = std::chrono::high_resolution_clock::now();
+        mapped_bp_trees.emplace_back(path);
+        auto opened = std::chrono::high_resolution_clock::now();
+        std::filesystem::remove(path);
+        std::cout << "Wrote dense tree of size " << (i + 1) * inserts_for_each_size << " to disk in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(written - start).count() << "ms, mapped in "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(opened - written).count() << "us"
+                  << std::endl;
+    }
 
-        sparse_tries.push_back(trie);
-        sparse_bp_trees.push_back(tree);
-        std::cout << "Created one sparse trie and tree of size " << max_key_size / 2 << std::endl;
+    // Read-only copies of the trees in the frozen layout
+    std::vector<FrozenBPlusTree<>> frozen_dense_bp_trees;
+    std::vector<FrozenBPlusTree<>> frozen_sparse_bp_trees;
+    for (size_t i = 0; i < dense_bp_trees.size(); i++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        frozen_dense_bp_trees.push_back(dense_bp_trees[i].freeze());
+        auto frozen = std::chrono::high_resolution_clock::now();
+        frozen_sparse_bp_trees.push_back(sparse_bp_trees[i].freeze());
+        std::cout << "Froze dense tree of size " << (i + 1) * inserts_for_each_size << " in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(frozen - start).count() << "ms, "
+                  << frozen_dense_bp_trees[i].bytes() / (1 << 20) << "MiB" << std::endl;
     }
 
-    std::cout << "All tries/trees created" << std::endl;
+    // The dense entries again, split into one shard per CPU
+    std::vector<ShardedIndex<BPlusTree<>>> sharded_bp_trees;
+    std::vector<ShardedIndex<Trie<>>> sharded_tries;
+    for (int i = 1; i <= number_of_sizes; i++) {
+        std::vector<std::pair<uint32_t, uint32_t>> entries(i * inserts_for_each_size);
+        for (uint32_t j = 0; j < entries.size(); j++)
+            entries[j] = {j, j};
+        sharded_bp_trees.emplace_back(entries);
+        sharded_tries.emplace_back(entries);
+    }
 
-    std::ofstream out("results.csv", std::ios::app);
-    if (out.tellp() == 0) {
-        out << "structure,size,query_type,thread_level,time\n";
+    // Where the memory of the largest structures goes
+    if (number_of_sizes > 0) {
+        std::cout << "Dense B+ tree: " << dense_bp_trees.back().stats()
+                  << "Sparse B+ tree: " << sparse_bp_trees.back().stats()
+                  << "Compressed sparse B+ tree: " << packed_sparse_bp_trees.back().stats()
+                  << "Dense trie: " << stats(&dense_tries.back()) << "Sparse trie: " << stats(&sparse_tries.back())
+                  << "Compressed sparse trie: " << stats(&packed_sparse_tries.back());
     }
 
+    std::cout << "All tries/trees created in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() -
+                                                                        setup_start)
+                         .count()
+              << "ms" << std::endl;
+
     measure_random_queries_tries(dense_tries, "Dense Trie", threads, out);
     measure_random_queries_tries(sparse_tries, "Sparse Trie", threads, out);
+    measure_batched_queries_tries(dense_tries, "Dense Trie (batched)", threads, out);
+    measure_batched_queries_tries(sparse_tries, "Sparse Trie (batched)", threads, out);
 
     measure_skewed_queries_tries(dense_tries, "Dense Trie (skew)", threads, out);
     measure_skewed_queries_tries(sparse_tries, "Sparse Trie (skew)", threads, out);
+    // The same skewed lookups with the head of the distribution answered by a hot-key cache
+    for (auto &trie: dense_tries)
+        trie.cache = std::make_unique<HotKeyCache<>>(hot_key_cache_entries);
+    for (auto &trie: sparse_tries)
+        trie.cache = std::make_unique<HotKeyCache<>>(hot_key_cache_entries);
+    measure_skewed_queries_tries(dense_tries, "Dense Trie (skew, cached)", threads, out);
+    measure_skewed_queries_tries(sparse_tries, "Sparse Trie (skew, cached)", threads, out);
+    for (auto &trie: dense_tries)
+        trie.cache.reset();
+    for (auto &trie: sparse_tries)
+        trie.cache.reset();
 
     measure_range_queries_tries(dense_tries, "Dense Trie (range)", threads, out);
+    measure_range_queries_tries(sparse_tries, "Sparse Trie (range)", threads, out);
+    measure_range_scans_tries(dense_tries, "Dense Trie (range scan)", threads, out);
+    measure_range_scans_tries(sparse_tries, "Sparse Trie (range scan)", threads, out);
+    measure_random_queries_tries(packed_dense_tries, "Dense Trie (compressed)", threads, out);
+    measure_random_queries_tries(packed_sparse_tries, "Sparse Trie (compressed)", threads, out);
+    measure_range_scans_tries(packed_dense_tries, "Dense Trie (compressed range scan)", threads, out);
 
     measure_random_queries_bplus(dense_bp_trees, "Dense B+ Tree", threads, out);
     measure_random_queries_bplus(sparse_bp_trees, "Sparse B+ Tree", threads, out);
+    measure_random_queries_bplus(mapped_bp_trees, "Dense B+ Tree (mapped)", threads, out);
+    measure_batched_queries_bplus(dense_bp_trees, "Dense B+ Tree (batched)", threads, out);
+    measure_batched_queries_bplus(sparse_bp_trees, "Sparse B+ Tree (batched)", threads, out);
+    measure_random_queries_bplus(frozen_dense_bp_trees, "Dense B+ Tree (frozen)", threads, out);
+    measure_random_queries_bplus(frozen_sparse_bp_trees, "Sparse B+ Tree (frozen)", threads, out);
+    measure_batched_queries_bplus(frozen_dense_bp_trees, "Dense B+ Tree (frozen, batched)", threads, out);
+    measure_batched_queries_bplus(frozen_sparse_bp_trees, "Sparse B+ Tree (frozen, batched)", threads, out);
+
+    measure_random_queries_bplus(dense_learned, "Dense Learned Index", threads, out);
+    measure_random_queries_bplus(sparse_learned, "Sparse Learned Index", threads, out);
+    measure_batched_queries_bplus(dense_learned, "Dense Learned Index (batched)", threads, out);
+    measure_batched_queries_bplus(sparse_learned, "Sparse Learned Index (batched)", threads, out);
+    measure_skewed_queries_bplus(dense_learned, "Dense Learned Index (skew)", threads, out);
+    measure_skewed_queries_bplus(sparse_learned, "Sparse Learned Index (skew)", threads, out);
+    measure_range_queries_bplus(dense_learned, "Dense Learned Index (range)", threads, out);
+
+    // Same lookups with binary search inside the nodes, as a baseline for the vector search the trees default to
+    std::cout << "\nB+ Tree node search ISA: " << vectorSearchIsa() << "\n";
+    for (auto &tree: dense_bp_trees)
+        tree.setKeySearch(KeySearch::Binary);
+    for (auto &tree: sparse_bp_trees)
+        tree.setKeySearch(KeySearch::Binary);
+    measure_random_queries_bplus(dense_bp_trees, "Dense B+ Tree (binary search)", threads, out);
+    measure_random_queries_bplus(sparse_bp_trees, "Sparse B+ Tree (binary search)", threads, out);
+    for (auto &tree: dense_bp_trees)
+        tree.setKeySearch(KeySearch::Vector);
+    for (auto &tree: sparse_bp_trees)
+        tree.setKeySearch(KeySearch::Vector);
 
     measure_skewed_queries_bplus(dense_bp_trees, "Dense B+ Tree (skew)", threads, out);
     measure_skewed_queries_bplus(sparse_bp_trees, "Sparse B+ Tree (skew)", threads, out);
+    for (auto &tree: dense_bp_trees)
+        tree.setHotKeyCache(hot_key_cache_entries);
+    for (auto &tree: sparse_bp_trees)
+        tree.setHotKeyCache(hot_key_cache_entries);
+    measure_skewed_queries_bplus(dense_bp_trees, "Dense B+ Tree (skew, cached)", threads, out);
+    measure_skewed_queries_bplus(sparse_bp_trees, "Sparse B+ Tree (skew, cached)", threads, out);
+    for (auto &tree: dense_bp_trees)
+        tree.setHotKeyCache(0);
+    for (auto &tree: sparse_bp_trees)
+        tree.setHotKeyCache(0);
 
     measure_range_queries_bplus(dense_bp_trees, "Dense B+ Tree (range)", threads, out);
+    measure_range_queries_bplus(frozen_dense_bp_trees, "Dense B+ Tree (frozen range)", threads, out);
+    measure_range_scans_bplus(dense_bp_trees, "Dense B+ Tree (range scan)", threads, out);
+    measure_random_queries_bplus(packed_dense_bp_trees, "Dense B+ Tree (compressed)", threads, out);
+    measure_random_queries_bplus(packed_sparse_bp_trees, "Sparse B+ Tree (compressed)", threads, out);
+    measure_range_scans_bplus(packed_dense_bp_trees, "Dense B+ Tree (compressed range scan)", threads, out);
+
+    measure_random_queries_sharded(sharded_bp_trees, "Dense Sharded B+ Tree", threads, out);
+    measure_random_queries_sharded(sharded_tries, "Dense Sharded Trie", threads, out);
+    measure_parallel_inserts([] { return BPlusTree<>(); },
+                             [](BPlusTree<> &t, uint32_t k, uint32_t v) { t.insert(k, v); }, "B+ Tree (insert)",
+                             threads, out);
+    measure_parallel_inserts([] { return ShardedIndex<BPlusTree<>>(); },
+                             [](ShardedIndex<BPlusTree<>> &s, uint32_t k, uint32_t v) { s.insert(k, v); },
+                             "Sharded B+ Tree (insert)", threads, out);
+    measure_parallel_inserts([] { return Trie<>(); },
+                             [](Trie<> &t, uint32_t k, uint32_t v) { insert_concurrent(&t, k, v); }, "Trie (insert)",
+                             threads, out);
+    measure_parallel_inserts([] { return ShardedIndex<Trie<>>(); },
+                             [](ShardedIndex<Trie<>> &s, uint32_t k, uint32_t v) { s.insert(k, v); },
+                             "Sharded Trie (insert)", threads, out);
+
+    measure_snapshot_ingest("Versioned B+ Tree", number_of_sizes, out);
+
+    measure_mixed_queries_tries(dense_tries, "Dense Trie (mixed)", threads, out);
+    measure_mixed_queries_bplus(dense_bp_trees, "Dense B+ Tree (mixed)", threads, out);
+
+    measure_churn_queries_tries(dense_tries, "Dense Trie (churn)", out);
+    measure_churn_queries_bplus(dense_bp_trees, "Dense B+ Tree (churn)", threads, out);
+
+    // Keys that used to be hashed down to 32 bits: scattered 64-bit IDs and short strings sharing a prefix
+    measure_random_queries_keyed<uint64_t>([](uint64_t i) { return i * 0x9e3779b97f4a7c15ull; }, "64-bit keys", threads,
+                                           number_of_sizes, out);
+    measure_random_queries_keyed<ByteKey<16>>(
+            [](uint32_t i) {
+                char text[17];
+                snprintf(text, sizeof(text), "user:%010u", i * 2654435761u);
+                return ByteKey<16>::from(text);
+            },
+            "string keys", threads, number_of_sizes, out);
 
     out.close();
 
@@ -0,0 +1,285 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+#include "file_io.h"
+#include "key_search.h"
+#include "mapped_b_plus_tree.h"
+#include "node_layout.h"
+
+using namespace std;
+
+static constexpr char fileMagic[8] = {'B', 'P', 'T', 'R', 'E', 'E', 0, 0};
+static constexpr uint32_t formatVersion = 1;
+static constexpr uint32_t noNode = UINT32_MAX;
+static constexpr size_t pageBytes = 4096;
+
+// The header takes a whole page (or node, if nodes are larger), so the nodes behind it start page-aligned.
+static constexpr size_t headerBytes(const size_t nodeBytes) { return std::max(nodeBytes, pageBytes); }
+
+template<size_t NodeBytes>
+struct MappedBPlusTree<NodeBytes>::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeBytes;
+    uint32_t root; // noNode for an empty tree
+    uint32_t height; // levels including the leaves
+    uint64_t nodes;
+    uint64_t keys;
+};
+
+// Same geometry as the in-memory nodes, except that child links are 4-byte node numbers, which leaves room for a few
+// more children per inner node.
+template<size_t NodeBytes>
+struct MappedBPlusTree<NodeBytes>::Leaf {
+    static constexpr int capacity = fitCapacity(NodeBytes, sizeof(uint32_t), sizeof(uint32_t), 0);
+
+    uint32_t count;
+    uint32_t next; // noNode on the last leaf
+    alignas(cacheLine) uint32_t keys[lines(capacity * sizeof(uint32_t)) / sizeof(uint32_t)];
+    alignas(cacheLine) uint32_t values[capacity];
+};
+
+template<size_t NodeBytes>
+struct MappedBPlusTree<NodeBytes>::Inner {
+    static constexpr int capacity = fitCapacity(NodeBytes, sizeof(uint32_t), sizeof(uint32_t), 1);
+
+    uint32_t count;
+    alignas(cacheLine) uint32_t keys[lines(capacity * sizeof(uint32_t)) / sizeof(uint32_t)];
+    alignas(cacheLine) uint32_t children[capacity + 1];
+};
+
+namespace {
+    // Appends nodes to the file in large sequential writes.
+    template<size_t NodeBytes>
+    class NodeWriter {
+    public:
+        NodeWriter(const int fd, const string &path) : fd(fd), path(path) { buffer.reserve(bufferBytes); }
+
+        // Returns the number of the node just appended.
+        template<typename NodeType>
+        uint32_t append(const NodeType &node) {
+            static_assert(sizeof(NodeType) <= NodeBytes && is_trivially_copyable_v<NodeType>);
+            if (nodes == noNode)
+                throw length_error("too many nodes for " + path);
+            const size_t at = buffer.size();
+            buffer.resize(at + NodeBytes);
+            memcpy(buffer.data() + at, &node, sizeof(NodeType));
+            if (buffer.size() >= bufferBytes)
+                flush();
+            return nodes++;
+        }
+
+        void flush() {
+            writeAll(fd, buffer.data(), buffer.size(), offset, path);
+            offset += buffer.size();
+            buffer.clear();
+        }
+
+        uint32_t count() const { return nodes; }
+
+    private:
+        static constexpr size_t bufferBytes = 1 << 20;
+
+        int fd;
+        const string &path;
+        off_t offset = headerBytes(NodeBytes);
+        uint32_t nodes = 0;
+        vector<char> buffer;
+    };
+} // namespace
+
+template<size_t NodeBytes>
+void MappedBPlusTree<NodeBytes>::write(const BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, NodeBytes> &tree,
+                                       const std::string &path) {
+    const string temporary = path + ".tmp";
+    File file(open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    if (file.fd < 0)
+        throw system_error(errno, generic_category(), "open " + temporary);
+
+    // Leaves go out as they fill up, keeping only their lowest keys for the levels above
+    NodeWriter<NodeBytes> writer(file.fd, temporary);
+    vector<uint32_t> lowKeys;
+    uint64_t keys = 0;
+    Leaf leaf{};
+    for (const auto &[key, value]: tree.scan(0, UINT32_MAX)) {
+        if (leaf.count == Leaf::capacity) {
+            leaf.next = writer.count() + 1;
+            lowKeys.push_back(leaf.keys[0]);
+            writer.append(leaf);
+            leaf = {};
+        }
+        leaf.keys[leaf.count] = key;
+        leaf.values[leaf.count] = value;
+        leaf.count++;
+        keys++;
+    }
+    if (leaf.count > 0) {
+        leaf.next = noNode;
+        lowKeys.push_back(leaf.keys[0]);
+        writer.append(leaf);
+    }
+
+    // Then every inner level, from the bottom up
+    uint32_t height = lowKeys.empty() ? 0 : 1;
+    uint32_t firstChild = 0;
+    while (lowKeys.size() > 1) {
+        vector<uint32_t> parentLowKeys;
+        const uint32_t firstParent = writer.count();
+        for (size_t first = 0; first < lowKeys.size(); first += Inner::capacity + 1) {
+            const size_t children = std::min<size_t>(Inner::capacity + 1, lowKeys.size() - first);
+            Inner inner{};
+            inner.count = children - 1;
+            for (size_t i = 0; i < children; i++)
+                inner.children[i] = firstChild + first + i;
+            std::copy_n(lowKeys.begin() + first + 1, children - 1, inner.keys);
+            parentLowKeys.push_back(lowKeys[first]);
+            writer.append(inner);
+        }
+        lowKeys = std::move(parentLowKeys);
+        firstChild = firstParent;
+        height++;
+    }
+    writer.flush();
+
+    // The header goes last, so a file cut short never passes for a complete one
+    vector<char> header(headerBytes(NodeBytes));
+    const Header fields{{}, formatVersion, NodeBytes, height ? writer.count() - 1 : noNode, height, writer.count(), keys};
+    memcpy(header.data(), &fields, sizeof(fields));
+    memcpy(header.data(), fileMagic, sizeof(fileMagic));
+    writeAll(file.fd, header.data(), header.size(), 0, temporary);
+
+    syncData(file.fd, temporary);
+    if (rename(temporary.c_str(), path.c_str()) != 0)
+        throw system_error(errno, generic_category(), "rename " + temporary);
+    const filesystem::path directory = filesystem::path(path).parent_path();
+    syncDirectory(directory.empty() ? "." : directory.string());
+}
+
+template<size_t NodeBytes>
+MappedBPlusTree<NodeBytes>::MappedBPlusTree(const std::string &path) {
+    static_assert(sizeof(Leaf) <= NodeBytes && sizeof(Inner) <= NodeBytes);
+
+    const File file(open(path.c_str(), O_RDONLY));
+    if (file.fd < 0)
+        throw system_error(errno, generic_category(), "open " + path);
+    struct stat status{};
+    if (fstat(file.fd, &status) != 0)
+        throw system_error(errno, generic_category(), "stat " + path);
+    if (static_cast<size_t>(status.st_size) < headerBytes(NodeBytes))
+        throw runtime_error(path + " is not a B+ tree file");
+
+    bytes = status.st_size;
+    void *mapped = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, file.fd, 0);
+    if (mapped == MAP_FAILED)
+        throw system_error(errno, generic_category(), "mmap " + path);
+    base = static_cast<const char *>(mapped);
+
+    const Header &h = header();
+    if (memcmp(h.magic, fileMagic, sizeof(fileMagic)) != 0 || h.version != formatVersion || h.nodeBytes != NodeBytes ||
+        bytes != headerBytes(NodeBytes) + h.nodes * NodeBytes) {
+        munmap(mapped, bytes);
+        throw runtime_error(path + " is not a B+ tree file for " + to_string(NodeBytes) + "-byte nodes");
+    }
+    // Node numbers are 32 bits, every level has at least one node, the root is the last one written, and an empty
+    // tree has neither
+    const bool empty = h.root == noNode;
+    if (h.nodes > noNode || empty != (h.height == 0) || empty != (h.nodes == 0) ||
+        (!empty && (h.root != h.nodes - 1 || h.height > h.nodes))) {
+        munmap(mapped, bytes);
+        throw runtime_error(path + " has an inconsistent B+ tree header");
+    }
+    // Lookups jump all over the file, so readahead would only pull in nodes nobody asked for
+    madvise(mapped, bytes, MADV_RANDOM);
+}
+
+template<size_t NodeBytes>
+MappedBPlusTree<NodeBytes>::~MappedBPlusTree() {
+    if (base)
+        munmap(const_cast<char *>(base), bytes);
+}
+
+template<size_t NodeBytes>
+MappedBPlusTree<NodeBytes>::MappedBPlusTree(MappedBPlusTree &&other) noexcept :
+    base(std::exchange(other.base, nullptr)), bytes(std::exchange(other.bytes, 0)) {}
+
+template<size_t NodeBytes>
+MappedBPlusTree<NodeBytes> &MappedBPlusTree<NodeBytes>::operator=(MappedBPlusTree &&other) noexcept {
+    std::swap(base, other.base);
+    std::swap(bytes, other.bytes);
+    return *this;
+}
+
+template<size_t NodeBytes>
+const typename MappedBPlusTree<NodeBytes>::Header &MappedBPlusTree<NodeBytes>::header() const {
+    return *reinterpret_cast<const Header *>(base);
+}
+
+template<size_t NodeBytes>
+template<typename NodeType>
+const NodeType *MappedBPlusTree<NodeBytes>::node(const uint32_t number) const {
+    const uint64_t clamped = std::min<uint64_t>(number, header().nodes - 1);
+    return reinterpret_cast<const NodeType *>(base + headerBytes(NodeBytes) + clamped * NodeBytes);
+}
+
+template<size_t NodeBytes>
+const typename MappedBPlusTree<NodeBytes>::Leaf *MappedBPlusTree<NodeBytes>::findLeaf(const uint32_t key) const {
+    uint32_t number = header().root;
+    for (uint32_t level = 1; level < header().height; level++) {
+        const auto inner = node<Inner>(number);
+        const int count = std::min<uint32_t>(inner->count, Inner::capacity);
+        number = inner->children[upperBound(KeySearch::Vector, inner->keys, count, key)];
+    }
+    return node<Leaf>(number);
+}
+
+template<size_t NodeBytes>
+uint32_t MappedBPlusTree<NodeBytes>::query(const uint32_t key) const {
+    if (header().root == noNode)
+        return 0;
+    const Leaf *leaf = findLeaf(key);
+    const int count = std::min<uint32_t>(leaf->count, Leaf::capacity);
+    const int idx = lowerBound(KeySearch::Vector, leaf->keys, count, key);
+    return idx < count && leaf->keys[idx] == key ? leaf->values[idx] : 0;
+}
+
+template<size_t NodeBytes>
+std::vector<std::pair<uint32_t, uint32_t>> MappedBPlusTree<NodeBytes>::range(const uint32_t low,
+                                                                               const uint32_t high) const {
+    std::vector<std::pair<uint32_t, uint32_t>> result;
+    if (header().root == noNode || low > high)
+        return result;
+
+    const Leaf *leaf = findLeaf(low);
+    // No chain of next links, however corrupt, visits more leaves than the file holds nodes
+    for (uint64_t visited = 1;; visited++) {
+        const int count = std::min<uint32_t>(leaf->count, Leaf::capacity);
+        for (int i = visited == 1 ? lowerBound(KeySearch::Vector, leaf->keys, count, low) : 0; i < count; i++) {
+            if (leaf->keys[i] > high)
+                return result;
+            result.emplace_back(leaf->keys[i], leaf->values[i]);
+        }
+        if (leaf->next == noNode || visited == header().nodes)
+            return result;
+        leaf = node<Leaf>(leaf->next);
+    }
+}
+
+template<size_t NodeBytes>
+size_t MappedBPlusTree<NodeBytes>::size() const {
+    return header().keys;
+}
+
+template class MappedBPlusTree<256>;
+template class MappedBPlusTree<1024>;
+template class MappedBPlusTree<4096>;
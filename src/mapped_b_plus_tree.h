@@ -0,0 +1,57 @@
+#ifndef MAPPED_B_PLUS_TREE_H
+#define MAPPED_B_PLUS_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "b_plus_tree.h"
+
+// Read-only B+ tree served straight from a file written by write(). The file is a header page followed by
+// NodeBytes-sized nodes at NodeBytes-aligned offsets, so none straddles a page: the leaves in key order, then each
+// inner level above them, the root last. Nodes refer to each other by node number instead of by pointer, so opening a
+// file is a single mmap with no deserialization, and the OS page cache keeps it warm across restarts. Integers are
+// stored in native byte order; files written for another NodeBytes or format version are rejected, as are headers
+// that do not add up. Node contents are not checked at open, but counts and node numbers are clamped as they are
+// read, so a corrupt file may give wrong answers but never makes a lookup read outside the mapping.
+//
+// Nothing is ever written through the mapping, so any number of threads may query a mapped tree at once.
+template<size_t NodeBytes = 1024>
+class MappedBPlusTree {
+public:
+    // Writes every entry of tree to path with fully packed nodes, replacing the file only once it is complete. The
+    // tree is streamed through a cursor, so this may run alongside writers with the guarantees of BPlusTree::scan.
+    // Throws std::system_error when the file cannot be written.
+    static void write(const BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, NodeBytes> &tree,
+                      const std::string &path);
+
+    // Maps the file at path. Throws std::system_error if it cannot be opened and std::runtime_error if it does not
+    // hold a tree in this format.
+    explicit MappedBPlusTree(const std::string &path);
+    ~MappedBPlusTree();
+    MappedBPlusTree(const MappedBPlusTree &) = delete;
+    MappedBPlusTree &operator=(const MappedBPlusTree &) = delete;
+    MappedBPlusTree(MappedBPlusTree &&other) noexcept;
+    MappedBPlusTree &operator=(MappedBPlusTree &&other) noexcept;
+
+    uint32_t query(uint32_t key) const;
+    std::vector<std::pair<uint32_t, uint32_t>> range(uint32_t low, uint32_t high) const;
+    size_t size() const;
+
+private:
+    struct Header;
+    struct Leaf;
+    struct Inner;
+    const char *base = nullptr;
+    size_t bytes = 0;
+
+    const Header &header() const;
+    // The node with number, or the last one for a number past the end.
+    template<typename NodeType>
+    const NodeType *node(uint32_t number) const;
+    const Leaf *findLeaf(uint32_t key) const;
+};
+
+#endif // MAPPED_B_PLUS_TREE_H
@@ -0,0 +1,32 @@
+#ifndef NODE_LAYOUT_H
+#define NODE_LAYOUT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Geometry shared by the B+ tree node formats, in memory and on disk.
+inline constexpr size_t cacheLine = 64;
+
+inline constexpr size_t lines(const size_t bytes) { return (bytes + cacheLine - 1) / cacheLine * cacheLine; }
+
+// Largest number of keys whose key array (keyBytes each) and payload array (payload bytes per key, plus extra payload
+// slots) both start on a cache line and fit behind the header line of a NodeBytes block.
+inline constexpr int fitCapacity(const size_t nodeBytes, const size_t keyBytes, const size_t payloadBytes,
+                                 const size_t extraPayload) {
+    int capacity = static_cast<int>(nodeBytes / keyBytes);
+    while (capacity > 0 &&
+           cacheLine + lines(capacity * keyBytes) + lines((capacity + extraPayload) * payloadBytes) > nodeBytes)
+        capacity--;
+    return capacity;
+}
+
+// Largest number of entries whose key array (keyBytes each) and value array (valueBytes each) both start on a cache
+// line and fit behind the header line of a NodeBytes block.
+inline constexpr int packedCapacity(const size_t nodeBytes, const size_t keyBytes, const size_t valueBytes) {
+    int capacity = static_cast<int>((nodeBytes - cacheLine) / keyBytes);
+    while (capacity > 0 && cacheLine + lines(capacity * keyBytes) + lines(capacity * valueBytes) > nodeBytes)
+        capacity--;
+    return capacity;
+}
+
+#endif // NODE_LAYOUT_H
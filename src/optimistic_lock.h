@@ -0,0 +1,63 @@
+#ifndef OPTIMISTIC_LOCK_H
+#define OPTIMISTIC_LOCK_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Version lock for optimistic lock coupling. Readers never write to it: they remember the version before reading a
+// node and validate it afterwards, retrying if a writer got in between. Writers take it exclusively, which bumps the
+// version on release. Bit 1 is the lock bit, bit 0 marks a node that was unlinked from the structure.
+class OptimisticLock {
+public:
+    // Waits for a writer to leave and returns the version to validate against. False if the node is obsolete.
+    bool readLock(uint64_t &version) const {
+        version = awaitUnlocked();
+        return !(version & obsoleteBit);
+    }
+
+    // True if no writer touched the node since version was read.
+    bool validate(const uint64_t version) const { return version == word.load(std::memory_order_acquire); }
+
+    // Turns a read into the write lock, failing if the node changed since version was read.
+    bool upgrade(uint64_t &version) {
+        if (!word.compare_exchange_strong(version, version + lockBit, std::memory_order_acquire))
+            return false;
+        version += lockBit;
+        return true;
+    }
+
+    // Takes the write lock directly; false if the node is obsolete.
+    bool writeLock() {
+        uint64_t version;
+        do {
+            if (!readLock(version))
+                return false;
+        } while (!upgrade(version));
+        return true;
+    }
+
+    void writeUnlock() { word.fetch_add(lockBit, std::memory_order_release); }
+
+    // Releases the lock and marks the node as unlinked, so later lockers know to start over.
+    void writeUnlockObsolete() { word.fetch_add(lockBit | obsoleteBit, std::memory_order_release); }
+
+private:
+    static constexpr uint64_t obsoleteBit = 1;
+    static constexpr uint64_t lockBit = 2;
+
+    std::atomic<uint64_t> word{0};
+
+    uint64_t awaitUnlocked() const {
+        uint64_t version = word.load(std::memory_order_acquire);
+        for (int spins = 0; version & lockBit; spins++) {
+            // The writer may be descheduled on an oversubscribed core, so stop burning its time slice
+            if (spins > 64)
+                std::this_thread::yield();
+            version = word.load(std::memory_order_acquire);
+        }
+        return version;
+    }
+};
+
+#endif // OPTIMISTIC_LOCK_H
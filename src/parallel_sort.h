@@ -0,0 +1,64 @@
+#ifndef PARALLEL_SORT_H
+#define PARALLEL_SORT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <thread>
+#include <vector>
+
+// Orders key/value pairs by key only, so entries with equal keys keep their input order.
+struct KeyLess {
+    template<typename Pair>
+    bool operator()(const Pair &a, const Pair &b) const {
+        return a.first < b.first;
+    }
+};
+
+// Splits [0, count) into up to threads contiguous ranges of about the same length and calls fn(begin, end) on each,
+// the first on the calling thread and every other on a thread of its own; returns once all are done.
+template<typename Fn>
+void parallelFor(const size_t count, unsigned threads, Fn &&fn) {
+    threads = static_cast<unsigned>(std::clamp<size_t>(count, 1, std::max(1u, threads)));
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++)
+        workers.emplace_back([&, i] { fn(count * i / threads, count * (i + 1) / threads); });
+    fn(size_t{0}, count / threads);
+    for (auto &worker: workers)
+        worker.join();
+}
+
+// Stable sort split across threads: every thread sorts one chunk, then neighbouring runs are merged pairwise (again
+// in parallel) until a single run is left. Use this to prepare unsorted input for the bulk loaders.
+template<typename T, typename Compare = KeyLess>
+void parallelSort(std::span<T> data, unsigned threads = std::thread::hardware_concurrency(), Compare comp = {}) {
+    constexpr size_t minChunk = 1 << 16;
+    threads = std::max(1u, std::min<unsigned>(threads, data.size() / minChunk + 1));
+
+    std::vector<size_t> bounds(threads + 1);
+    for (unsigned i = 0; i <= threads; i++)
+        bounds[i] = data.size() * i / threads;
+
+    auto forEachWorker = [&](const unsigned step, auto &&task) {
+        std::vector<std::thread> workers;
+        for (unsigned i = step; i < threads; i += step)
+            workers.emplace_back(task, i);
+        task(0u);
+        for (auto &worker: workers)
+            worker.join();
+    };
+
+    forEachWorker(1, [&](const unsigned i) {
+        std::stable_sort(data.begin() + bounds[i], data.begin() + bounds[i + 1], comp);
+    });
+
+    for (unsigned width = 1; width < threads; width *= 2) {
+        forEachWorker(2 * width, [&](const unsigned i) {
+            const size_t mid = bounds[std::min(i + width, threads)];
+            const size_t end = bounds[std::min(i + 2 * width, threads)];
+            std::inplace_merge(data.begin() + bounds[i], data.begin() + mid, data.begin() + end, comp);
+        });
+    }
+}
+
+#endif // PARALLEL_SORT_H
@@ -0,0 +1,110 @@
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <limits>
+
+#include "perf_counters.h"
+
+using namespace std;
+
+const char *const perfEventNames[perfEventCount] = {"cycles",     "instructions", "l1d_misses",
+                                                    "llc_misses", "dtlb_misses",  "branch_misses"};
+
+namespace {
+    constexpr uint64_t cacheReadMiss(const uint64_t cache) {
+        return cache | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    }
+
+    // Type and config of each PerfEvent
+    constexpr pair<uint32_t, uint64_t> events[perfEventCount] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, cacheReadMiss(PERF_COUNT_HW_CACHE_L1D)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HW_CACHE, cacheReadMiss(PERF_COUNT_HW_CACHE_DTLB)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    int openEvent(const uint32_t type, const uint64_t config, const bool children) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = children;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    }
+} // namespace
+
+PerfCounts &PerfCounts::operator+=(const PerfCounts &other) {
+    for (int i = 0; i < perfEventCount; i++)
+        counts[i] += other.counts[i];
+    return *this;
+}
+
+PerfCounts PerfCounts::operator/(const double divisor) const {
+    PerfCounts result = *this;
+    for (double &count: result.counts)
+        count /= divisor;
+    return result;
+}
+
+PerfCounters::PerfCounters(const bool children) {
+    for (int i = 0; i < perfEventCount; i++)
+        fds[i] = openEvent(events[i].first, events[i].second, children);
+}
+
+PerfCounters::~PerfCounters() {
+    for (const int fd: fds) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+bool PerfCounters::available() const {
+    for (const int fd: fds) {
+        if (fd >= 0)
+            return true;
+    }
+    return false;
+}
+
+void PerfCounters::start() {
+    for (const int fd: fds) {
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void PerfCounters::stop() {
+    for (const int fd: fds) {
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+}
+
+PerfCounts PerfCounters::read() const {
+    PerfCounts result;
+    for (int i = 0; i < perfEventCount; i++) {
+        uint64_t values[3]; // count, time enabled, time running
+        if (fds[i] < 0 || ::read(fds[i], values, sizeof(values)) != sizeof(values)) {
+            result.counts[i] = numeric_limits<double>::quiet_NaN();
+            continue;
+        }
+        if (values[2] == 0) {
+            // Enabled but never scheduled onto a hardware counter: nothing to scale up
+            result.counts[i] = values[1] == 0 ? 0 : numeric_limits<double>::quiet_NaN();
+            continue;
+        }
+        const double scale = static_cast<double>(values[1]) / static_cast<double>(values[2]);
+        result.counts[i] = static_cast<double>(values[0]) * scale;
+    }
+    return result;
+}
@@ -0,0 +1,46 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <array>
+#include <cstdint>
+
+// The hardware events the benchmark can count, in the order of their results.csv columns.
+enum class PerfEvent { Cycles, Instructions, L1dMisses, LlcMisses, DtlbMisses, BranchMisses };
+constexpr int perfEventCount = 6;
+extern const char *const perfEventNames[perfEventCount]; // column names: cycles, instructions, l1d_misses, ...
+
+// Counts of each event. An event the kernel or the CPU cannot count is NaN, which sums stay.
+struct PerfCounts {
+    std::array<double, perfEventCount> counts{};
+
+    double operator[](PerfEvent event) const { return counts[static_cast<int>(event)]; }
+    PerfCounts &operator+=(const PerfCounts &other);
+    PerfCounts operator/(double divisor) const;
+};
+
+// perf_event_open counters for the user-space work of the thread that creates them, and with children set also of the
+// threads it creates afterwards (counted once those exit). They start stopped. Each event is opened on its own, so
+// the kernel can multiplex them when the CPU has fewer counters than events; counts are scaled up to the whole time
+// they were enabled.
+//
+// Needs perf_event_paranoid <= 2 for user-space counting, and a CPU that exposes its PMU (virtual machines often do
+// not): events that cannot be opened are left out and count NaN.
+class PerfCounters {
+public:
+    explicit PerfCounters(bool children = false);
+    ~PerfCounters();
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    // Whether any event could be opened.
+    bool available() const;
+    void start();
+    void stop();
+    // Counts between all start/stop pairs so far.
+    PerfCounts read() const;
+
+private:
+    std::array<int, perfEventCount> fds;
+};
+
+#endif // PERF_COUNTERS_H
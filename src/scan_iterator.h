@@ -0,0 +1,36 @@
+#ifndef SCAN_ITERATOR_H
+#define SCAN_ITERATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+
+// Input iterator over a range cursor, which provides done(), current() and advance(). It compares equal to
+// std::default_sentinel once the cursor has run out, so cursors work in range-for loops and std::ranges algorithms.
+// The iterator refers to its cursor, which has to stay where it is while iterating. Entry is what current() returns.
+template<typename Cursor, typename Entry = std::pair<uint32_t, uint32_t>>
+class ScanIterator {
+public:
+    using value_type = Entry;
+    using difference_type = std::ptrdiff_t;
+
+    ScanIterator() = default;
+    explicit ScanIterator(Cursor *cursor) : cursor(cursor) {}
+
+    const value_type &operator*() const { return cursor->current(); }
+
+    ScanIterator &operator++() {
+        cursor->advance();
+        return *this;
+    }
+
+    void operator++(int) { cursor->advance(); }
+
+    friend bool operator==(const ScanIterator &it, std::default_sentinel_t) { return it.cursor->done(); }
+
+private:
+    Cursor *cursor = nullptr;
+};
+
+#endif // SCAN_ITERATOR_H
@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#include "b_plus_tree.h"
+#include "cpu_affinity.h"
+#include "index_adapters.h"
+#include "sharded_index.h"
+#include "trie.h"
+
+using namespace std;
+
+// The wrapper-specific half of how ShardedIndex reaches into each kind of index; shards are written and read from
+// several threads, so the trie goes through its concurrent mode.
+namespace {
+    using index_adapters::drop;
+    using index_adapters::load;
+    using index_adapters::lookup;
+    using index_adapters::put;
+    using index_adapters::Tree;
+
+    void put(Trie<> &trie, const uint32_t key, const uint32_t value) { insert_concurrent(&trie, key, value); }
+
+    uint32_t lookup(Trie<> &trie, const uint32_t key) { return query_concurrent(&trie, key); }
+
+    template<size_t NodeBytes>
+    vector<pair<uint32_t, uint32_t>> collect(Tree<NodeBytes> &tree, const uint32_t low, const uint32_t high) {
+        return tree.range(low, high);
+    }
+
+    vector<pair<uint32_t, uint32_t>> collect(Trie<> &trie, const uint32_t low, const uint32_t high) {
+        return range(&trie, low, high);
+    }
+
+    template<size_t NodeBytes>
+    size_t count(Tree<NodeBytes> &tree, const uint32_t low, const uint32_t high) {
+        return tree.rangeCount(low, high);
+    }
+
+    size_t count(Trie<> &trie, const uint32_t low, const uint32_t high) { return range_count(&trie, low, high); }
+
+    template<size_t NodeBytes>
+    IndexStats statsOf(Tree<NodeBytes> &tree) {
+        return tree.stats();
+    }
+
+    IndexStats statsOf(Trie<> &trie) { return stats(&trie); }
+
+    size_t defaultShards(const size_t shards) { return shards > 0 ? shards : allowedCpus().size(); }
+} // namespace
+
+template<typename Index>
+ShardedIndex<Index>::ShardedIndex(size_t shards) {
+    shards = defaultShards(shards);
+    for (size_t i = 0; i < shards; i++)
+        lowKeys.push_back(static_cast<uint32_t>((uint64_t{1} << 32) * i / shards));
+    build([](size_t, Index &) {});
+}
+
+template<typename Index>
+ShardedIndex<Index>::ShardedIndex(const span<const pair<uint32_t, uint32_t>> sorted, size_t shards) {
+    shards = defaultShards(shards);
+    // Shard i starts at entry cuts[i], moved forward past keys equal to the one before it
+    vector<size_t> cuts = {0};
+    for (size_t i = 1; i < shards; i++) {
+        size_t cut = max(sorted.size() * i / shards, cuts.back() + 1);
+        while (cut < sorted.size() && sorted[cut].first == sorted[cut - 1].first)
+            cut++;
+        if (cut >= sorted.size())
+            break;
+        cuts.push_back(cut);
+    }
+    lowKeys.push_back(0);
+    for (size_t i = 1; i < cuts.size(); i++)
+        lowKeys.push_back(sorted[cuts[i]].first);
+    cuts.push_back(sorted.size());
+
+    build([&](const size_t shard, Index &index) {
+        load(index, sorted.subspan(cuts[shard], cuts[shard + 1] - cuts[shard]));
+    });
+}
+
+template<typename Index>
+template<typename Fill>
+void ShardedIndex<Index>::build(Fill &&fill) {
+    const vector<int> cpus = allowedCpus();
+    owners.resize(lowKeys.size());
+    shards.resize(lowKeys.size());
+
+    vector<thread> builders;
+    for (size_t i = 0; i < shards.size(); i++) {
+        owners[i] = cpus[i % cpus.size()];
+        builders.emplace_back([&, i] {
+            pinThread(owners[i]);
+            shards[i] = make_unique<Index>();
+            fill(i, *shards[i]);
+        });
+    }
+    for (auto &builder: builders)
+        builder.join();
+}
+
+template<typename Index>
+size_t ShardedIndex<Index>::shardOf(const uint32_t key) const {
+    return upper_bound(lowKeys.begin(), lowKeys.end(), key) - lowKeys.begin() - 1;
+}
+
+template<typename Index>
+void ShardedIndex<Index>::insert(const uint32_t key, const uint32_t value) {
+    put(*shards[shardOf(key)], key, value);
+}
+
+template<typename Index>
+bool ShardedIndex<Index>::erase(const uint32_t key) {
+    return drop(*shards[shardOf(key)], key);
+}
+
+template<typename Index>
+uint32_t ShardedIndex<Index>::query(const uint32_t key) {
+    return lookup(*shards[shardOf(key)], key);
+}
+
+template<typename Index>
+vector<pair<uint32_t, uint32_t>> ShardedIndex<Index>::range(const uint32_t low, const uint32_t high) {
+    vector<pair<uint32_t, uint32_t>> result;
+    if (high < low)
+        return result;
+    for (size_t i = shardOf(low); i <= shardOf(high); i++) {
+        const auto part = collect(*shards[i], low, high);
+        result.insert(result.end(), part.begin(), part.end());
+    }
+    return result;
+}
+
+template<typename Index>
+size_t ShardedIndex<Index>::rangeCount(const uint32_t low, const uint32_t high) {
+    if (high < low)
+        return 0;
+    size_t total = 0;
+    for (size_t i = shardOf(low); i <= shardOf(high); i++)
+        total += count(*shards[i], low, high);
+    return total;
+}
+
+template<typename Index>
+IndexStats ShardedIndex<Index>::stats() {
+    IndexStats total;
+    for (const auto &shard: shards)
+        total += statsOf(*shard);
+    return total;
+}
+
+template class ShardedIndex<BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, 256>>;
+template class ShardedIndex<BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, 1024>>;
+template class ShardedIndex<BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, 4096>>;
+template class ShardedIndex<Trie<>>;
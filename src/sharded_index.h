@@ -0,0 +1,61 @@
+#ifndef SHARDED_INDEX_H
+#define SHARDED_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "index_stats.h"
+
+// Splits an index (a BPlusTree or a Trie, with uint32_t keys and values) into shards by key range, one per CPU by
+// default. Every shard has an owner CPU: the shard is created and bulk-loaded by a thread pinned to that CPU, so its
+// nodes are first touched there and land on the owner's NUMA node, and threads that work on one key range mostly reach
+// into one shard instead of all of them sharing the same upper levels. Point operations are routed to the shard whose
+// range holds the key, range operations visit the shards the range overlaps in key order.
+//
+// Writes to different shards never touch the same memory. insert, erase and query follow the concurrency rules of the
+// index: a sharded BPlusTree may be used from any number of threads. Sharded tries are queried and written in the
+// trie's concurrent mode, so insert and query may run from any number of threads, erase and range only while nothing
+// else runs.
+template<typename Index>
+class ShardedIndex {
+public:
+    // Empty shards splitting the key space evenly. shards = 0 makes one per CPU the process may run on.
+    explicit ShardedIndex(size_t shards = 0);
+    // Builds the shards in parallel from entries sorted by key, splitting them so every shard gets the same number of
+    // keys. Equal keys keep their last occurrence and never end up in two shards, so there may be fewer shards than
+    // asked for.
+    explicit ShardedIndex(std::span<const std::pair<uint32_t, uint32_t>> sorted, size_t shards = 0);
+    ShardedIndex(ShardedIndex &&) noexcept = default;
+    ShardedIndex &operator=(ShardedIndex &&) noexcept = default;
+
+    void insert(uint32_t key, uint32_t value);
+    bool erase(uint32_t key);
+    uint32_t query(uint32_t key);
+    // Entries with keys in [low, high] in key order, the results of the shards concatenated.
+    std::vector<std::pair<uint32_t, uint32_t>> range(uint32_t low, uint32_t high);
+    size_t rangeCount(uint32_t low, uint32_t high);
+    // The statistics of every shard summed up, level by level. Only while nothing else runs.
+    IndexStats stats();
+
+    size_t shardCount() const { return shards.size(); }
+    // The shard whose key range holds key.
+    size_t shardOf(uint32_t key) const;
+    // The CPU that owns shard, for pinning the threads that mostly work on it.
+    int owner(size_t shard) const { return owners[shard]; }
+    Index &shard(size_t shard) { return *shards[shard]; }
+
+private:
+    std::vector<uint32_t> lowKeys; // lowest key routed to each shard, lowKeys[0] == 0
+    std::vector<int> owners;
+    std::vector<std::unique_ptr<Index>> shards;
+
+    // Creates the shards, calling fill(shard, index) on a thread pinned to the shard's owner.
+    template<typename Fill>
+    void build(Fill &&fill);
+};
+
+#endif // SHARDED_INDEX_H
@@ -1,71 +1,1304 @@
 #include "trie.h"
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
-#include <unordered_map>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-static Node *find(Node *node, const uint8_t key) {
-    auto it = node->nodes.find(key);
-    if (it != node->nodes.end()) {
-        return &(it->second);
+#include "parallel_sort.h"
+
+namespace {
+    template<typename Key>
+    constexpr int leaf_depth = KeyTraits<Key>::bytes - 1;
+    // Keys looked up together by query_batch
+    constexpr size_t batch_group = 16;
+
+    template<typename Key>
+    uint8_t key_byte(const Key &key, const int depth) {
+        return KeyTraits<Key>::byteAt(key, depth);
+    }
+
+    // The byte at depth of every key below node, for depth in node's prefix window.
+    uint8_t prefix_byte(const Node *node, const int depth) { return node->prefix[depth - node->depth + max_prefix]; }
+
+    template<typename Key>
+    void set_prefix(Node *node, const Key &key) {
+        for (int i = 0; i < max_prefix; i++) {
+            const int depth = node->depth - max_prefix + i;
+            node->prefix[i] = depth >= 0 ? key_byte(key, depth) : 0;
+        }
+    }
+
+    // The first byte in [from, node->depth) where key leaves node's prefix, or node->depth if it does not. from is one
+    // past the parent's depth, so these are the bytes node skips.
+    template<typename Key>
+    int mismatch(const Node *node, const Key &key, const int from) {
+        for (int depth = from; depth < node->depth; depth++) {
+            if (key_byte(key, depth) != prefix_byte(node, depth))
+                return depth;
+        }
+        return node->depth;
+    }
+
+    // Everything a reader may race with insert_concurrent on is accessed through these. On x86 they compile to plain
+    // moves, so the single-threaded paths pay nothing for them.
+    template<typename T>
+    T load(const T &field) {
+        return std::atomic_ref<T>(const_cast<T &>(field)).load(std::memory_order_acquire);
+    }
+
+    template<typename T>
+    void store(T &field, const T value) {
+        std::atomic_ref<T>(field).store(value, std::memory_order_release);
+    }
+
+    // Slot is Node * on inner levels and the value on the last level. next(byte) returns the smallest
+    // present byte >= byte, or -1.
+    template<typename Slot>
+    struct Node256;
+
+    template<typename Slot>
+    struct Node48;
+
+    template<typename Slot>
+    struct Node16;
+
+    template<typename Slot>
+    struct Node4 : Node {
+        uint8_t keys[4];
+        Slot slots[4];
+
+        explicit Node4(const uint8_t depth) : Node{NodeType::N4, depth, 0, {}, {}}, keys{}, slots{} {}
+
+        bool full() const { return count == 4; }
+
+        Slot *find(const uint8_t byte) {
+            for (int i = 0; i < count; i++) {
+                if (keys[i] == byte)
+                    return &slots[i];
+            }
+            return nullptr;
+        }
+
+        int next(const int byte) const {
+            for (int i = 0; i < count; i++) {
+                if (keys[i] >= byte)
+                    return keys[i];
+            }
+            return -1;
+        }
+
+        Slot *add(const uint8_t byte) {
+            int pos = 0;
+            while (pos < count && keys[pos] < byte)
+                pos++;
+            memmove(keys + pos + 1, keys + pos, count - pos);
+            memmove(slots + pos + 1, slots + pos, (count - pos) * sizeof(Slot));
+            keys[pos] = byte;
+            slots[pos] = Slot{};
+            count++;
+            return &slots[pos];
+        }
+
+        // byte must be present
+        void remove(const uint8_t byte) {
+            int pos = 0;
+            while (keys[pos] != byte)
+                pos++;
+            memmove(keys + pos, keys + pos + 1, count - pos - 1);
+            memmove(slots + pos, slots + pos + 1, (count - pos - 1) * sizeof(Slot));
+            count--;
+        }
+
+        // Keys and slots share the header's line
+        void prefetch(uint8_t) const { __builtin_prefetch(this); }
+
+        Node4 *clone(Arena &arena) const {
+            auto copy = arena.create<Node4>(depth);
+            memcpy(copy->prefix, prefix, max_prefix);
+            memcpy(copy->keys, keys, count);
+            memcpy(copy->slots, slots, count * sizeof(Slot));
+            copy->count = count;
+            return copy;
+        }
+
+        Node16<Slot> *grow(Arena &arena) const {
+            auto bigger = arena.create<Node16<Slot>>(depth);
+            memcpy(bigger->prefix, prefix, max_prefix);
+            memcpy(bigger->keys, keys, count);
+            memcpy(bigger->slots, slots, count * sizeof(Slot));
+            bigger->count = count;
+            return bigger;
+        }
+
+        template<typename Fn>
+        void for_each(Fn &&fn) {
+            for (int i = 0; i < count; i++)
+                fn(keys[i], load(slots[i]));
+        }
+    };
+
+    template<typename Slot>
+    struct Node16 : Node {
+        uint8_t keys[16];
+        Slot slots[16];
+
+        explicit Node16(const uint8_t depth) : Node{NodeType::N16, depth, 0, {}, {}}, keys{}, slots{} {}
+
+        bool full() const { return count == 16; }
+
+        Slot *find(const uint8_t byte) {
+#ifdef __SSE2__
+            const __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(byte)),
+                                               _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys)));
+            const unsigned mask = _mm_movemask_epi8(cmp) & ((1u << count) - 1);
+            return mask ? &slots[__builtin_ctz(mask)] : nullptr;
+#else
+            for (int i = 0; i < count; i++) {
+                if (keys[i] == byte)
+                    return &slots[i];
+            }
+            return nullptr;
+#endif
+        }
+
+        int next(const int byte) const {
+            for (int i = 0; i < count; i++) {
+                if (keys[i] >= byte)
+                    return keys[i];
+            }
+            return -1;
+        }
+
+        Slot *add(const uint8_t byte) {
+            int pos = 0;
+            while (pos < count && keys[pos] < byte)
+                pos++;
+            memmove(keys + pos + 1, keys + pos, count - pos);
+            memmove(slots + pos + 1, slots + pos, (count - pos) * sizeof(Slot));
+            keys[pos] = byte;
+            slots[pos] = Slot{};
+            count++;
+            return &slots[pos];
+        }
+
+        // byte must be present
+        void remove(const uint8_t byte) {
+            int pos = 0;
+            while (keys[pos] != byte)
+                pos++;
+            memmove(keys + pos, keys + pos + 1, count - pos - 1);
+            memmove(slots + pos, slots + pos + 1, (count - pos - 1) * sizeof(Slot));
+            count--;
+        }
+
+        void prefetch(uint8_t) const {
+            __builtin_prefetch(this);
+            for (size_t offset = 0; offset < sizeof(slots); offset += 64)
+                __builtin_prefetch(reinterpret_cast<const char *>(slots) + offset);
+        }
+
+        Node16 *clone(Arena &arena) const {
+            auto copy = arena.create<Node16>(depth);
+            memcpy(copy->prefix, prefix, max_prefix);
+            memcpy(copy->keys, keys, count);
+            memcpy(copy->slots, slots, count * sizeof(Slot));
+            copy->count = count;
+            return copy;
+        }
+
+        Node48<Slot> *grow(Arena &arena) const {
+            auto bigger = arena.create<Node48<Slot>>(depth);
+            memcpy(bigger->prefix, prefix, max_prefix);
+            for (int i = 0; i < count; i++) {
+                bigger->index[keys[i]] = i + 1;
+                bigger->slots[i] = slots[i];
+            }
+            bigger->count = count;
+            return bigger;
+        }
+
+        template<typename Fn>
+        void for_each(Fn &&fn) {
+            for (int i = 0; i < count; i++)
+                fn(keys[i], load(slots[i]));
+        }
+    };
+
+    template<typename Slot>
+    struct Node48 : Node {
+        uint8_t index[256]; // 0 = empty, otherwise slot position + 1
+        Slot slots[48];
+
+        explicit Node48(const uint8_t depth) : Node{NodeType::N48, depth, 0, {}, {}}, index{}, slots{} {}
+
+        bool full() const { return count == 48; }
+
+        Slot *find(const uint8_t byte) {
+            const uint8_t pos = load(index[byte]);
+            return pos ? &slots[pos - 1] : nullptr;
+        }
+
+        int next(int byte) const {
+            for (; byte < 256; byte++) {
+                if (load(index[byte]))
+                    return byte;
+            }
+            return -1;
+        }
+
+        Slot *add(const uint8_t byte) {
+            index[byte] = count + 1;
+            slots[count] = Slot{};
+            return &slots[count++];
+        }
+
+        // byte must be present. The last slot moves into the hole, so slots stay packed for add.
+        void remove(const uint8_t byte) {
+            const int pos = index[byte] - 1;
+            index[byte] = 0;
+            count--;
+            if (pos == count)
+                return;
+            slots[pos] = slots[count];
+            for (int other = 0; other < 256; other++) {
+                if (index[other] == count + 1) {
+                    index[other] = pos + 1;
+                    break;
+                }
+            }
+        }
+
+        // The slot itself is only known once the index entry has been read
+        void prefetch(const uint8_t byte) const { __builtin_prefetch(&index[byte]); }
+
+        // Fills the slot before publishing it through the index, so readers never see an unset child
+        void add_concurrent(const uint8_t byte, const Slot value) {
+            store(slots[count], value);
+            store(index[byte], static_cast<uint8_t>(count + 1));
+            count++;
+        }
+
+        Node256<Slot> *grow(Arena &arena) const {
+            auto bigger = arena.create<Node256<Slot>>(depth);
+            memcpy(bigger->prefix, prefix, max_prefix);
+            for (int byte = 0; byte < 256; byte++) {
+                if (index[byte]) {
+                    bigger->present[byte >> 6] |= 1ull << (byte & 63);
+                    bigger->slots[byte] = slots[index[byte] - 1];
+                }
+            }
+            bigger->count = count;
+            return bigger;
+        }
+
+        template<typename Fn>
+        void for_each(Fn &&fn) {
+            for (int byte = 0; byte < 256; byte++) {
+                if (const uint8_t pos = load(index[byte]))
+                    fn(static_cast<uint8_t>(byte), load(slots[pos - 1]));
+            }
+        }
+    };
+
+    template<typename Slot>
+    struct Node256 : Node {
+        uint64_t present[4];
+        Slot slots[256];
+
+        explicit Node256(const uint8_t depth) : Node{NodeType::N256, depth, 0, {}, {}}, present{}, slots{} {}
+
+        bool has(const uint8_t byte) const { return load(present[byte >> 6]) >> (byte & 63) & 1; }
+
+        Slot *find(const uint8_t byte) { return has(byte) ? &slots[byte] : nullptr; }
+
+        int next(const int byte) const {
+            for (int word = byte >> 6; word < 4; word++) {
+                uint64_t bits = load(present[word]);
+                if (word == byte >> 6)
+                    bits &= ~0ull << (byte & 63);
+                if (bits)
+                    return word * 64 + __builtin_ctzll(bits);
+            }
+            return -1;
+        }
+
+        Slot *add(const uint8_t byte) {
+            present[byte >> 6] |= 1ull << (byte & 63);
+            slots[byte] = Slot{};
+            count++;
+            return &slots[byte];
+        }
+
+        void remove(const uint8_t byte) {
+            present[byte >> 6] &= ~(1ull << (byte & 63));
+            count--;
+        }
+
+        void prefetch(const uint8_t byte) const {
+            __builtin_prefetch(&present[byte >> 6]);
+            __builtin_prefetch(&slots[byte]);
+        }
+
+        // Fills the slot before setting its presence bit, so readers never see an unset child
+        void add_concurrent(const uint8_t byte, const Slot value) {
+            store(slots[byte], value);
+            std::atomic_ref(present[byte >> 6]).fetch_or(1ull << (byte & 63), std::memory_order_release);
+            count++;
+        }
+
+        template<typename Fn>
+        void for_each(Fn &&fn) {
+            for (int word = 0; word < 4; word++) {
+                for (uint64_t bits = load(present[word]); bits; bits &= bits - 1) {
+                    const int byte = word * 64 + __builtin_ctzll(bits);
+                    fn(static_cast<uint8_t>(byte), load(slots[byte]));
+                }
+            }
+        }
+    };
+
+
+    // Packed last-level node: the present bytes as a bitmap, followed by their values in byte order. For integer keys,
+    // values are stored as their difference to the key in 0, 1 or 2 bytes (0 when every value equals its key) or as
+    // they are, so a full run of 256 keys whose values equal the keys takes 64 bytes instead of a Node256's 1080.
+    // Never written after it is built.
+    template<typename Key, typename Value>
+    struct PackedLeaf : Node {
+        static constexpr bool deltas = std::is_integral_v<Key> && sizeof(Value) > 2;
+
+        uint8_t width; // sizeof(Value) for values stored as they are
+        uint8_t ranks[4]; // present bytes in the words of present before each
+        uint64_t present[4];
+
+        static size_t bytes(const int count, const int width) { return sizeof(PackedLeaf) + count * width; }
+        size_t bytes() const { return bytes(count, width); }
+
+        // sorted holds the entries below one parent byte, equal keys keeping their last occurrence.
+        static PackedLeaf *build(Arena &arena, const uint8_t depth, std::span<const std::pair<Key, Value>> sorted) {
+            int count = 0;
+            int64_t low = 0;
+            int64_t high = 0;
+            for (size_t i = 0; i < sorted.size(); i++) {
+                if (i + 1 < sorted.size() && sorted[i].first == sorted[i + 1].first)
+                    continue;
+                if constexpr (deltas) {
+                    const int64_t delta = valueDelta(sorted[i].first, sorted[i].second);
+                    low = std::min(low, delta);
+                    high = std::max(high, delta);
+                }
+                count++;
+            }
+            int width = sizeof(Value);
+            if constexpr (deltas) {
+                width = low == 0 && high == 0                      ? 0
+                        : low >= INT8_MIN && high <= INT8_MAX   ? 1
+                        : low >= INT16_MIN && high <= INT16_MAX ? 2
+                                                                : sizeof(Value);
+            }
+
+            auto leaf = new (arena.allocate(bytes(count, width))) PackedLeaf{};
+            leaf->type = NodeType::Packed;
+            leaf->depth = depth;
+            leaf->width = width;
+            set_prefix(leaf, sorted.front().first);
+            for (size_t i = 0; i < sorted.size(); i++) {
+                if (i + 1 < sorted.size() && sorted[i].first == sorted[i + 1].first)
+                    continue;
+                const uint8_t byte = key_byte(sorted[i].first, depth);
+                leaf->present[byte >> 6] |= 1ull << (byte & 63);
+                uint8_t *at = leaf->values() + leaf->count * width;
+                if (width == sizeof(Value)) {
+                    memcpy(at, &sorted[i].second, width);
+                } else if constexpr (deltas) {
+                    const auto delta = static_cast<int16_t>(valueDelta(sorted[i].first, sorted[i].second));
+                    memcpy(at, &delta, width);
+                }
+                leaf->count++;
+            }
+            for (int word = 1; word < 4; word++)
+                leaf->ranks[word] = leaf->ranks[word - 1] + __builtin_popcountll(leaf->present[word - 1]);
+            return leaf;
+        }
+
+        uint8_t *values() { return reinterpret_cast<uint8_t *>(this + 1); }
+        const uint8_t *values() const { return reinterpret_cast<const uint8_t *>(this + 1); }
+
+        bool has(const uint8_t byte) const { return present[byte >> 6] >> (byte & 63) & 1; }
+
+        int next(const int byte) const {
+            for (int word = byte >> 6; word < 4; word++) {
+                uint64_t bits = present[word];
+                if (word == byte >> 6)
+                    bits &= ~0ull << (byte & 63);
+                if (bits)
+                    return word * 64 + __builtin_ctzll(bits);
+            }
+            return -1;
+        }
+
+        // Value of the present key, whose last byte picks the slot.
+        Value value(const Key &key) const {
+            const uint8_t byte = key_byte(key, leaf_depth<Key>);
+            const int rank = ranks[byte >> 6] + __builtin_popcountll(present[byte >> 6] & ((1ull << (byte & 63)) - 1));
+            const uint8_t *at = values() + rank * width;
+            if (width == sizeof(Value)) {
+                Value value;
+                memcpy(&value, at, sizeof(value));
+                return value;
+            }
+            if constexpr (deltas) {
+                switch (width) {
+                    case 0:
+                        return addDelta<Key, Value>(key, 0);
+                    case 1:
+                        return addDelta<Key, Value>(key, static_cast<int8_t>(*at));
+                    default: {
+                        int16_t delta;
+                        memcpy(&delta, at, sizeof(delta));
+                        return addDelta<Key, Value>(key, delta);
+                    }
+                }
+            }
+            return Value{};
+        }
+
+        void prefetch(const uint8_t byte) const {
+            // The rank is not known yet, so aim where the value would be if the present bytes were spread evenly
+            __builtin_prefetch(values() + (byte * count >> 8) * width);
+        }
+    };
+
+    template<typename Slot, typename Fn>
+    decltype(auto) dispatch(Node *node, Fn &&fn) {
+        switch (node->type) {
+            case NodeType::N4:
+                return fn(static_cast<Node4<Slot> *>(node));
+            case NodeType::N16:
+                return fn(static_cast<Node16<Slot> *>(node));
+            case NodeType::N48:
+                return fn(static_cast<Node48<Slot> *>(node));
+            default:
+                return fn(static_cast<Node256<Slot> *>(node));
+        }
+    }
+
+    template<typename Slot>
+    Slot *find(Node *node, const uint8_t byte) {
+        return dispatch<Slot>(node, [&](auto *n) { return n->find(byte); });
+    }
+
+    // Returns the slot for byte, adding it (and growing the node in place of *ref) when it does not exist yet.
+    template<typename Slot>
+    Slot *find_or_add(Arena &arena, Node **ref, const uint8_t byte) {
+        return dispatch<Slot>(*ref, [&](auto *n) -> Slot * {
+            if (Slot *slot = n->find(byte))
+                return slot;
+            if constexpr (requires { n->grow(arena); }) {
+                if (n->full()) {
+                    auto bigger = n->grow(arena);
+                    *ref = bigger;
+                    arena.destroy(n);
+                    return bigger->add(byte);
+                }
+            }
+            return n->add(byte);
+        });
+    }
+
+    // Packed nodes have no slots to hand out, so every last-level lookup goes through this. False if key is missing.
+    template<typename Key, typename Value>
+    bool find_value(Node *node, const Key &key, Value &value) {
+        const uint8_t byte = key_byte(key, leaf_depth<Key>);
+        if (node->type == NodeType::Packed) {
+            const auto packed = static_cast<const PackedLeaf<Key, Value> *>(node);
+            if (!packed->has(byte))
+                return false;
+            value = packed->value(key);
+            return true;
+        }
+        const Value *slot = find<Value>(node, byte);
+        if (slot)
+            value = load(*slot);
+        return slot;
+    }
+
+    template<typename Slot>
+    Node *make_node(Arena &arena, const uint8_t depth, const int fanout) {
+        if (fanout <= 4)
+            return arena.create<Node4<Slot>>(depth);
+        if (fanout <= 16)
+            return arena.create<Node16<Slot>>(depth);
+        if (fanout <= 48)
+            return arena.create<Node48<Slot>>(depth);
+        return arena.create<Node256<Slot>>(depth);
+    }
+
+    // from is the first byte not decided by the parent. With threads > 1 the subtrees below the first node that
+    // branches are built concurrently: each thread takes the children starting in its share of the entries, or, if
+    // the node has fewer children than threads, each child gets a thread and splits its own children between its share
+    // of the threads.
+    template<typename Key, typename Value>
+    Node *build(Arena &arena, std::span<const std::pair<Key, Value>> sorted, const int from, const bool compress,
+                const unsigned threads = 1) {
+        // Bytes all entries share are skipped, which, the entries being sorted, are those the first and the last share
+        int depth = from;
+        while (depth < leaf_depth<Key> && depth - from < max_prefix &&
+               key_byte(sorted.front().first, depth) == key_byte(sorted.back().first, depth))
+            depth++;
+        if (depth == leaf_depth<Key> && compress)
+            return PackedLeaf<Key, Value>::build(arena, depth, sorted);
+
+        int fanout = 0;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            if (i == 0 || key_byte(sorted[i].first, depth) != key_byte(sorted[i - 1].first, depth))
+                fanout++;
+        }
+
+        if (depth == leaf_depth<Key>) {
+            Node *node = make_node<Value>(arena, depth, fanout);
+            set_prefix(node, sorted.front().first);
+            dispatch<Value>(node, [&](auto *n) {
+                for (const auto &[key, value]: sorted) {
+                    Value *slot = n->find(key_byte(key, depth));
+                    *(slot ? slot : n->add(key_byte(key, depth))) = value;
+                }
+            });
+            return node;
+        }
+
+        Node *node = make_node<Node *>(arena, depth, fanout);
+        set_prefix(node, sorted.front().first);
+        if (threads > 1) {
+            std::vector<size_t> starts; // of each child's entries, and the end of the last
+            for (size_t i = 0; i < sorted.size(); i++) {
+                if (i == 0 || key_byte(sorted[i].first, depth) != key_byte(sorted[i - 1].first, depth))
+                    starts.push_back(i);
+            }
+            starts.push_back(sorted.size());
+
+            std::vector<Node *> children(fanout);
+            auto build_child = [&](const size_t child, const unsigned child_threads) {
+                children[child] = build(arena, sorted.subspan(starts[child], starts[child + 1] - starts[child]),
+                                        depth + 1, compress, child_threads);
+            };
+            if (static_cast<unsigned>(fanout) >= threads) {
+                parallelFor(sorted.size(), threads, [&](const size_t begin, const size_t end) {
+                    const auto first = std::lower_bound(starts.begin(), starts.end() - 1, begin) - starts.begin();
+                    for (size_t child = first; child < children.size() && starts[child] < end; child++)
+                        build_child(child, 1);
+                });
+            } else {
+                parallelFor(children.size(), fanout, [&](const size_t begin, const size_t end) {
+                    for (size_t child = begin; child < end; child++)
+                        build_child(child, threads / fanout);
+                });
+            }
+            dispatch<Node *>(node, [&](auto *n) {
+                for (size_t child = 0; child < children.size(); child++)
+                    *n->add(key_byte(sorted[starts[child]].first, depth)) = children[child];
+            });
+            return node;
+        }
+        dispatch<Node *>(node, [&](auto *n) {
+            size_t first = 0;
+            while (first < sorted.size()) {
+                const uint8_t byte = key_byte(sorted[first].first, depth);
+                size_t last = first;
+                while (last < sorted.size() && key_byte(sorted[last].first, depth) == byte)
+                    last++;
+                *n->add(byte) = build(arena, sorted.subspan(first, last - first), depth + 1, compress);
+                first = last;
+            }
+        });
+        return node;
+    }
+
+    template<typename Key, typename Value>
+    void free_node(Arena &arena, Node *node) {
+        if (node->type == NodeType::Packed)
+            arena.deallocate(node, static_cast<PackedLeaf<Key, Value> *>(node)->bytes());
+        else if (node->depth == leaf_depth<Key>)
+            dispatch<Value>(node, [&](auto *n) { arena.destroy(n); });
+        else
+            dispatch<Node *>(node, [&](auto *n) { arena.destroy(n); });
+    }
+
+    // Only needed for subtrees that were never published; a whole trie goes away with its arena.
+    template<typename Key, typename Value>
+    void free_subtree(Arena &arena, Node *node) {
+        if (node->depth != leaf_depth<Key>)
+            dispatch<Node *>(node, [&](auto *n) {
+                n->for_each([&](uint8_t, Node *child) { free_subtree<Key, Value>(arena, child); });
+            });
+        free_node<Key, Value>(arena, node);
+    }
+
+    // A fresh path of Node4s holding only key, from the first byte not decided by the parent down to the last level,
+    // skipping as many bytes per node as a prefix holds.
+    template<typename Key, typename Value>
+    Node *chain(Arena &arena, const Key &key, const Value value, const int from) {
+        const int depth = std::min(leaf_depth<Key>, from + max_prefix);
+        if (depth == leaf_depth<Key>) {
+            const auto leaf = arena.create<Node4<Value>>(depth);
+            set_prefix(leaf, key);
+            *leaf->add(key_byte(key, depth)) = value;
+            return leaf;
+        }
+        const auto node = arena.create<Node4<Node *>>(depth);
+        set_prefix(node, key);
+        *node->add(key_byte(key, depth)) = chain(arena, key, value, depth + 1);
+        return node;
+    }
+
+    // A Node4 branching at depth, the first byte where key leaves node's prefix, with node and a fresh path for key
+    // below it. node keeps its prefix, which still holds for its keys.
+    template<typename Key, typename Value>
+    Node *split(Arena &arena, Node *node, const Key &key, const Value value, const int depth) {
+        const auto parent = arena.create<Node4<Node *>>(depth);
+        set_prefix(parent, key);
+        *parent->add(prefix_byte(node, depth)) = node;
+        *parent->add(key_byte(key, depth)) = chain(arena, key, value, depth + 1);
+        return parent;
+    }
+
+    // A regular node with the entries of a packed one, for writing to.
+    template<typename Key, typename Value>
+    Node *unpack(Arena &arena, const PackedLeaf<Key, Value> *packed, const Key &key) {
+        Node *node = make_node<Value>(arena, packed->depth, packed->count);
+        memcpy(node->prefix, packed->prefix, max_prefix);
+        dispatch<Value>(node, [&](auto *n) {
+            for (int byte = packed->next(0); byte >= 0; byte = byte < 255 ? packed->next(byte + 1) : -1)
+                *n->add(byte) = packed->value(KeyTraits<Key>::withByte(key, leaf_depth<Key>, byte));
+        });
+        return node;
+    }
+
+    // Swaps the packed node in *ref, if it is one, for a regular copy. key is any key below it.
+    template<typename Key, typename Value>
+    void unpack_in_place(Arena &arena, Node **ref, const Key &key) {
+        if ((*ref)->type != NodeType::Packed)
+            return;
+        Node *regular = unpack(arena, static_cast<PackedLeaf<Key, Value> *>(*ref), key);
+        free_node<Key, Value>(arena, *ref);
+        *ref = regular;
+    }
+
+    // An unpublished copy of node with byte added, in the next bigger layout if node is full.
+    template<typename Slot>
+    Node *copy_with(Arena &arena, Node *node, const uint8_t byte, const Slot value) {
+        return dispatch<Slot>(node, [&](auto *n) -> Node * {
+            if constexpr (requires { n->grow(arena); }) {
+                if (n->full()) {
+                    auto bigger = n->grow(arena);
+                    *bigger->add(byte) = value;
+                    return bigger;
+                }
+            }
+            if constexpr (requires { n->clone(arena); }) {
+                auto copy = n->clone(arena);
+                *copy->add(byte) = value;
+                return copy;
+            }
+            return nullptr; // Node48 with room and Node256 are always extended in place
+        });
+    }
+
+    template<typename Key, typename Value>
+    void retire(Trie<Key, Value> *trie, Node *node) {
+        trie->epochs->retire(node, [](void *retired, void *arena) {
+            free_node<Key, Value>(*static_cast<Arena *>(arena), static_cast<Node *>(retired));
+        }, trie->arena.get());
+    }
+
+    // The slot of parent (or the root pointer) that leads towards key.
+    template<typename Key, typename Value>
+    Node **child_ref(Trie<Key, Value> *trie, Node *parent, const Key &key) {
+        return parent ? find<Node *>(parent, key_byte(key, parent->depth)) : &trie->root;
+    }
+
+    // Adds the missing key byte at node's depth to node, whose parent is parent (nullptr for the root). False if
+    // another writer changed either node first and the insert has to start over.
+    template<typename Slot, typename Key, typename Value>
+    bool add_concurrent(Trie<Key, Value> *trie, Node *parent, Node *node, const Key &key, const Value value) {
+        const uint8_t byte = key_byte(key, node->depth);
+        const auto item = [&]() -> Slot {
+            if constexpr (std::is_same_v<Slot, Value>)
+                return value;
+            else
+                return chain(*trie->arena, key, value, node->depth + 1);
+        };
+
+        if (node->type == NodeType::N256 || (node->type == NodeType::N48 && node->count < 48)) {
+            if (!node->lock.writeLock())
+                return false;
+            const bool added = !find<Slot>(node, byte) && (node->type == NodeType::N256 || node->count < 48);
+            if (added)
+                dispatch<Slot>(node, [&](auto *n) {
+                    if constexpr (requires { n->add_concurrent(byte, item()); })
+                        n->add_concurrent(byte, item());
+                });
+            node->lock.writeUnlock();
+            return added;
+        }
+
+        OptimisticLock &parent_lock = parent ? parent->lock : trie->root_lock;
+        if (!parent_lock.writeLock())
+            return false;
+        if (!node->lock.writeLock()) {
+            parent_lock.writeUnlock();
+            return false;
+        }
+
+        // A packed node is replaced even if it has the key already, as its values cannot be written in place
+        Node **ref = child_ref(trie, parent, key);
+        const bool replaced =
+                ref && load(*ref) == node && (node->type == NodeType::Packed || !find<Slot>(node, byte));
+        if (replaced) {
+            Node *copy;
+            if constexpr (std::is_same_v<Slot, Value>) {
+                if (node->type == NodeType::Packed) {
+                    copy = unpack(*trie->arena, static_cast<PackedLeaf<Key, Value> *>(node), key);
+                    *find_or_add<Value>(*trie->arena, &copy, byte) = value;
+                } else {
+                    copy = copy_with<Slot>(*trie->arena, node, byte, item());
+                }
+            } else {
+                copy = copy_with<Slot>(*trie->arena, node, byte, item());
+            }
+            store(*ref, copy);
+            node->lock.writeUnlockObsolete();
+        } else {
+            node->lock.writeUnlock();
+        }
+        parent_lock.writeUnlock();
+
+        if (replaced)
+            retire(trie, node);
+        return replaced;
+    }
+
+    // Puts a new Node4 for key above node, whose prefix key leaves at depth. node itself is not touched, so only its
+    // parent is locked. False if another writer got there first.
+    template<typename Key, typename Value>
+    bool split_concurrent(Trie<Key, Value> *trie, Node *parent, Node *node, const Key &key, const Value value,
+                          const int depth) {
+        OptimisticLock &parent_lock = parent ? parent->lock : trie->root_lock;
+        if (!parent_lock.writeLock())
+            return false;
+        Node **ref = child_ref(trie, parent, key);
+        const bool linked = ref && load(*ref) == node;
+        if (linked)
+            store(*ref, split(*trie->arena, node, key, value, depth));
+        parent_lock.writeUnlock();
+        return linked;
     }
-    return nullptr;
+
+    template<typename Key, typename Value>
+    bool try_insert_concurrent(Trie<Key, Value> *trie, const Key &key, const Value value) {
+        Node *node = load(trie->root);
+        if (!node) {
+            Node *fresh = chain(*trie->arena, key, value, 0);
+            if (std::atomic_ref(trie->root).compare_exchange_strong(node, fresh))
+                return true;
+            free_subtree<Key, Value>(*trie->arena, fresh);
+            return false;
+        }
+
+        Node *parent = nullptr;
+        int from = 0;
+        while (true) {
+            const int diff = mismatch(node, key, from);
+            if (diff < node->depth)
+                return split_concurrent(trie, parent, node, key, value, diff);
+            if (node->depth == leaf_depth<Key>)
+                break;
+            Node **child = find<Node *>(node, key_byte(key, node->depth));
+            if (!child)
+                return add_concurrent<Node *>(trie, parent, node, key, value);
+            parent = node;
+            from = node->depth + 1;
+            node = load(*child);
+        }
+
+        Value *slot = node->type == NodeType::Packed ? nullptr : find<Value>(node, key_byte(key, leaf_depth<Key>));
+        if (!slot)
+            return add_concurrent<Value>(trie, parent, node, key, value);
+
+        // Existing slots stay where they are until their node is replaced, which the lock rules out
+        if (!node->lock.writeLock())
+            return false;
+        store(*slot, value);
+        node->lock.writeUnlock();
+        return true;
+    }
+
+    // insert and query without the cache
+    template<typename Key, typename Value>
+    void insert_entry(Trie<Key, Value> *trie, const Key &key, const Value &value) {
+        Arena &arena = *trie->arena;
+        if (!trie->root) {
+            trie->root = chain(arena, key, value, 0);
+            return;
+        }
+
+        Node **ref = &trie->root;
+        int from = 0;
+        while (true) {
+            Node *node = *ref;
+            const int diff = mismatch(node, key, from);
+            if (diff < node->depth) {
+                *ref = split(arena, node, key, value, diff);
+                return;
+            }
+            if (node->depth == leaf_depth<Key>)
+                break;
+            Node **child = find<Node *>(node, key_byte(key, node->depth));
+            if (!child) {
+                Node *fresh = chain(arena, key, value, node->depth + 1);
+                *find_or_add<Node *>(arena, ref, key_byte(key, node->depth)) = fresh;
+                return;
+            }
+            from = node->depth + 1;
+            ref = child;
+        }
+        unpack_in_place<Key, Value>(arena, ref, key);
+        *find_or_add<Value>(arena, ref, key_byte(key, leaf_depth<Key>)) = value;
+    }
+
+    template<typename Key, typename Value>
+    Value lookup(Trie<Key, Value> *trie, const Key &key) {
+        Node *node = load(trie->root);
+        int from = 0;
+        while (node && mismatch(node, key, from) == node->depth) {
+            if (node->depth == leaf_depth<Key>) {
+                Value value;
+                return find_value(node, key, value) ? value : Value{};
+            }
+            Node **child = find<Node *>(node, key_byte(key, node->depth));
+            if (child == nullptr) {
+                return Value{};
+            }
+            from = node->depth + 1;
+            node = load(*child);
+        }
+        return Value{};
+    }
+} // namespace
+
+template<typename Key, typename Value>
+Trie<Key, Value>::Trie(Trie &&other) noexcept :
+    root(std::exchange(other.root, nullptr)), compress_leaves(other.compress_leaves), cache(std::move(other.cache)),
+    arena(std::move(other.arena)), epochs(std::move(other.epochs)) {}
+
+template<typename Key, typename Value>
+Trie<Key, Value> &Trie<Key, Value>::operator=(Trie &&other) noexcept {
+    if (this != &other) {
+        // Hand the current nodes to a temporary, whose members are torn down epochs first, then the arena
+        Trie old(std::move(*this));
+        root = std::exchange(other.root, nullptr);
+        compress_leaves = other.compress_leaves;
+        cache = std::move(other.cache);
+        arena = std::move(other.arena);
+        epochs = std::move(other.epochs);
+    }
+    return *this;
 }
 
-void insert(Trie *trie, const uint32_t key, const uint32_t value) {
-    Node *node = &trie->node;
-    for (int shift = 24; shift >= 0; shift -= 8) {
-        constexpr uint32_t mask = 0xff;
-        const auto masked_key = static_cast<uint8_t>((key >> shift) & mask);
+template<typename Key, typename Value>
+void insert(Trie<Key, Value> *trie, const std::type_identity_t<Key> key, const std::type_identity_t<Value> value) {
+    insert_entry(trie, key, value);
+    if (trie->cache)
+        trie->cache->invalidate(key);
+}
 
-        auto [it, inserted] = node->nodes.emplace(masked_key, Node{masked_key, 0, {}});
-        node = &(it->second);
+template<typename Key, typename Value>
+Value query(Trie<Key, Value> *trie, const std::type_identity_t<Key> key) {
+    if (!trie->cache)
+        return lookup(trie, key);
+    Value value;
+    uint32_t ticket = 1; // odd, so fill would ignore it had lookup not set it
+    if (!trie->cache->lookup(key, value, ticket)) {
+        value = lookup(trie, key);
+        trie->cache->fill(key, value, ticket);
     }
-    node->value = value;
+    return value;
 }
 
-uint32_t query(Trie *trie, const uint32_t key) {
-    Node *node = &trie->node;
-    for (int shift = 24; shift >= 0; shift -= 8) {
-        constexpr uint32_t mask = 0xff;
-        const auto masked_key = static_cast<uint8_t>((key >> shift) & mask);
-        Node *res = find(node, masked_key);
+template<typename Key, typename Value>
+bool erase(Trie<Key, Value> *trie, const std::type_identity_t<Key> key) {
+    if (!trie->root)
+        return false;
+
+    // refs[level] is the slot (or the root pointer) holding the level-th node on the way to key
+    Node **refs[KeyTraits<Key>::bytes];
+    int level = 0;
+    refs[0] = &trie->root;
+    for (int from = 0;; level++) {
+        Node *node = *refs[level];
+        if (mismatch(node, key, from) < node->depth)
+            return false;
+        if (node->depth == leaf_depth<Key>)
+            break;
+        Node **child = find<Node *>(node, key_byte(key, node->depth));
+        if (!child)
+            return false;
+        refs[level + 1] = child;
+        from = node->depth + 1;
+    }
+
+    const uint8_t byte = key_byte(key, leaf_depth<Key>);
+    if ((*refs[level])->type == NodeType::Packed) {
+        if (!static_cast<PackedLeaf<Key, Value> *>(*refs[level])->has(byte))
+            return false;
+        unpack_in_place<Key, Value>(*trie->arena, refs[level], key);
+    }
+    const bool found = dispatch<Value>(*refs[level], [&](auto *n) {
+        if (!n->find(byte))
+            return false;
+        n->remove(byte);
+        return true;
+    });
+    if (!found)
+        return false;
 
-        if (res == nullptr) {
-            return 0;
+    // Prune the nodes the removal left empty, bottom-up
+    for (; level >= 0 && (*refs[level])->count == 0; level--) {
+        free_node<Key, Value>(*trie->arena, *refs[level]);
+        if (level == 0) {
+            trie->root = nullptr;
+        } else {
+            Node *parent = *refs[level - 1];
+            dispatch<Node *>(parent, [&](auto *n) { n->remove(key_byte(key, parent->depth)); });
         }
-        node = res;
     }
-    return node->value;
+
+    // An inner node left with a single child makes way for it, if the child's prefix covers the bytes it then skips
+    if (level >= 0 && (*refs[level])->depth != leaf_depth<Key> && (*refs[level])->count == 1) {
+        Node *node = *refs[level];
+        Node *child = nullptr;
+        dispatch<Node *>(node, [&](auto *n) { n->for_each([&](uint8_t, Node *only) { child = only; }); });
+        const int from = level > 0 ? (*refs[level - 1])->depth + 1 : 0;
+        if (child->depth - from <= max_prefix) {
+            *refs[level] = child;
+            free_node<Key, Value>(*trie->arena, node);
+        }
+    }
+    if (trie->cache)
+        trie->cache->invalidate(key);
+    return true;
 }
 
-static void rangeHelper(Node *node, const int depth, uint32_t key, const uint32_t low, const uint32_t high,
-                        std::vector<std::pair<uint32_t, uint32_t>> &result) {
-    if (depth == 4) {
-        if (key >= low && key <= high && node->value != 0) {
-            result.emplace_back(key, node->value);
+template<typename Key, typename Value>
+void query_batch(Trie<Key, Value> *trie, const std::span<const std::type_identity_t<Key>> keys,
+                 const std::span<std::type_identity_t<Value>> out) {
+    for (size_t first = 0; first < keys.size(); first += batch_group) {
+        const size_t size = std::min(batch_group, keys.size() - first);
+        const Key *group_keys = keys.data() + first;
+        Value *group_out = out.data() + first;
+
+        // nodes[i] becomes nullptr once key i is found or turns out to be missing, from[i] is the first byte its
+        // node may skip
+        Node *nodes[batch_group];
+        int from[batch_group];
+        std::fill_n(nodes, size, load(trie->root));
+        std::fill_n(from, size, 0);
+        std::fill_n(group_out, size, Value{});
+
+        // Every round takes two passes over the group: the first prefetches the line of each node that holds the
+        // key's slot (the header line is already on its way), the second follows the slots and prefetches the
+        // children's headers. Keys go down one node per round, which with skipped bytes need not be the same level.
+        for (bool active = true; active;) {
+            active = false;
+            for (size_t i = 0; i < size; i++) {
+                if (nodes[i]) {
+                    const uint8_t byte = key_byte(group_keys[i], nodes[i]->depth);
+                    if (nodes[i]->type == NodeType::Packed)
+                        static_cast<const PackedLeaf<Key, Value> *>(nodes[i])->prefetch(byte);
+                    else if (nodes[i]->depth == leaf_depth<Key>)
+                        dispatch<Value>(nodes[i], [&](auto *n) { n->prefetch(byte); });
+                    else
+                        dispatch<Node *>(nodes[i], [&](auto *n) { n->prefetch(byte); });
+                }
+            }
+            for (size_t i = 0; i < size; i++) {
+                Node *node = nodes[i];
+                if (!node)
+                    continue;
+                nodes[i] = nullptr;
+                if (mismatch(node, group_keys[i], from[i]) < node->depth)
+                    continue;
+                if (node->depth == leaf_depth<Key>) {
+                    Value value;
+                    if (find_value(node, group_keys[i], value))
+                        group_out[i] = value;
+                    continue;
+                }
+                Node **child = find<Node *>(node, key_byte(group_keys[i], node->depth));
+                if (child) {
+                    nodes[i] = load(*child);
+                    from[i] = node->depth + 1;
+                    __builtin_prefetch(nodes[i]);
+                    active = true;
+                }
+            }
         }
+    }
+}
+
+template<typename Key, typename Value>
+void insert_concurrent(Trie<Key, Value> *trie, const std::type_identity_t<Key> key,
+                       const std::type_identity_t<Value> value) {
+    EpochManager::Guard guard(*trie->epochs);
+    while (!try_insert_concurrent(trie, key, value)) {
+    }
+    if (trie->cache)
+        trie->cache->invalidate(key);
+}
+
+template<typename Key, typename Value>
+Value query_concurrent(Trie<Key, Value> *trie, const std::type_identity_t<Key> key) {
+    EpochManager::Guard guard(*trie->epochs);
+    return query(trie, key);
+}
+
+template<typename Key, typename Value>
+void bulk_load(Trie<Key, Value> *trie,
+               const std::span<const std::pair<std::type_identity_t<Key>, std::type_identity_t<Value>>> sorted,
+               const unsigned threads) {
+    if (trie->root) {
+        for (const auto &[key, value]: sorted)
+            insert(trie, key, value);
         return;
     }
+    if (!sorted.empty())
+        trie->root = build(*trie->arena, sorted, 0, trie->compress_leaves, threads);
+    // Misses cached while the trie was empty
+    if (trie->cache)
+        trie->cache->clear();
+}
+
+template<typename Key, typename Value>
+std::vector<std::pair<Key, Value>> range(Trie<Key, Value> *trie, const std::type_identity_t<Key> low,
+                                         const std::type_identity_t<Key> high) {
+    std::vector<std::pair<Key, Value>> result;
+    for (const auto &entry: scan(trie, low, high))
+        result.push_back(entry);
+    return result;
+}
+
+template<typename Key, typename Value>
+TrieCursor<Key, Value>::TrieCursor(Trie<Key, Value> *trie, const Key &low, const Key &high) : level(0), high(high) {
+    path[0] = load(trie->root);
+    finished = !path[0] || high < low || !seek(low);
+}
 
-    for (auto &kv: node->nodes) {
-        const auto &child = kv.second;
-        const uint32_t shift = 24 - depth * 8;
-        const uint32_t new_key = key | (static_cast<uint32_t>(child.key) << shift);
+template<typename Key, typename Value>
+bool TrieCursor<Key, Value>::seek(Key target) {
+    while (!(high < target)) {
+        Node *node = path[level];
+        const int depth = node->depth;
 
-        if (new_key <= high && (new_key | ((1u << (24 - depth * 8)) - 1)) >= low) {
-            rangeHelper(const_cast<Node*>(&child), depth + 1, new_key, low, high, result);
+        // Compare target with the bytes node skips: below them, it moves up to node's smallest key, above them, past
+        // node altogether
+        const int diff = mismatch(node, target, level > 0 ? path[level - 1]->depth + 1 : 0);
+        if (diff < depth) {
+            if (key_byte(target, diff) > prefix_byte(node, diff)) {
+                if (!step_right(target))
+                    return false;
+                continue;
+            }
+            for (int skipped = diff; skipped < depth; skipped++)
+                target = KeyTraits<Key>::withByte(target, skipped, prefix_byte(node, skipped));
         }
+        const int want = key_byte(target, depth);
+
+        if (depth == leaf_depth<Key>) {
+            int byte;
+            Value value{};
+            if (node->type == NodeType::Packed) {
+                const auto packed = static_cast<const PackedLeaf<Key, Value> *>(node);
+                byte = packed->next(want);
+                if (byte >= 0)
+                    value = packed->value(KeyTraits<Key>::withByte(target, depth, byte));
+            } else {
+                byte = dispatch<Value>(node, [&](auto *n) {
+                    const int next = n->next(want);
+                    if (next >= 0)
+                        value = load(*n->find(next));
+                    return next;
+                });
+            }
+            if (byte >= 0) {
+                target = KeyTraits<Key>::withByte(target, depth, byte);
+                entry = {target, value};
+                return !(high < target);
+            }
+        } else {
+            Node *child = nullptr;
+            const int byte = dispatch<Node *>(node, [&](auto *n) {
+                const int next = n->next(want);
+                if (next >= 0)
+                    child = load(*n->find(next));
+                return next;
+            });
+            if (byte >= 0) {
+                // Skipping ahead to a larger byte starts at the smallest key below it
+                if (byte != want)
+                    target = KeyTraits<Key>::withByte(target, depth, byte);
+                path[++level] = child;
+                continue;
+            }
+        }
+
+        // Nothing left at or after target in this node
+        if (!step_right(target))
+            return false;
     }
+    return false;
 }
 
-std::vector<std::pair<uint32_t, uint32_t>> range(Trie *trie, const uint32_t low, const uint32_t high) {
-    std::vector<std::pair<uint32_t, uint32_t>> result;
-    rangeHelper(&trie->node, 0, 0, low, high, result);
-    return result;
+template<typename Key, typename Value>
+bool TrieCursor<Key, Value>::step_right(Key &target) {
+    do {
+        if (level == 0)
+            return false;
+        level--;
+    } while (key_byte(target, path[level]->depth) == 0xff);
+    const int depth = path[level]->depth;
+    target = KeyTraits<Key>::withByte(target, depth, key_byte(target, depth) + 1);
+    return true;
 }
 
-void print(Node *node, int level) {
-    printf("%*sk:%u, v:%u, n:%zu\n", level * 2, "", node->key, node->value, node->nodes.size());
-    for (auto &kv: node->nodes) {
-        print(&kv.second, level + 1);
+template<typename Key, typename Value>
+void TrieCursor<Key, Value>::advance() {
+    const Key key = entry.first;
+    if (!(key < high)) {
+        finished = true;
+        return;
+    }
+    // The next byte in the current leaf, or right of it further up
+    Key target = key;
+    const uint8_t last = key_byte(key, leaf_depth<Key>);
+    if (last < 0xff)
+        target = KeyTraits<Key>::withByte(key, leaf_depth<Key>, last + 1);
+    else if (!step_right(target)) {
+        finished = true;
+        return;
     }
+    finished = !seek(target);
 }
+
+template<typename Key, typename Value>
+TrieCursor<Key, Value> scan(Trie<Key, Value> *trie, const std::type_identity_t<Key> low,
+                            const std::type_identity_t<Key> high) {
+    return {trie, low, high};
+}
+
+template<typename Key, typename Value>
+size_t range_count(Trie<Key, Value> *trie, const std::type_identity_t<Key> low, const std::type_identity_t<Key> high) {
+    size_t total = 0;
+    for (TrieCursor<Key, Value> cursor(trie, low, high); !cursor.done(); cursor.advance())
+        total++;
+    return total;
+}
+
+namespace {
+    // key holds the key bytes above node, which packed nodes need to turn their stored differences back into values.
+    template<typename Key, typename Value>
+    void print_node(Node *node, const int level, Key key) {
+        static const char *names[] = {"N4", "N16", "N48", "N256", "Packed"};
+        printf("%*s%s d:%u, n:%u\n", level * 2, "", names[static_cast<int>(node->type)], node->depth, node->count);
+        for (int depth = std::max(node->depth - max_prefix, 0); depth < node->depth; depth++)
+            key = KeyTraits<Key>::withByte(key, depth, prefix_byte(node, depth));
+
+        if (node->type == NodeType::Packed) {
+            const auto packed = static_cast<const PackedLeaf<Key, Value> *>(node);
+            for (int byte = packed->next(0); byte >= 0; byte = byte < 255 ? packed->next(byte + 1) : -1) {
+                const Value value = packed->value(KeyTraits<Key>::withByte(key, node->depth, byte));
+                printf("%*sk:%u, v:%llu\n", (level + 1) * 2, "", byte, static_cast<unsigned long long>(value));
+            }
+            return;
+        }
+
+        if (node->depth == leaf_depth<Key>) {
+            dispatch<Value>(node, [&](auto *n) {
+                n->for_each([&](const uint8_t byte, const Value value) {
+                    printf("%*sk:%u, v:%llu\n", (level + 1) * 2, "", byte, static_cast<unsigned long long>(value));
+                });
+            });
+            return;
+        }
+        dispatch<Node *>(node, [&](auto *n) {
+            n->for_each([&](const uint8_t byte, Node *child) {
+                printf("%*sk:%u\n", (level + 1) * 2, "", byte);
+                print_node<Key, Value>(child, level + 2, KeyTraits<Key>::withByte(key, node->depth, byte));
+            });
+        });
+    }
+
+    // Fan-out is the number of children, or of values on the last level; capacity that of the node's layout.
+    template<typename Key, typename Value>
+    void add_stats(IndexStats &stats, Node *node, const size_t level) {
+        static constexpr int capacities[] = {4, 16, 48, 256, 256};
+        const int capacity = capacities[static_cast<int>(node->type)];
+        if (node->type == NodeType::Packed) {
+            stats.keys += node->count;
+            stats.addNode(level, static_cast<const PackedLeaf<Key, Value> *>(node)->bytes(), node->count, capacity,
+                          node->count);
+        } else if (node->depth == leaf_depth<Key>) {
+            stats.keys += node->count;
+            dispatch<Value>(node, [&](auto *n) { stats.addNode(level, sizeof(*n), n->count, capacity, n->count); });
+        } else {
+            dispatch<Node *>(node, [&](auto *n) {
+                stats.addNode(level, sizeof(*n), n->count, capacity, n->count);
+                n->for_each([&](uint8_t, Node *child) { add_stats<Key, Value>(stats, child, level + 1); });
+            });
+        }
+    }
+} // namespace
+
+template<typename Key, typename Value>
+void print(Trie<Key, Value> *trie) {
+    if (trie->root)
+        print_node<Key, Value>(trie->root, 0, Key{});
+}
+
+template<typename Key, typename Value>
+IndexStats stats(Trie<Key, Value> *trie) {
+    IndexStats stats;
+    if (trie->root)
+        add_stats<Key, Value>(stats, trie->root, 0);
+    if (trie->arena) {
+        stats.allocatedBytes = trie->arena->mappedBytes();
+        stats.freeBytes = trie->arena->freeBytes();
+    }
+    if (trie->cache)
+        stats.allocatedBytes += trie->cache->bytes();
+    return stats;
+}
+
+#define INSTANTIATE_TRIE(Key, Value)                                                                                   \
+    template struct Trie<Key, Value>;                                                                                  \
+    template class TrieCursor<Key, Value>;                                                                             \
+    template void insert<Key, Value>(Trie<Key, Value> *, Key, Value);                                                  \
+    template Value query<Key, Value>(Trie<Key, Value> *, Key);                                                         \
+    template bool erase<Key, Value>(Trie<Key, Value> *, Key);                                                          \
+    template void query_batch<Key, Value>(Trie<Key, Value> *, std::span<const Key>, std::span<Value>);                 \
+    template std::vector<std::pair<Key, Value>> range<Key, Value>(Trie<Key, Value> *, Key, Key);                       \
+    template TrieCursor<Key, Value> scan<Key, Value>(Trie<Key, Value> *, Key, Key);                                    \
+    template size_t range_count<Key, Value>(Trie<Key, Value> *, Key, Key);                                             \
+    template void bulk_load<Key, Value>(Trie<Key, Value> *, std::span<const std::pair<Key, Value>>, unsigned);         \
+    template void insert_concurrent<Key, Value>(Trie<Key, Value> *, Key, Value);                                       \
+    template Value query_concurrent<Key, Value>(Trie<Key, Value> *, Key);                                              \
+    template void print<Key, Value>(Trie<Key, Value> *);                                                               \
+    template IndexStats stats<Key, Value>(Trie<Key, Value> *);
+
+INSTANTIATE_TRIE(uint32_t, uint32_t)
+INSTANTIATE_TRIE(uint64_t, uint64_t)
+INSTANTIATE_TRIE(ByteKey<16>, uint64_t)
@@ -2,24 +2,155 @@
 #define TRIE_H
 
 #include <cstdint>
+#include <memory>
+#include <span>
+#include <type_traits>
 #include <utility>
 #include <vector>
-#include <unordered_map>
+
+#include "arena.h"
+#include "epoch.h"
+#include "hot_key_cache.h"
+#include "index_stats.h"
+#include "key_traits.h"
+#include "optimistic_lock.h"
+#include "scan_iterator.h"
+
+// Adaptive radix tree over the bytes of a key, most significant byte first. Each node picks one of four layouts
+// (4, 16, 48 or 256 children) by fan-out and grows into the next one when it fills up. Nodes on the last level
+// store values in their slots instead of child pointers, or, in a trie bulk-loaded with compress_leaves, are packed:
+// a bitmap of the present bytes plus their values in as few bytes as they fit.
+//
+// Paths are compressed: a node branches on the key byte at its depth, and the up to max_prefix bytes between its
+// parent's depth and its own, which every key below it shares, are skipped on the way down and only compared against
+// the node's prefix. Longer runs of shared bytes take a node per max_prefix bytes.
+enum class NodeType : uint8_t { N4, N16, N48, N256, Packed };
+
+inline constexpr int max_prefix = 8;
 
 struct Node {
-    uint8_t key;
-    uint32_t value;
-    std::unordered_map<uint8_t, Node> nodes;
+    NodeType type;
+    uint8_t depth; // index of the key byte the node branches on
+    uint16_t count;
+    // Key bytes depth - max_prefix to depth - 1, which all keys below the node share. Set when the node is created and
+    // never changed, so a node keeps its prefix when a new parent is put above it.
+    uint8_t prefix[max_prefix];
+    OptimisticLock lock; // only taken by insert_concurrent
 };
 
+// Keys are unsigned integers or ByteKey, values integers.
+template<typename Key = uint32_t, typename Value = uint32_t>
 struct Trie {
-    Node node;
+    static_assert(std::is_integral_v<Value>, "trie values are integers");
+
+    Node *root = nullptr;
+    OptimisticLock root_lock;
+    // Makes bulk_load pack the last level. Packed nodes are read-only: the writes reaching one turn it back into a
+    // regular node first.
+    bool compress_leaves = false;
+    // Optional HotKeyCache in front of query and query_concurrent, which every write keeps up to date.
+    std::unique_ptr<HotKeyCache<Key, Value>> cache;
+    // Owns every node; declared before epochs so nodes still waiting for reclamation outlive the epoch manager.
+    std::unique_ptr<Arena> arena = std::make_unique<Arena>();
+    std::unique_ptr<EpochManager> epochs = std::make_unique<EpochManager>();
+
+    Trie() = default;
+    Trie(const Trie &) = delete;
+    Trie &operator=(const Trie &) = delete;
+    Trie(Trie &&other) noexcept;
+    Trie &operator=(Trie &&other) noexcept;
 };
 
-void insert(Trie *trie, uint32_t key, uint32_t value);
-uint32_t query(Trie *trie, uint32_t key);
-std::vector<std::pair<uint32_t, uint32_t>> range(Trie *trie, uint32_t low, uint32_t high);
+// Forward cursor over the entries of one key range, returned by scan. It keeps the path from the root to the current
+// entry and moves on from the deepest node on that path with children left to the right, finding children in byte
+// order through each layout's next(), so it needs no allocation and never visits subtrees outside the range.
+template<typename Key = uint32_t, typename Value = uint32_t>
+class TrieCursor {
+public:
+    using Entry = std::pair<Key, Value>;
+
+    TrieCursor(Trie<Key, Value> *trie, const Key &low, const Key &high);
+
+    ScanIterator<TrieCursor, Entry> begin() { return ScanIterator<TrieCursor, Entry>(this); }
+    std::default_sentinel_t end() const { return {}; }
+
+    bool done() const { return finished; }
+    const Entry &current() const { return entry; }
+    void advance();
+
+private:
+    Node *path[KeyTraits<Key>::bytes]; // the nodes from the root down to path[level]
+    int level;
+    Entry entry;
+    Key high;
+    bool finished;
+
+    // Moves to the smallest key >= target, where path[level] is a node whose parent's byte target shares; false if
+    // there is none up to high. Only ever walks down towards target and back up past exhausted nodes, so the nodes it
+    // touches are those on the way to low, those holding the result and those on the way to high.
+    bool seek(Key target);
+    // Moves target to the smallest key right of path[level]'s subtree, climbing to the closest ancestor with a larger
+    // byte left; false if there is none.
+    bool step_right(Key &target);
+};
+
+// Keys and values are passed as the trie's own types, so other integers convert to them.
+template<typename Key, typename Value>
+void insert(Trie<Key, Value> *trie, std::type_identity_t<Key> key, std::type_identity_t<Value> value);
+// The value of key, or 0 if it is missing.
+template<typename Key, typename Value>
+Value query(Trie<Key, Value> *trie, std::type_identity_t<Key> key);
+// Removes key, returning false if it was not there. Nodes left without children are freed and unlinked on the way
+// back up, so a trie that lost all its keys is empty again, and a node left with one child makes way for it.
+template<typename Key, typename Value>
+bool erase(Trie<Key, Value> *trie, std::type_identity_t<Key> key);
+// Looks up every key at once, writing its value (0 if missing) to the same position of out, which must be at least
+// as long as keys. Keys are walked down the trie in small groups one level at a time, prefetching each key's next
+// node before any of them is read, so the cache misses of a group overlap instead of queueing up.
+template<typename Key, typename Value>
+void query_batch(Trie<Key, Value> *trie, std::span<const std::type_identity_t<Key>> keys,
+                 std::span<std::type_identity_t<Value>> out);
+// Entries with keys in [low, high] in key order. A stored 0 is returned like any other value.
+template<typename Key, typename Value>
+std::vector<std::pair<Key, Value>> range(Trie<Key, Value> *trie, std::type_identity_t<Key> low,
+                                         std::type_identity_t<Key> high);
+// Streams the entries with keys in [low, high] in key order: for (auto [key, value]: scan(trie, low, high)).
+template<typename Key, typename Value>
+TrieCursor<Key, Value> scan(Trie<Key, Value> *trie, std::type_identity_t<Key> low, std::type_identity_t<Key> high);
+// Calls fn(key, value) for the entries with keys in [low, high] in key order until fn returns false.
+template<typename Key, typename Value, typename Fn>
+void scan(Trie<Key, Value> *trie, const std::type_identity_t<Key> low, const std::type_identity_t<Key> high, Fn &&fn) {
+    for (const auto &[key, value]: scan(trie, low, high)) {
+        if (!fn(key, value))
+            return;
+    }
+}
+// Number of keys in [low, high].
+template<typename Key, typename Value>
+size_t range_count(Trie<Key, Value> *trie, std::type_identity_t<Key> low, std::type_identity_t<Key> high);
+// Builds the trie bottom-up from entries sorted by key, giving every node its final layout straight away. Equal keys
+// keep their last occurrence. A trie that already holds keys gets the entries inserted one by one instead. With
+// threads > 1 the entries are split by their first distinguishing byte and the subtrees built concurrently.
+template<typename Key, typename Value>
+void bulk_load(Trie<Key, Value> *trie,
+               std::span<const std::pair<std::type_identity_t<Key>, std::type_identity_t<Value>>> sorted,
+               unsigned threads = 1);
+
+// Concurrent mode: any number of threads may run these on the same trie at once, but not alongside the functions
+// above. Readers never block or retry. New children of Node48/Node256 are installed in place and become visible
+// with a single atomic store; Node4/Node16 (and full nodes) are copied with the new child and swapped into their
+// parent, and the replaced node is freed through the trie's epoch manager once no reader can still see it. A key that
+// leaves a node's prefix gets a new Node4 put above that node, which stays as it is.
+template<typename Key, typename Value>
+void insert_concurrent(Trie<Key, Value> *trie, std::type_identity_t<Key> key, std::type_identity_t<Value> value);
+template<typename Key, typename Value>
+Value query_concurrent(Trie<Key, Value> *trie, std::type_identity_t<Key> key);
 
-void print(Node *node, int level = 0);
+template<typename Key, typename Value>
+void print(Trie<Key, Value> *trie);
+// Node counts per level, fill and fan-out of the node layouts, bytes per key and allocator overhead, from a walk over
+// every node. Like print, it may not run alongside writes.
+template<typename Key, typename Value>
+IndexStats stats(Trie<Key, Value> *trie);
 
 #endif // TRIE_H
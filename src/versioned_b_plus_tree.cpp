@@ -0,0 +1,642 @@
+#include <algorithm>
+#include <cstring>
+
+#include "key_search.h"
+#include "node_layout.h"
+#include "versioned_b_plus_tree.h"
+
+using namespace std;
+
+// Nodes are laid out like those of a BPlusTree: a header line, then cache-line aligned key and payload arrays, the key
+// arrays padded to whole lines for the vector search kernels. Published nodes are never written again, so readers
+// need neither locks nor validation.
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+class VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Node {
+public:
+    uint64_t version; // the version the node was made for
+    bool isLeaf;
+    uint16_t count;
+
+    Node(const bool leaf, const uint64_t version) : version(version), isLeaf(leaf), count(0) {}
+};
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+class VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Leaf : public Node {
+public:
+    static constexpr int capacity = packedCapacity(NodeBytes, sizeof(Key), sizeof(Value));
+    static constexpr int minCount = capacity / 4;
+
+    alignas(cacheLine) Key keys[lines(capacity * sizeof(Key)) / sizeof(Key)];
+    alignas(cacheLine) Value values[capacity];
+
+    explicit Leaf(const uint64_t version) : Node(true, version) {}
+
+    // Number of keys < key.
+    int lowerBound(const Key &key) const {
+        return ::lowerBound(KeySearch::Vector, keys, this->count, key, Compare{});
+    }
+
+    // Number of keys <= key.
+    int upperBound(const Key &key) const {
+        return ::upperBound(KeySearch::Vector, keys, this->count, key, Compare{});
+    }
+
+    void insertAt(const int idx, const Key &key, const Value &value) {
+        memmove(keys + idx + 1, keys + idx, (this->count - idx) * sizeof(Key));
+        memmove(values + idx + 1, values + idx, (this->count - idx) * sizeof(Value));
+        keys[idx] = key;
+        values[idx] = value;
+        this->count++;
+    }
+
+    void removeAt(const int idx) {
+        memmove(keys + idx, keys + idx + 1, (this->count - idx - 1) * sizeof(Key));
+        memmove(values + idx, values + idx + 1, (this->count - idx - 1) * sizeof(Value));
+        this->count--;
+    }
+
+    // Moves the entries of other behind these.
+    void append(const Leaf *other) {
+        memcpy(keys + this->count, other->keys, other->count * sizeof(Key));
+        memcpy(values + this->count, other->values, other->count * sizeof(Value));
+        this->count += other->count;
+    }
+};
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+class VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Inner : public Node {
+public:
+    static constexpr int capacity = fitCapacity(NodeBytes, sizeof(Key), sizeof(Node *), 1);
+    static constexpr int minCount = capacity / 4;
+
+    alignas(cacheLine) Key keys[lines(capacity * sizeof(Key)) / sizeof(Key)];
+    alignas(cacheLine) Node *children[capacity + 1];
+
+    explicit Inner(const uint64_t version) : Node(false, version) {}
+
+    // Index of the child whose keys cover key.
+    int childFor(const Key &key) const {
+        return ::upperBound(KeySearch::Vector, keys, this->count, key, Compare{});
+    }
+
+    // Adds child to the right of separator key at idx; the node must not be full.
+    void insertAt(const int idx, const Key &key, Node *child) {
+        memmove(keys + idx + 1, keys + idx, (this->count - idx) * sizeof(Key));
+        memmove(children + idx + 2, children + idx + 1, (this->count - idx) * sizeof(Node *));
+        keys[idx] = key;
+        children[idx + 1] = child;
+        this->count++;
+    }
+
+    // Drops the separator at idx together with the child to its right.
+    void removeAt(const int idx) {
+        memmove(keys + idx, keys + idx + 1, (this->count - idx - 1) * sizeof(Key));
+        memmove(children + idx + 1, children + idx + 2, (this->count - idx - 1) * sizeof(Node *));
+        this->count--;
+    }
+
+    // Moves separator and the children of other behind these.
+    void append(const Key &separator, const Inner *other) {
+        keys[this->count] = separator;
+        memcpy(keys + this->count + 1, other->keys, other->count * sizeof(Key));
+        memcpy(children + this->count + 1, other->children, (other->count + 1) * sizeof(Node *));
+        this->count += other->count + 1;
+    }
+};
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Cursor::Cursor(const Node *root, const Key &low, const Key &high) :
+    high(high) {
+    if (!root || less(high, low)) {
+        finished = true;
+        return;
+    }
+    while (!root->isLeaf) {
+        const auto inner = static_cast<const Inner *>(root);
+        path[depth] = inner;
+        slots[depth] = inner->childFor(low);
+        root = inner->children[slots[depth]];
+        depth++;
+    }
+    leaf = static_cast<const Leaf *>(root);
+    index = leaf->lowerBound(low);
+    settle();
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Cursor::advance() {
+    index++;
+    settle();
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Cursor::settle() {
+    while (index == leaf->count) {
+        if (!nextLeaf()) {
+            finished = true;
+            return;
+        }
+    }
+    if (less(high, leaf->keys[index])) {
+        finished = true;
+        return;
+    }
+    entry = {leaf->keys[index], leaf->values[index]};
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+bool VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Cursor::nextLeaf() {
+    // Up to the closest inner node with a child to the right, then down its leftmost path
+    while (depth > 0 && slots[depth - 1] == path[depth - 1]->count)
+        depth--;
+    if (depth == 0)
+        return false;
+    const Node *node = path[depth - 1]->children[++slots[depth - 1]];
+    while (!node->isLeaf) {
+        path[depth] = static_cast<const Inner *>(node);
+        slots[depth] = 0;
+        node = path[depth]->children[0];
+        depth++;
+    }
+    leaf = static_cast<const Leaf *>(node);
+    index = 0;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+size_t VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Cursor::remaining() {
+    size_t total = 0;
+    while (!finished) {
+        const int end = leaf->upperBound(high);
+        total += end - index;
+        if (end < leaf->count || !nextLeaf())
+            break;
+    }
+    finished = true;
+    return total;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Snapshot::Snapshot(VersionedBPlusTree *tree, const Node *root,
+                                                                       const uint64_t version, const size_t count) :
+    tree(tree), root(root), at(version), count(count) {}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Snapshot::Snapshot(Snapshot &&other) noexcept :
+    tree(other.tree), root(other.root), at(other.at), count(other.count) {
+    other.tree = nullptr;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+typename VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Snapshot &
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Snapshot::operator=(Snapshot &&other) noexcept {
+    swap(tree, other.tree);
+    swap(root, other.root);
+    swap(at, other.at);
+    swap(count, other.count);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Snapshot::~Snapshot() {
+    if (tree)
+        tree->unpin(at);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+Value VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Snapshot::query(const Key &key) const {
+    return find(root, key);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+vector<typename VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Entry>
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Snapshot::range(const Key &low, const Key &high) const {
+    return collect(root, low, high);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+size_t VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Snapshot::rangeCount(const Key &low, const Key &high) const {
+    return countRange(root, low, high);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::VersionedBPlusTree() :
+    arena(make_unique<Arena>()), epochs(make_unique<EpochManager>()) {
+    static_assert(sizeof(Leaf) <= NodeBytes && sizeof(Inner) <= NodeBytes);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+Value VersionedBPlusTree<Key, Value, Compare, NodeBytes>::find(const Node *node, const Key &key) {
+    if (!node)
+        return Value{};
+    while (!node->isLeaf) {
+        const auto inner = static_cast<const Inner *>(node);
+        node = inner->children[inner->childFor(key)];
+    }
+    const auto leaf = static_cast<const Leaf *>(node);
+    const int idx = leaf->lowerBound(key);
+    return idx < leaf->count && !less(key, leaf->keys[idx]) ? leaf->values[idx] : Value{};
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+vector<typename VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Entry>
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::collect(const Node *root, const Key &low, const Key &high) {
+    vector<Entry> result;
+    for (const auto &entry: Cursor(root, low, high))
+        result.push_back(entry);
+    return result;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+size_t VersionedBPlusTree<Key, Value, Compare, NodeBytes>::countRange(const Node *root, const Key &low,
+                                                                      const Key &high) {
+    return Cursor(root, low, high).remaining();
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+Value VersionedBPlusTree<Key, Value, Compare, NodeBytes>::query(const Key &key) const {
+    EpochManager::Guard guard(*epochs);
+    return find(root.load(memory_order_acquire), key);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+vector<typename VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Entry>
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::range(const Key &low, const Key &high) const {
+    EpochManager::Guard guard(*epochs);
+    return collect(root.load(memory_order_acquire), low, high);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+size_t VersionedBPlusTree<Key, Value, Compare, NodeBytes>::rangeCount(const Key &low, const Key &high) const {
+    EpochManager::Guard guard(*epochs);
+    return countRange(root.load(memory_order_acquire), low, high);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+typename VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Snapshot
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::snapshot() {
+    lock_guard lock(pins);
+    const uint64_t version = current.load(memory_order_relaxed);
+    pinned[version]++;
+    return Snapshot(this, root.load(memory_order_relaxed), version, count.load(memory_order_relaxed));
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void VersionedBPlusTree<Key, Value, Compare, NodeBytes>::unpin(const uint64_t version) {
+    lock_guard lock(pins);
+    const auto it = pinned.find(version);
+    if (--it->second == 0)
+        pinned.erase(it);
+    release();
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void VersionedBPlusTree<Key, Value, Compare, NodeBytes>::release() {
+    // A node replaced by version w is only reachable from versions before w
+    const uint64_t oldest = pinned.empty() ? current.load(memory_order_relaxed) : pinned.begin()->first;
+    if (retired.empty() || retired.front().first > oldest)
+        return;
+    EpochManager::Guard guard(*epochs);
+    while (!retired.empty() && retired.front().first <= oldest) {
+        epochs->retire(retired.front().second, reclaim, arena.get());
+        retired.pop_front();
+    }
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void VersionedBPlusTree<Key, Value, Compare, NodeBytes>::reclaim(void *node, void *arena) {
+    const auto retired = static_cast<Node *>(node);
+    if (retired->isLeaf)
+        static_cast<Arena *>(arena)->destroy(static_cast<Leaf *>(retired));
+    else
+        static_cast<Arena *>(arena)->destroy(static_cast<Inner *>(retired));
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+template<typename T>
+T *VersionedBPlusTree<Key, Value, Compare, NodeBytes>::writable(T *node) {
+    if (node->version == pending)
+        return node;
+    T *copy = arena->create<T>(*node);
+    copy->version = pending;
+    replaced.push_back(node);
+    return copy;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void VersionedBPlusTree<Key, Value, Compare, NodeBytes>::discard(Node *node) {
+    // Nobody has seen a node of the pending version yet, so it can go straight back
+    if (node->version != pending)
+        replaced.push_back(node);
+    else if (node->isLeaf)
+        arena->destroy(static_cast<Leaf *>(node));
+    else
+        arena->destroy(static_cast<Inner *>(node));
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+typename VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Split
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::insertBelow(Node *node, const Key &key, const Value &value,
+                                                                bool &added) {
+    if (node->isLeaf) {
+        Leaf *leaf = static_cast<Leaf *>(node);
+        const int idx = leaf->lowerBound(key);
+        if (idx < leaf->count && !less(key, leaf->keys[idx])) {
+            added = false;
+            if (!memcmp(&leaf->values[idx], &value, sizeof(Value)))
+                return {leaf, Key{}, nullptr};
+            leaf = writable(leaf);
+            leaf->values[idx] = value;
+            return {leaf, Key{}, nullptr};
+        }
+        added = true;
+        leaf = writable(leaf);
+        if (leaf->count < Leaf::capacity) {
+            leaf->insertAt(idx, key, value);
+            return {leaf, Key{}, nullptr};
+        }
+
+        // Full: the upper half moves to a new right sibling
+        const int half = leaf->count / 2;
+        const auto right = arena->create<Leaf>(pending);
+        memcpy(right->keys, leaf->keys + half, (leaf->count - half) * sizeof(Key));
+        memcpy(right->values, leaf->values + half, (leaf->count - half) * sizeof(Value));
+        right->count = leaf->count - half;
+        leaf->count = half;
+        if (idx <= half)
+            leaf->insertAt(idx, key, value);
+        else
+            right->insertAt(idx - half, key, value);
+        return {leaf, right->keys[0], right};
+    }
+
+    const auto inner = static_cast<Inner *>(node);
+    const int idx = inner->childFor(key);
+    const Split below = insertBelow(inner->children[idx], key, value, added);
+    if (below.left == inner->children[idx] && !below.right)
+        return {inner, Key{}, nullptr};
+    Inner *copy = writable(inner);
+    copy->children[idx] = below.left;
+    if (!below.right)
+        return {copy, Key{}, nullptr};
+    if (copy->count < Inner::capacity) {
+        copy->insertAt(idx, below.separator, below.right);
+        return {copy, Key{}, nullptr};
+    }
+
+    // Full: the middle separator moves up, the ones after it to a new right sibling
+    const int mid = copy->count / 2;
+    const Key separator = copy->keys[mid];
+    const auto right = arena->create<Inner>(pending);
+    right->count = copy->count - mid - 1;
+    memcpy(right->keys, copy->keys + mid + 1, right->count * sizeof(Key));
+    memcpy(right->children, copy->children + mid + 1, (right->count + 1) * sizeof(Node *));
+    copy->count = mid;
+    if (idx <= mid)
+        copy->insertAt(idx, below.separator, below.right);
+    else
+        right->insertAt(idx - mid - 1, below.separator, below.right);
+    return {copy, separator, right};
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+typename VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Node *
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::insertInto(Node *top, const Key &key, const Value &value,
+                                                               size_t &size) {
+    if (!top) {
+        const auto leaf = arena->create<Leaf>(pending);
+        leaf->insertAt(0, key, value);
+        size++;
+        return leaf;
+    }
+    bool added = false;
+    const Split split = insertBelow(top, key, value, added);
+    size += added;
+    if (!split.right)
+        return split.left;
+    const auto grown = arena->create<Inner>(pending);
+    grown->children[0] = split.left;
+    grown->insertAt(0, split.separator, split.right);
+    return grown;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void VersionedBPlusTree<Key, Value, Compare, NodeBytes>::mergeChildren(Inner *parent, const int idx) {
+    if (parent->count == 0)
+        return;
+    const int left = idx == parent->count ? idx - 1 : idx;
+    Node *a = parent->children[left];
+    Node *b = parent->children[left + 1];
+    if (a->isLeaf) {
+        if ((a->count >= Leaf::minCount && b->count >= Leaf::minCount) || a->count + b->count > Leaf::capacity)
+            return;
+        Leaf *merged = writable(static_cast<Leaf *>(a));
+        merged->append(static_cast<Leaf *>(b));
+        parent->children[left] = merged;
+    } else {
+        if ((a->count >= Inner::minCount && b->count >= Inner::minCount) || a->count + b->count + 1 > Inner::capacity)
+            return;
+        Inner *merged = writable(static_cast<Inner *>(a));
+        merged->append(parent->keys[left], static_cast<Inner *>(b));
+        parent->children[left] = merged;
+    }
+    discard(b);
+    parent->removeAt(left);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+typename VersionedBPlusTree<Key, Value, Compare, NodeBytes>::Node *
+VersionedBPlusTree<Key, Value, Compare, NodeBytes>::eraseBelow(Node *node, const Key &key, bool &erased) {
+    if (node->isLeaf) {
+        Leaf *leaf = static_cast<Leaf *>(node);
+        const int idx = leaf->lowerBound(key);
+        erased = idx < leaf->count && !less(key, leaf->keys[idx]);
+        if (!erased)
+            return leaf;
+        if (leaf->count == 1) {
+            discard(leaf);
+            return nullptr;
+        }
+        leaf = writable(leaf);
+        leaf->removeAt(idx);
+        return leaf;
+    }
+
+    const auto inner = static_cast<Inner *>(node);
+    const int idx = inner->childFor(key);
+    Node *child = eraseBelow(inner->children[idx], key, erased);
+    if (!erased)
+        return inner;
+    if (!child && inner->count == 0) {
+        discard(inner);
+        return nullptr;
+    }
+    Inner *copy = writable(inner);
+    if (child) {
+        copy->children[idx] = child;
+        mergeChildren(copy, idx);
+    } else if (idx == 0) {
+        // The first child goes together with the separator after it
+        memmove(copy->keys, copy->keys + 1, (copy->count - 1) * sizeof(Key));
+        memmove(copy->children, copy->children + 1, copy->count * sizeof(Node *));
+        copy->count--;
+    } else {
+        copy->removeAt(idx - 1);
+    }
+    return copy;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void VersionedBPlusTree<Key, Value, Compare, NodeBytes>::publish(Node *top, const size_t size) {
+    lock_guard lock(pins);
+    root.store(top, memory_order_release);
+    count.store(size, memory_order_relaxed);
+    current.store(pending, memory_order_relaxed);
+    for (Node *node: replaced)
+        retired.emplace_back(pending, node);
+    replaced.clear();
+    release();
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void VersionedBPlusTree<Key, Value, Compare, NodeBytes>::insert(const Key &key, const Value &value) {
+    const Entry entry(key, value);
+    insertBatch(span(&entry, 1));
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void VersionedBPlusTree<Key, Value, Compare, NodeBytes>::insertBatch(const span<const Entry> entries) {
+    lock_guard lock(writer);
+    pending = current.load(memory_order_relaxed) + 1;
+    Node *const before = root.load(memory_order_relaxed);
+    Node *top = before;
+    size_t size = count.load(memory_order_relaxed);
+    for (const auto &[key, value]: entries)
+        top = insertInto(top, key, value, size);
+    // Any change copies the root, which is never of the pending version
+    if (top != before)
+        publish(top, size);
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+bool VersionedBPlusTree<Key, Value, Compare, NodeBytes>::erase(const Key &key) {
+    lock_guard lock(writer);
+    Node *top = root.load(memory_order_relaxed);
+    if (!top)
+        return false;
+    pending = current.load(memory_order_relaxed) + 1;
+    bool erased = false;
+    top = eraseBelow(top, key, erased);
+    if (!erased)
+        return false;
+    // A root left with a single child makes way for it
+    while (top && !top->isLeaf && top->count == 0) {
+        Node *only = static_cast<Inner *>(top)->children[0];
+        discard(top);
+        top = only;
+    }
+    publish(top, count.load(memory_order_relaxed) - 1);
+    return true;
+}
+
+static vector<size_t> chunkSizes(const size_t count, const size_t perNode) {
+    vector<size_t> sizes((count + perNode - 1) / perNode, perNode);
+    sizes.back() = count - (sizes.size() - 1) * perNode;
+
+    // Share a short tail with its neighbour so no node ends up less than half full
+    if (sizes.size() > 1 && sizes.back() < (perNode + 1) / 2) {
+        const size_t pair = sizes[sizes.size() - 2] + sizes.back();
+        sizes[sizes.size() - 2] = pair - pair / 2;
+        sizes.back() = pair / 2;
+    }
+    return sizes;
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+void VersionedBPlusTree<Key, Value, Compare, NodeBytes>::bulkLoad(const span<const Entry> sorted,
+                                                                  const double fillFactor) {
+    unique_lock lock(writer);
+    if (root.load(memory_order_relaxed)) {
+        lock.unlock();
+        insertBatch(sorted);
+        return;
+    }
+
+    // Equal keys keep their last occurrence
+    vector<Entry> entries;
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (i + 1 == sorted.size() || less(sorted[i].first, sorted[i + 1].first))
+            entries.push_back(sorted[i]);
+    }
+    if (entries.empty())
+        return;
+
+    pending = current.load(memory_order_relaxed) + 1;
+    const int maxChildren = Inner::capacity + 1;
+    const size_t perLeaf = clamp(static_cast<int>(Leaf::capacity * fillFactor), 2, Leaf::capacity);
+    const size_t perInner = clamp(static_cast<int>(maxChildren * fillFactor), 3, maxChildren);
+
+    // Pack the leaves left to right, keeping the lowest key of every node for the level above
+    vector<Node *> level;
+    vector<Key> lowKeys;
+    size_t first = 0;
+    for (const size_t size: chunkSizes(entries.size(), perLeaf)) {
+        const auto leaf = arena->create<Leaf>(pending);
+        for (size_t i = 0; i < size; i++) {
+            leaf->keys[i] = entries[first + i].first;
+            leaf->values[i] = entries[first + i].second;
+        }
+        leaf->count = size;
+        level.push_back(leaf);
+        lowKeys.push_back(entries[first].first);
+        first += size;
+    }
+
+    // Build each inner level from the one below until a single root remains
+    while (level.size() > 1) {
+        vector<Node *> parents;
+        vector<Key> parentLowKeys;
+        first = 0;
+        for (const size_t size: chunkSizes(level.size(), perInner)) {
+            const auto node = arena->create<Inner>(pending);
+            copy_n(level.begin() + first, size, node->children);
+            copy_n(lowKeys.begin() + first + 1, size - 1, node->keys);
+            node->count = size - 1;
+            parents.push_back(node);
+            parentLowKeys.push_back(lowKeys[first]);
+            first += size;
+        }
+        level = std::move(parents);
+        lowKeys = std::move(parentLowKeys);
+    }
+    publish(level[0], entries.size());
+}
+
+template<typename Key, typename Value, typename Compare, size_t NodeBytes>
+IndexStats VersionedBPlusTree<Key, Value, Compare, NodeBytes>::stats() const {
+    EpochManager::Guard guard(*epochs);
+    IndexStats stats;
+    vector<const Node *> level;
+    if (const Node *top = root.load(memory_order_acquire))
+        level.push_back(top);
+    for (size_t depth = 0; !level.empty(); depth++) {
+        vector<const Node *> below;
+        for (const Node *node: level) {
+            if (node->isLeaf) {
+                stats.keys += node->count;
+                stats.addNode(depth, sizeof(Leaf), node->count, Leaf::capacity);
+            } else {
+                const auto inner = static_cast<const Inner *>(node);
+                stats.addNode(depth, sizeof(Inner), inner->count, Inner::capacity);
+                below.insert(below.end(), inner->children, inner->children + inner->count + 1);
+            }
+        }
+        level = std::move(below);
+    }
+    stats.allocatedBytes = arena->mappedBytes();
+    stats.freeBytes = arena->freeBytes();
+    return stats;
+}
+
+template class VersionedBPlusTree<uint32_t, uint32_t>;
+template class VersionedBPlusTree<uint64_t, uint64_t>;
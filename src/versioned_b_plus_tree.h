@@ -0,0 +1,195 @@
+#ifndef VERSIONED_B_PLUS_TREE_H
+#define VERSIONED_B_PLUS_TREE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "epoch.h"
+#include "index_stats.h"
+#include "scan_iterator.h"
+
+// B+ tree that keeps every version a reader may still look at. Writes never change a node that was published: they
+// copy the nodes from the root down to the leaves they touch and then publish the new root with a single atomic store
+// (path copying), so each version is immutable once it is visible. A Snapshot pins the version current when it was
+// taken, and its lookups and scans see exactly the entries of that moment however long they run and whatever is
+// written meanwhile.
+//
+// Writers are serialized by a mutex; query, range and rangeCount read the latest version from any number of threads
+// next to them, without locks or retries. Each insert or erase makes a version of its own and copies about height
+// nodes. insertBatch applies many writes as one version, copying every node at most once, as nodes of a version that
+// is not published yet are changed in place. Leaves have no sibling links, which path copying could not keep up to
+// date, so scans step from leaf to leaf through the path of inner nodes above them.
+//
+// Nodes come from the tree's own arena. A node replaced by version w is only reachable from versions before w: it is
+// handed to the epoch manager once no snapshot of an earlier version is left, which returns it to the arena once no
+// reader of the latest version can still hold it. Snapshots must not outlive their tree. Keys are searched like the
+// nodes of a BPlusTree; instantiated for uint32_t and uint64_t keys with values of the same type.
+template<typename Key = uint32_t, typename Value = uint32_t, typename Compare = std::less<Key>,
+         size_t NodeBytes = 1024>
+class VersionedBPlusTree {
+    class Node;
+    class Leaf;
+    class Inner;
+
+public:
+    using Entry = std::pair<Key, Value>;
+
+    // Forward cursor over the entries of one key range of one version, holding the path of inner nodes to its leaf
+    // instead of allocating. It reads the nodes in place, so it must not outlive the snapshot it came from.
+    class Cursor {
+    public:
+        ScanIterator<Cursor, Entry> begin() { return ScanIterator<Cursor, Entry>(this); }
+        std::default_sentinel_t end() const { return {}; }
+
+        bool done() const { return finished; }
+        const Entry &current() const { return entry; }
+        void advance();
+
+    private:
+        friend class VersionedBPlusTree;
+        // Far more levels than any tree of 64-bit keys reaches with at least two children per inner node
+        static constexpr int maxHeight = 64;
+
+        const Inner *path[maxHeight]; // inner nodes from the root down to the leaf's parent
+        int slots[maxHeight]; // child taken at each of them
+        int depth = 0;
+        const Leaf *leaf = nullptr;
+        int index = 0;
+        Key high;
+        Entry entry;
+        bool finished = false;
+
+        Cursor(const Node *root, const Key &low, const Key &high);
+        // Moves on to the first entry at or after index, finishing past high.
+        void settle();
+        bool nextLeaf();
+        // Number of entries from the current one up to high, which the cursor steps past a leaf at a time.
+        size_t remaining();
+    };
+
+    // A consistent read-only view of the version that was current when it was taken. Any number of threads may read
+    // the same snapshot at once.
+    class Snapshot {
+    public:
+        Snapshot(Snapshot &&other) noexcept;
+        Snapshot &operator=(Snapshot &&other) noexcept;
+        Snapshot(const Snapshot &) = delete;
+        Snapshot &operator=(const Snapshot &) = delete;
+        ~Snapshot();
+
+        Value query(const Key &key) const;
+        std::vector<Entry> range(const Key &low, const Key &high) const;
+        size_t rangeCount(const Key &low, const Key &high) const;
+        // Streams the entries with keys in [low, high] in key order: for (auto [key, value]: snapshot.scan(low, high)).
+        Cursor scan(const Key &low, const Key &high) const { return Cursor(root, low, high); }
+        // Calls fn(key, value) for the entries with keys in [low, high] in key order until fn returns false.
+        template<typename Fn>
+        void scan(const Key &low, const Key &high, Fn &&fn) const {
+            for (const auto &[key, value]: scan(low, high)) {
+                if (!fn(key, value))
+                    return;
+            }
+        }
+        size_t size() const { return count; }
+        uint64_t version() const { return at; }
+
+    private:
+        friend class VersionedBPlusTree;
+        VersionedBPlusTree *tree;
+        const Node *root;
+        uint64_t at;
+        size_t count;
+
+        Snapshot(VersionedBPlusTree *tree, const Node *root, uint64_t version, size_t count);
+    };
+
+    VersionedBPlusTree();
+    // Releases every node at once; no snapshot may be left.
+    ~VersionedBPlusTree() = default;
+    // Snapshots point back at their tree, so it stays where it is
+    VersionedBPlusTree(const VersionedBPlusTree &) = delete;
+    VersionedBPlusTree &operator=(const VersionedBPlusTree &) = delete;
+
+    void insert(const Key &key, const Value &value);
+    // Removes key, returning false if it was not there. A node down to a quarter of its capacity merges with a
+    // neighbour when both fit into one, and a leaf that lost its last key is dropped.
+    bool erase(const Key &key);
+    // Inserts every entry, in any order, as one version: readers see all of them or none.
+    void insertBatch(std::span<const Entry> entries);
+    // Builds the tree bottom-up from entries sorted by key, packing every node to fillFactor of its capacity. Equal
+    // keys keep their last occurrence. A tree that already holds keys gets the entries through insertBatch instead.
+    void bulkLoad(std::span<const Entry> sorted, double fillFactor = 1.0);
+
+    // The value of key in the latest version, or Value{} if it is missing.
+    Value query(const Key &key) const;
+    std::vector<Entry> range(const Key &low, const Key &high) const;
+    size_t rangeCount(const Key &low, const Key &high) const;
+    // Pins the latest version until the snapshot goes away.
+    Snapshot snapshot();
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+    // Number of versions published so far; 0 for a tree that was never written.
+    uint64_t version() const { return current.load(std::memory_order_relaxed); }
+    // Nodes per level, fill, bytes per key and allocator overhead of the latest version. Nodes kept for snapshots
+    // count as overhead.
+    IndexStats stats() const;
+
+private:
+    // Result of a write below a node: the node's version for the pending write, and, if it split, the separator and
+    // the new node to its right.
+    struct Split {
+        Node *left;
+        Key separator;
+        Node *right;
+    };
+
+    std::atomic<Node *> root{nullptr};
+    std::atomic<size_t> count{0};
+    std::atomic<uint64_t> current{0};
+    // Declared before epochs, so nodes still waiting for reclamation outlive the epoch manager
+    std::unique_ptr<Arena> arena;
+    std::unique_ptr<EpochManager> epochs;
+
+    std::mutex writer; // held for a whole write
+    // Only touched with writer held: the version being built and the published nodes it replaced
+    uint64_t pending = 0;
+    std::vector<Node *> replaced;
+
+    std::mutex pins; // guards publishing, pinned and retired
+    std::map<uint64_t, size_t> pinned; // snapshots per version
+    std::deque<std::pair<uint64_t, Node *>> retired; // nodes and the version that replaced them, oldest first
+
+    static Value find(const Node *root, const Key &key);
+    static std::vector<Entry> collect(const Node *root, const Key &low, const Key &high);
+    static size_t countRange(const Node *root, const Key &low, const Key &high);
+
+    // node itself if it belongs to the pending version, otherwise a copy that does, with node marked as replaced.
+    template<typename T>
+    T *writable(T *node);
+    // Drops node from the pending version.
+    void discard(Node *node);
+    Split insertBelow(Node *node, const Key &key, const Value &value, bool &added);
+    // Returns node's pending version, or nullptr if it lost its last key.
+    Node *eraseBelow(Node *node, const Key &key, bool &erased);
+    // Merges the child at idx of parent with a neighbour if one of them is down to minCount and both fit into one.
+    void mergeChildren(Inner *parent, int idx);
+    Node *insertInto(Node *top, const Key &key, const Value &value, size_t &size);
+    // Makes top, holding size keys, the latest version, and hands on the nodes no snapshot can reach any more.
+    void publish(Node *top, size_t size);
+    // Retires the nodes replaced by versions no snapshot is older than. pins must be held.
+    void release();
+    void unpin(uint64_t version);
+    static void reclaim(void *node, void *arena);
+    static bool less(const Key &a, const Key &b) { return Compare{}(a, b); }
+};
+
+#endif // VERSIONED_B_PLUS_TREE_H
@@ -0,0 +1,317 @@
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "workload.h"
+
+using namespace std;
+
+namespace {
+    template<typename T>
+    T parse_number(const string &key, const string &value) {
+        T number{};
+        const auto [end, error] = from_chars(value.data(), value.data() + value.size(), number);
+        if (error != errc() || end != value.data() + value.size())
+            throw invalid_argument("bad value for " + key + ": '" + value + "'");
+        return number;
+    }
+
+    bool parse_bool(const string &key, const string &value) {
+        if (value == "true" || value == "1")
+            return true;
+        if (value == "false" || value == "0")
+            return false;
+        throw invalid_argument("bad value for " + key + ": '" + value + "'");
+    }
+
+    // Just enough JSON for workload files: objects whose values are strings, numbers, booleans or arrays of those.
+    // Arrays come back as their elements joined by commas, the way lists are written on the command line.
+    class JsonReader {
+    public:
+        JsonReader(const string &text, const string &path) : text(text), path(path) {}
+
+        vector<map<string, string>> workloads() {
+            vector<map<string, string>> result;
+            skip_space();
+            if (peek() == '[') {
+                pos++;
+                skip_space();
+                if (peek() == ']') {
+                    pos++;
+                } else {
+                    do {
+                        result.push_back(object());
+                    } while (separator(']'));
+                }
+            } else {
+                result.push_back(object());
+            }
+            skip_space();
+            if (pos != text.size())
+                fail("trailing characters");
+            return result;
+        }
+
+    private:
+        const string &text;
+        const string &path;
+        size_t pos = 0;
+
+        [[noreturn]] void fail(const string &what) const {
+            throw runtime_error(path + ": " + what + " at offset " + to_string(pos));
+        }
+
+        char peek() const { return pos < text.size() ? text[pos] : '\0'; }
+
+        void skip_space() {
+            while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos])))
+                pos++;
+        }
+
+        void expect(const char c) {
+            skip_space();
+            if (peek() != c)
+                fail(string("expected '") + c + "'");
+            pos++;
+        }
+
+        // After an element: true on ',', false on close.
+        bool separator(const char close) {
+            skip_space();
+            if (peek() == ',') {
+                pos++;
+                return true;
+            }
+            expect(close);
+            return false;
+        }
+
+        string scalar() {
+            skip_space();
+            if (peek() == '"') {
+                string value;
+                for (pos++; peek() != '"'; pos++) {
+                    if (pos >= text.size())
+                        fail("unterminated string");
+                    if (text[pos] == '\\')
+                        pos++;
+                    value += peek();
+                }
+                pos++;
+                return value;
+            }
+            const size_t start = pos;
+            while (pos < text.size() && (isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '.' ||
+                                         text[pos] == '-' || text[pos] == '+'))
+                pos++;
+            if (pos == start)
+                fail("expected a value");
+            return text.substr(start, pos - start);
+        }
+
+        string value() {
+            skip_space();
+            if (peek() != '[')
+                return scalar();
+            pos++;
+            string joined;
+            skip_space();
+            if (peek() == ']') {
+                pos++;
+                return joined;
+            }
+            do {
+                joined += (joined.empty() ? "" : ",") + scalar();
+            } while (separator(']'));
+            return joined;
+        }
+
+        map<string, string> object() {
+            map<string, string> fields;
+            expect('{');
+            skip_space();
+            if (peek() == '}') {
+                pos++;
+                return fields;
+            }
+            do {
+                string key = scalar();
+                expect(':');
+                fields[key] = value();
+            } while (separator('}'));
+            return fields;
+        }
+    };
+} // namespace
+
+void WorkloadSpec::set(const string &key, const string &value) {
+    if (key == "name") {
+        name = value;
+    } else if (key == "structure") {
+        structure = value;
+    } else if (key == "size") {
+        size = parse_number<uint32_t>(key, value);
+    } else if (key == "keys") {
+        if (value != "dense" && value != "sparse")
+            throw invalid_argument("keys is dense or sparse, not '" + value + "'");
+        sparse = value == "sparse";
+    } else if (key == "distribution") {
+        distribution = value;
+    } else if (key == "theta") {
+        theta = parse_number<double>(key, value);
+    } else if (key == "skew") {
+        skew = parse_number<double>(key, value);
+    } else if (key == "read") {
+        read = parse_number<int>(key, value);
+    } else if (key == "write") {
+        write = parse_number<int>(key, value);
+    } else if (key == "range") {
+        range = parse_number<int>(key, value);
+    } else if (key == "range_length") {
+        range_length = parse_number<uint32_t>(key, value);
+    } else if (key == "threads") {
+        threads.clear();
+        stringstream list(value);
+        for (string item; getline(list, item, ',');)
+            threads.push_back(parse_number<int>(key, item));
+    } else if (key == "operations") {
+        operations = parse_number<int>(key, value);
+    } else if (key == "runs") {
+        runs = parse_number<int>(key, value);
+    } else if (key == "warmup") {
+        warmup = parse_number<int>(key, value);
+    } else if (key == "pin") {
+        pin = parse_bool(key, value);
+    } else {
+        throw invalid_argument("unknown workload setting '" + key + "'");
+    }
+}
+
+void WorkloadSpec::validate() const {
+    if (structure != "bplus" && structure != "trie" && structure != "sharded_bplus" && structure != "sharded_trie" &&
+        structure != "learned")
+        throw invalid_argument("structure is bplus, trie, sharded_bplus, sharded_trie or learned, not '" + structure +
+                               "'");
+    if (distribution != "uniform" && distribution != "zipf" && distribution != "exponential")
+        throw invalid_argument("distribution is uniform, zipf or exponential, not '" + distribution + "'");
+    if (distribution == "zipf" && !(theta > 0 && theta < 1))
+        throw invalid_argument("theta has to be between 0 and 1");
+    if (distribution == "exponential" && !(skew > 0))
+        throw invalid_argument("skew has to be positive");
+    if (read < 0 || write < 0 || range < 0 || read + write + range != 100)
+        throw invalid_argument("read, write and range have to add up to 100");
+    if (structure == "learned" && write > 0)
+        throw invalid_argument("learned indexes are read-only, so write has to be 0");
+    if (size == 0 || (sparse && size > UINT32_MAX / 2))
+        throw invalid_argument("size out of range");
+    if (range_length == 0)
+        throw invalid_argument("range_length has to be positive");
+    if (threads.empty())
+        throw invalid_argument("no thread counts");
+    for (const int count: threads) {
+        if (count <= 0)
+            throw invalid_argument("thread counts have to be positive");
+        // Trie ranges are not part of its concurrent mode
+        if (count > 1 && write > 0 && range > 0 && (structure == "trie" || structure == "sharded_trie"))
+            throw invalid_argument("trie range queries cannot run alongside writes from other threads");
+    }
+    if (operations <= 0 || runs <= 0 || warmup < 0)
+        throw invalid_argument("operations and runs have to be positive, warmup not negative");
+}
+
+string WorkloadSpec::label() const {
+    if (!name.empty())
+        return name;
+    string label = sparse ? "Sparse " : "Dense ";
+    if (structure.starts_with("sharded_"))
+        label += "Sharded ";
+    label += structure == "learned" ? "Learned Index" : structure.ends_with("bplus") ? "B+ Tree" : "Trie";
+    label += " (" + distribution;
+    if (distribution == "zipf") {
+        ostringstream exponent;
+        exponent << theta;
+        label += " " + exponent.str();
+    }
+    return label + " " + mix() + ")";
+}
+
+string WorkloadSpec::mix() const { return to_string(read) + "/" + to_string(write) + "/" + to_string(range); }
+
+WorkloadSpec parse_workload(const string &text, const WorkloadSpec &defaults) {
+    WorkloadSpec spec = defaults;
+    istringstream fields(text);
+    for (string field; fields >> field;) {
+        const size_t equals = field.find('=');
+        if (equals == string::npos)
+            throw invalid_argument("expected key=value, got '" + field + "'");
+        spec.set(field.substr(0, equals), field.substr(equals + 1));
+    }
+    spec.validate();
+    return spec;
+}
+
+vector<WorkloadSpec> load_workloads(const string &path, const WorkloadSpec &defaults) {
+    ifstream file(path);
+    if (!file)
+        throw runtime_error("cannot read " + path);
+    stringstream contents;
+    contents << file.rdbuf();
+    const string text = contents.str();
+
+    vector<WorkloadSpec> specs;
+    for (const auto &fields: JsonReader(text, path).workloads()) {
+        WorkloadSpec spec = defaults;
+        for (const auto &[key, value]: fields)
+            spec.set(key, value);
+        spec.validate();
+        specs.push_back(spec);
+    }
+    return specs;
+}
+
+OperationGenerator::OperationGenerator(const WorkloadSpec &spec, const uint32_t key_space, const uint64_t seed) :
+    spec(spec), key_space(key_space), rng(seed), uniform(0, key_space - 1), exponential(spec.skew) {
+    if (spec.distribution == "zipf") {
+        for (uint64_t i = 1; i <= key_space; i++)
+            zeta_n += 1 / pow(static_cast<double>(i), spec.theta);
+        const double zeta_2 = 1 + pow(0.5, spec.theta);
+        alpha = 1 / (1 - spec.theta);
+        eta = (1 - pow(2.0 / key_space, 1 - spec.theta)) / (1 - zeta_2 / zeta_n);
+        half_pow_theta = pow(0.5, spec.theta);
+    }
+}
+
+uint32_t OperationGenerator::zipf() {
+    const double u = unit(rng);
+    const double uz = u * zeta_n;
+    uint64_t rank;
+    if (uz < 1)
+        rank = 0;
+    else if (uz < 1 + half_pow_theta)
+        rank = 1;
+    else
+        rank = static_cast<uint64_t>(key_space * pow(eta * u - eta + 1, alpha));
+    // Scatter ranks over the key space; rank 0 stays the hottest key whichever key it lands on
+    uint64_t hash = (rank + 1) * 0x9e3779b97f4a7c15ull;
+    hash ^= hash >> 29;
+    return static_cast<uint32_t>(hash % key_space);
+}
+
+Operation OperationGenerator::operator()() {
+    const int dice = percent(rng);
+    const OperationKind kind = dice < spec.read               ? OperationKind::Read
+                               : dice < spec.read + spec.write ? OperationKind::Write
+                                                               : OperationKind::Range;
+    uint32_t key;
+    if (spec.distribution == "zipf")
+        key = zipf();
+    else if (spec.distribution == "exponential")
+        key = static_cast<uint32_t>(exponential(rng)) % key_space;
+    else
+        key = uniform(rng);
+    return {key, kind};
+}
@@ -0,0 +1,80 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+// One benchmark workload: which structure to build over how many keys, and the mix of operations the threads then run
+// against it with keys drawn from which distribution. Written on the command line as whitespace-separated key=value
+// pairs ("structure=trie distribution=zipf theta=0.99 read=90 write=10 threads=1,8,32") or in a JSON file as an object
+// with the same keys, or an array of such objects. Lists are comma-separated on the command line, JSON arrays in files.
+struct WorkloadSpec {
+    std::string name; // structure column in results.csv; made up from the other fields if empty
+    std::string structure = "bplus"; // bplus, trie, sharded_bplus, sharded_trie or learned (read-only)
+    uint32_t size = 500000; // keys loaded before the operations start
+    bool sparse = false; // keys=sparse: drawn at random from [0, 2 * size) instead of being 0 to size - 1
+    std::string distribution = "uniform"; // of the operation keys: uniform, zipf or exponential
+    double theta = 0.99; // Zipf exponent, in (0, 1)
+    double skew = 0.00001; // rate of the exponential distribution
+    // Shares of the operations in percent, adding up to 100. Writes insert the key with itself as the value, ranges
+    // count the keys in [key, key + range_length).
+    int read = 100;
+    int write = 0;
+    int range = 0;
+    uint32_t range_length = 100;
+    std::vector<int> threads = {1};
+    int operations = 1000000; // per run
+    int runs = 5;
+    int warmup = 1; // untimed runs before the timed ones
+    bool pin = false; // pins thread i of a run to the i-th CPU the process may use
+
+    // Throws std::invalid_argument on an unknown key or a value that does not parse.
+    void set(const std::string &key, const std::string &value);
+    // Throws std::invalid_argument if the fields do not make a workload that can run.
+    void validate() const;
+    std::string label() const;
+    // The operation mix as read/write/range percentages, e.g. "95/5/0", for the query_type column of results.csv.
+    std::string mix() const;
+};
+
+// The workload described by key=value pairs in text, starting from defaults.
+WorkloadSpec parse_workload(const std::string &text, const WorkloadSpec &defaults);
+// The workloads in the JSON file at path, each starting from defaults. Throws std::runtime_error if the file cannot be
+// read or is not JSON, std::invalid_argument for bad workloads.
+std::vector<WorkloadSpec> load_workloads(const std::string &path, const WorkloadSpec &defaults);
+
+enum class OperationKind : uint8_t { Read, Write, Range };
+
+struct Operation {
+    uint32_t key;
+    OperationKind kind;
+};
+
+// Draws the operations of a workload over keys in [0, key_space): kinds in the spec's proportions, keys from its
+// distribution. Zipf ranks are scattered over the key space by a hash, like YCSB's scrambled Zipfian generator, so the
+// hottest keys do not all share a few nodes.
+class OperationGenerator {
+public:
+    OperationGenerator(const WorkloadSpec &spec, uint32_t key_space, uint64_t seed);
+    Operation operator()();
+
+private:
+    const WorkloadSpec &spec;
+    uint32_t key_space;
+    std::mt19937_64 rng;
+    std::uniform_int_distribution<uint32_t> uniform;
+    std::uniform_int_distribution<int> percent{0, 99};
+    std::exponential_distribution<> exponential;
+    std::uniform_real_distribution<> unit{0.0, 1.0};
+    // Gray et al.'s constant-time Zipf sampler, "Quickly generating billion-record synthetic databases"
+    double zeta_n = 0;
+    double alpha = 0;
+    double eta = 0;
+    double half_pow_theta = 0;
+
+    uint32_t zipf();
+};
+
+#endif // WORKLOAD_H
@@ -0,0 +1,114 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <exception>
+#include <system_error>
+
+#include "file_io.h"
+#include "write_ahead_log.h"
+
+using namespace std;
+
+WriteAheadLog::WriteAheadLog(const std::string &path, const size_t groupSize) :
+    path(path), fd(open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644)), groupSize(std::max<size_t>(groupSize, 1)) {
+    if (fd < 0)
+        throw system_error(errno, generic_category(), "open " + path);
+    pending.reserve(this->groupSize);
+    writing.reserve(this->groupSize);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    try {
+        sync();
+    } catch (...) {
+        // Nothing left to report to; whatever did not make it to disk is lost like on a crash
+    }
+    close(fd);
+}
+
+uint32_t WriteAheadLog::checksum(const uint32_t op, const uint32_t key, const uint32_t value) {
+    // Seeded, so the zero-filled tail a crash can leave behind never passes for a record
+    uint64_t hash = 0x9e3779b97f4a7c15ULL;
+    for (const uint64_t word: {uint64_t{op}, uint64_t{key}, uint64_t{value}}) {
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    return static_cast<uint32_t>(hash);
+}
+
+void WriteAheadLog::append(const LogOp op, const uint32_t key, const uint32_t value) {
+    const auto code = static_cast<uint32_t>(op);
+    unique_lock lock(mutex);
+    // Checked here too, as appends that do not fill a group never reach awaitDurable
+    if (failure)
+        rethrow_exception(failure);
+    pending.push_back({code, key, value, checksum(code, key, value)});
+    const uint64_t lsn = ++appended;
+    if (pending.size() >= groupSize)
+        awaitDurable(lock, lsn);
+}
+
+void WriteAheadLog::sync() {
+    unique_lock lock(mutex);
+    awaitDurable(lock, appended);
+}
+
+void WriteAheadLog::awaitDurable(unique_lock<std::mutex> &lock, const uint64_t upTo) {
+    while (durable < upTo) {
+        if (failure)
+            rethrow_exception(failure);
+        if (syncing) {
+            synced.wait(lock);
+            continue;
+        }
+        // Lead the next group: take everything pending, including what others appended while we waited
+        syncing = true;
+        writing.swap(pending);
+        const uint64_t groupEnd = appended;
+        const off_t offset = end;
+        end += writing.size() * sizeof(Record);
+        lock.unlock();
+        try {
+            writeAll(fd, reinterpret_cast<const char *>(writing.data()), writing.size() * sizeof(Record), offset, path);
+            syncData(fd, path);
+        } catch (...) {
+            lock.lock();
+            // The file may now end in a partial group, so nothing appended after it could be replayed
+            failure = current_exception();
+            syncing = false;
+            synced.notify_all();
+            throw;
+        }
+        lock.lock();
+        writing.clear();
+        durable = groupEnd;
+        syncing = false;
+        synced.notify_all();
+    }
+}
+
+size_t WriteAheadLog::replay(const std::string &path, const std::function<void(LogOp, uint32_t, uint32_t)> &apply) {
+    const File file(open(path.c_str(), O_RDONLY));
+    if (file.fd < 0)
+        throw system_error(errno, generic_category(), "open " + path);
+
+    size_t applied = 0;
+    vector<Record> records(4096);
+    for (off_t offset = 0;;) {
+        const size_t bytes = readAll(file.fd, reinterpret_cast<char *>(records.data()), records.size() * sizeof(Record),
+                                     offset, path);
+        offset += bytes;
+        for (size_t i = 0; i < bytes / sizeof(Record); i++) {
+            const Record &record = records[i];
+            const bool known = record.op == static_cast<uint32_t>(LogOp::Insert) ||
+                               record.op == static_cast<uint32_t>(LogOp::Erase);
+            if (!known || record.checksum != checksum(record.op, record.key, record.value))
+                return applied;
+            apply(static_cast<LogOp>(record.op), record.key, record.value);
+            applied++;
+        }
+        if (bytes < records.size() * sizeof(Record))
+            return applied;
+    }
+}
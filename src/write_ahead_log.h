@@ -0,0 +1,68 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class LogOp : uint32_t { Insert = 1, Erase = 2 };
+
+// Append-only log of index operations in one file. Records are fixed-size and checksummed, so replay stops cleanly at
+// a record torn by a crash. Appends are buffered and written out together with a single fdatasync: once groupSize of
+// them are pending, the appender that filled the group writes it and waits for the disk. With groupSize 1 every append
+// is durable before it returns, and appenders arriving while a sync is in flight queue up behind it and are synced
+// together by the next one (group commit). Larger groups trade the last few appends on a crash for throughput.
+// A failed write or sync is reported to every waiting appender and makes the log unusable from then on. Safe to use
+// from several threads.
+class WriteAheadLog {
+public:
+    // Creates the file at path, which must not exist yet.
+    WriteAheadLog(const std::string &path, size_t groupSize = 1);
+    // Writes and syncs whatever is still pending.
+    ~WriteAheadLog();
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    void append(LogOp op, uint32_t key, uint32_t value);
+    // Returns once every earlier append is durable.
+    void sync();
+
+    // Calls apply(op, key, value) for every intact record of the log at path in append order, stopping at the first
+    // torn or corrupt one. Returns the number of records applied.
+    static size_t replay(const std::string &path, const std::function<void(LogOp, uint32_t, uint32_t)> &apply);
+
+private:
+    struct Record {
+        uint32_t op;
+        uint32_t key;
+        uint32_t value;
+        uint32_t checksum;
+    };
+
+    std::string path;
+    int fd;
+    size_t groupSize;
+    off_t end = 0; // file offset of the next write
+
+    std::mutex mutex;
+    std::condition_variable synced;
+    std::vector<Record> pending;
+    std::vector<Record> writing; // swapped with pending by the thread that syncs
+    uint64_t appended = 0; // records handed to append so far
+    uint64_t durable = 0; // records written and synced so far
+    bool syncing = false;
+    std::exception_ptr failure; // set once a write or sync failed; every later append and sync rethrows it
+
+    static uint32_t checksum(uint32_t op, uint32_t key, uint32_t value);
+    // Makes the first upTo records durable, either by syncing them itself or by waiting for the thread that is.
+    void awaitDurable(std::unique_lock<std::mutex> &lock, uint64_t upTo);
+};
+
+#endif // WRITE_AHEAD_LOG_H
@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include "b_plus_tree.h"
+
+// Readers look up keys nobody writes while writers insert and erase the keys between them, which keeps leaves and
+// inner nodes splitting, borrowing and merging under the readers. Every read is checked against the value the key
+// has held all along, and every erase against what its writer knows to be in the tree, so a descent that follows a
+// stale child pointer or a scan that steps into a leaf whose entries just moved shows up as a wrong answer rather
+// than only as a crash.
+
+using Tree = BPlusTree<uint32_t, uint32_t, std::less<uint32_t>, 256>;
+
+const uint32_t stable_keys = 200000; // keys 0, 2, 4, ... that readers look up, valued key + 1
+const int writer_count = 4;
+const int reader_count = 4;
+const int reads_per_reader = 200000;
+const uint32_t range_length = 200;
+const size_t batch_keys = 64;
+// Stable keys of the borrowing test are its multiples, few enough that a leaf runs low while it still has others
+const uint32_t borrow_step = 16;
+const uint32_t borrow_keys = 4000; // keys of each writer's stretch that the borrowing test fills and erases again
+const int scans_per_reader = 3000;
+
+uint32_t stable_value(uint32_t key) { return key + 1; }
+
+// Wrong answers of range, scan and rangeCount over [low, high], which has to hold every stable key in it, in order,
+// whatever other keys come and go around them. Stable keys are the multiples of step up to last; low is one of them.
+long check_range(const Tree &tree, uint32_t low, uint32_t high, uint32_t step = 2,
+                 uint32_t last = 2 * stable_keys - 2) {
+    long failures = 0;
+    const uint32_t expected = (std::min(high, last) - low) / step + 1;
+    uint32_t seen = 0;
+    for (const auto &[k, v]: tree.range(low, high)) {
+        if (k % step == 0 && (k != low + step * seen++ || v != stable_value(k)))
+            failures++;
+    }
+    uint32_t scanned = 0;
+    for (const auto &[k, v]: tree.scan(low, high)) {
+        if (k % step == 0 && (k != low + step * scanned++ || v != stable_value(k)))
+            failures++;
+    }
+    if (seen != expected || scanned != expected || tree.rangeCount(low, high) < expected)
+        failures++;
+    return failures;
+}
+
+// Returns the number of wrong answers.
+long run(bool compress) {
+    Tree tree;
+    tree.setLeafCompression(compress);
+    std::vector<Tree::Entry> entries;
+    for (uint32_t i = 0; i < stable_keys; i++)
+        entries.emplace_back(2 * i, stable_value(2 * i));
+    tree.bulkLoad(entries);
+
+    std::atomic<long> failures{0};
+    std::atomic<int> readers_left{reader_count};
+    // Odd keys each writer has in the tree: writer w owns the odd keys 2 * i + 1 with i % writer_count == w
+    std::vector<std::vector<bool>> present(writer_count, std::vector<bool>(stable_keys / writer_count));
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writer_count; w++) {
+        threads.emplace_back([&, w] {
+            std::mt19937 rng(static_cast<unsigned>(w));
+            std::vector<bool> &mine = present[w];
+            while (readers_left.load(std::memory_order_relaxed) > 0) {
+                const uint32_t slot = rng() % mine.size();
+                const uint32_t key = 2 * (slot * writer_count + w) + 1;
+                if (mine[slot]) {
+                    if (!tree.erase(key))
+                        failures++;
+                } else {
+                    tree.insert(key, key);
+                }
+                mine[slot] = !mine[slot];
+            }
+        });
+    }
+    for (int r = 0; r < reader_count; r++) {
+        threads.emplace_back([&, r] {
+            std::mt19937 rng(static_cast<unsigned>(writer_count + r));
+            auto random_stable = [&] { return 2 * static_cast<uint32_t>(rng() % stable_keys); };
+            std::vector<uint32_t> keys(batch_keys);
+            std::vector<uint32_t> values(batch_keys);
+            for (int i = 0; i < reads_per_reader; i++) {
+                const uint32_t key = random_stable();
+                if (tree.query(key) != stable_value(key))
+                    failures++;
+
+                if (i % 16 == 0) {
+                    for (auto &k: keys)
+                        k = random_stable();
+                    tree.queryBatch(keys, values);
+                    for (size_t j = 0; j < batch_keys; j++) {
+                        if (values[j] != stable_value(keys[j]))
+                            failures++;
+                    }
+                }
+                if (i % 64 == 0)
+                    failures += check_range(tree, key, key + range_length);
+            }
+            readers_left--;
+        });
+    }
+    for (auto &thread: threads)
+        thread.join();
+
+    // What is left has to match what the writers did
+    for (uint32_t i = 0; i < stable_keys; i++) {
+        if (tree.query(2 * i) != stable_value(2 * i))
+            failures++;
+        const bool expected = present[i % writer_count][i / writer_count];
+        if (tree.query(2 * i + 1) != (expected ? 2 * i + 1 : 0))
+            failures++;
+    }
+    return failures;
+}
+
+// Scans next to erases that keep moving entries from a leaf into the one to its left. Only every borrow_step-th key
+// is stable. Each writer inserts the other keys of its own stretch in random order, which leaves its leaves anywhere
+// from half to completely full, then erases them in ascending order: the leftmost leaf of the stretch runs low first,
+// and whenever its right neighbour is too full to merge with it, lends it its lowest entries. Readers scan across the
+// stretches all the while.
+long run_borrows(bool compress) {
+    const uint32_t last = 2 * stable_keys - borrow_step;
+    Tree tree;
+    tree.setLeafCompression(compress);
+    std::vector<Tree::Entry> entries;
+    for (uint32_t key = 0; key <= last; key += borrow_step)
+        entries.emplace_back(key, stable_value(key));
+    tree.bulkLoad(entries);
+
+    std::atomic<long> failures{0};
+    std::atomic<int> readers_left{reader_count};
+    const uint32_t stretch = 2 * stable_keys / writer_count;
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writer_count; w++) {
+        threads.emplace_back([&, w] {
+            std::mt19937 rng(static_cast<unsigned>(w));
+            std::vector<uint32_t> keys;
+            for (uint32_t key = w * stretch; key < w * stretch + borrow_keys; key++) {
+                if (key % borrow_step != 0)
+                    keys.push_back(key);
+            }
+            while (readers_left.load(std::memory_order_relaxed) > 0) {
+                std::shuffle(keys.begin(), keys.end(), rng);
+                for (const uint32_t key: keys)
+                    tree.insert(key, key);
+                std::sort(keys.begin(), keys.end());
+                for (const uint32_t key: keys) {
+                    if (!tree.erase(key))
+                        failures++;
+                }
+            }
+        });
+    }
+    for (int r = 0; r < reader_count; r++) {
+        threads.emplace_back([&, r] {
+            std::mt19937 rng(static_cast<unsigned>(writer_count + r));
+            for (int i = 0; i < scans_per_reader; i++) {
+                // From somewhere in a stretch's busy part to past its end
+                const uint32_t low = (rng() % writer_count) * stretch + rng() % borrow_keys / borrow_step * borrow_step;
+                failures += check_range(tree, low, low + 2 * borrow_keys, borrow_step, last);
+            }
+            readers_left--;
+        });
+    }
+    for (auto &thread: threads)
+        thread.join();
+
+    for (uint32_t key = 0; key <= last + borrow_step; key++) {
+        if (tree.query(key) != (key % borrow_step == 0 && key <= last ? stable_value(key) : 0))
+            failures++;
+    }
+    return failures;
+}
+
+int main() {
+    long total = 0;
+    for (const bool compress: {false, true}) {
+        const char *leaves = compress ? "compressed leaves" : "plain leaves";
+        const long failures = run(compress);
+        std::cout << leaves << ": " << failures << " wrong results\n";
+        const long borrow_failures = run_borrows(compress);
+        std::cout << leaves << ", borrowing: " << borrow_failures << " wrong results\n";
+        total += failures + borrow_failures;
+    }
+    return total == 0 ? 0 : 1;
+}
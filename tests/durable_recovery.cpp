@@ -0,0 +1,133 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include "b_plus_tree.h"
+#include "durable_index.h"
+#include "trie.h"
+
+// Kills a process mid-ingest and checks what a durable index recovers. A child process opens the directory, applies
+// a fixed sequence of inserts and erases, checkpointing every so often, and reports each operation through a pipe
+// once it returned. The parent SIGKILLs it at some point and reopens the directory: the recovered index has to hold
+// exactly the acknowledged operations, plus possibly the one the child was in the middle of. The next round carries
+// on from there in the same directory, so recovery also starts from recovered state and from interrupted checkpoints.
+
+const uint32_t key_space = 5000;
+const uint64_t checkpoint_every = 700;
+// Operations acknowledged before each round's kill. The first and third rounds end on a multiple of checkpoint_every,
+// so the child is killed as it starts a checkpoint.
+const uint64_t kill_after[] = {2800, 1950, 2950, 2600};
+
+struct Operation {
+    bool erase;
+    uint32_t key;
+    uint32_t value;
+};
+
+// Operation number i of the sequence, the same in every process.
+Operation operation(uint64_t i) {
+    uint64_t z = i + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    return {z % 10 < 3, static_cast<uint32_t>((z >> 8) % key_space), static_cast<uint32_t>(i + 1)};
+}
+
+void apply_operation(std::map<uint32_t, uint32_t> &model, const Operation &op) {
+    if (op.erase)
+        model.erase(op.key);
+    else
+        model[op.key] = op.value;
+}
+
+template<typename Index>
+bool matches(DurableIndex<Index> &index, const std::map<uint32_t, uint32_t> &model) {
+    for (uint32_t key = 0; key < key_space; key++) {
+        const auto it = model.find(key);
+        if (index.query(key) != (it == model.end() ? 0 : it->second))
+            return false;
+    }
+    return true;
+}
+
+// Runs the sequence from first on in a child and kills it once it acknowledged kill_at operations, returning how many
+// it acknowledged in the end.
+template<typename Index>
+uint64_t ingest_until_killed(const std::string &directory, uint64_t first, uint64_t kill_at) {
+    int acks[2];
+    if (pipe(acks) != 0) {
+        perror("pipe");
+        exit(2);
+    }
+    const pid_t child = fork();
+    if (child == 0) {
+        close(acks[0]);
+        DurableIndex<Index> index(directory);
+        for (uint64_t i = first;; i++) {
+            const Operation op = operation(i);
+            if (op.erase)
+                index.erase(op.key);
+            else
+                index.insert(op.key, op.value);
+            if (write(acks[1], &i, sizeof(i)) != sizeof(i))
+                _exit(2);
+            if ((i + 1) % checkpoint_every == 0)
+                index.checkpoint();
+        }
+    }
+    close(acks[1]);
+
+    uint64_t acknowledged = 0;
+    uint64_t number;
+    while (acknowledged < kill_at && read(acks[0], &number, sizeof(number)) == sizeof(number))
+        acknowledged++;
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+    // Whatever the child acknowledged before it died is still in the pipe
+    while (read(acks[0], &number, sizeof(number)) == sizeof(number))
+        acknowledged++;
+    close(acks[0]);
+    return acknowledged;
+}
+
+template<typename Index>
+bool run(const std::string &name) {
+    const std::filesystem::path directory =
+            std::filesystem::temp_directory_path() / ("durable_recovery_" + std::to_string(getpid()) + "_" + name);
+    std::filesystem::remove_all(directory);
+
+    std::map<uint32_t, uint32_t> model; // state after the first `done` operations of the sequence
+    uint64_t done = 0;
+    bool ok = true;
+    for (size_t round = 0; round < std::size(kill_after) && ok; round++) {
+        const uint64_t acknowledged = ingest_until_killed<Index>(directory, done, kill_after[round]);
+        for (uint64_t i = done; i < done + acknowledged; i++)
+            apply_operation(model, operation(i));
+        done += acknowledged;
+
+        DurableIndex<Index> index(directory);
+        if (!matches(index, model)) {
+            // The operation the child was in the middle of may have made it to the log as well
+            apply_operation(model, operation(done));
+            done++;
+            ok = matches(index, model);
+        }
+        std::cout << name << " round " << round << ": " << acknowledged << " operations acknowledged, "
+                  << index.recovered() << " replayed from the log, " << (ok ? "recovered" : "NOT recovered") << "\n";
+    }
+    std::filesystem::remove_all(directory);
+    return ok;
+}
+
+int main() {
+    const bool tree = run<BPlusTree<>>("bplus");
+    const bool trie = run<Trie<>>("trie");
+    return tree && trie ? 0 : 1;
+}
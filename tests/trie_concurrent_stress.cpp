@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "trie.h"
+
+// Readers look up keys nobody writes while writers keep inserting keys of their own all over the key space through the
+// trie's concurrent mode, which keeps growing nodes into larger layouts, copying Node4/Node16 and putting new nodes
+// above compressed prefixes under the readers. Writers rewrite all of their keys once per round with the round number,
+// so a reader that sees a value a writer has not written yet, or a stable key with a wrong value or none at all, shows
+// up as a wrong answer rather than only as a crash.
+
+const size_t stable_keys = 100000;
+const int writer_count = 4;
+const size_t keys_per_writer = 25000;
+const int reader_count = 4;
+const int reads_per_reader = 400000;
+
+uint32_t stable_value(uint32_t key) { return (key >> 1) + 1; }
+
+// Returns the number of wrong answers.
+long run() {
+    // Random keys, so they share prefixes of every length and split compressed paths when they go in
+    std::mt19937 rng(42);
+    std::unordered_set<uint32_t> seen;
+    std::vector<uint32_t> stable;
+    std::vector<std::vector<uint32_t>> owned(writer_count);
+    while (stable.size() < stable_keys) {
+        const uint32_t key = rng();
+        if (seen.insert(key).second)
+            stable.push_back(key);
+    }
+    for (auto &keys: owned) {
+        while (keys.size() < keys_per_writer) {
+            const uint32_t key = rng();
+            if (seen.insert(key).second)
+                keys.push_back(key);
+        }
+    }
+
+    Trie<> trie;
+    std::vector<std::pair<uint32_t, uint32_t>> entries;
+    for (const uint32_t key: stable)
+        entries.emplace_back(key, stable_value(key));
+    std::sort(entries.begin(), entries.end());
+    bulk_load(&trie, entries);
+
+    std::atomic<long> failures{0};
+    std::atomic<int> readers_left{reader_count};
+    // The round each writer is in
+    std::vector<std::atomic<uint32_t>> rounds(writer_count);
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writer_count; w++) {
+        threads.emplace_back([&, w] {
+            std::mt19937 order(static_cast<unsigned>(w));
+            std::vector<uint32_t> keys = owned[w];
+            while (readers_left.load(std::memory_order_relaxed) > 0) {
+                const uint32_t round = rounds[w].load(std::memory_order_relaxed) + 1;
+                rounds[w].store(round, std::memory_order_release);
+                std::shuffle(keys.begin(), keys.end(), order);
+                for (const uint32_t key: keys)
+                    insert_concurrent(&trie, key, round);
+            }
+        });
+    }
+    for (int r = 0; r < reader_count; r++) {
+        threads.emplace_back([&, r] {
+            std::mt19937 pick(static_cast<unsigned>(writer_count + r));
+            for (int i = 0; i < reads_per_reader; i++) {
+                const uint32_t key = stable[pick() % stable.size()];
+                if (query_concurrent(&trie, key) != stable_value(key))
+                    failures++;
+
+                // A writer announces a round before writing it and the next one only after it wrote every key, so a
+                // key holds at least the round before the one read first and at most the one read after
+                const int w = static_cast<int>(pick() % writer_count);
+                const uint32_t before = rounds[w].load(std::memory_order_acquire);
+                const uint32_t value = query_concurrent(&trie, owned[w][pick() % keys_per_writer]);
+                if (value + 1 < before || value > rounds[w].load(std::memory_order_acquire))
+                    failures++;
+            }
+            readers_left--;
+        });
+    }
+    for (auto &thread: threads)
+        thread.join();
+
+    // Every writer finished its last round, so each of its keys holds that round's number
+    for (const uint32_t key: stable) {
+        if (query_concurrent(&trie, key) != stable_value(key))
+            failures++;
+    }
+    for (int w = 0; w < writer_count; w++) {
+        for (const uint32_t key: owned[w]) {
+            if (query_concurrent(&trie, key) != rounds[w].load())
+                failures++;
+        }
+    }
+    return failures;
+}
+
+int main() {
+    const long failures = run();
+    std::cout << failures << " wrong results\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+#include "versioned_b_plus_tree.h"
+
+// A writer interleaves inserts and erases on a VersionedBPlusTree and a std::map, growing the tree and then erasing
+// most of it again, so nodes keep splitting, merging and losing their last keys. Every so often it pins a snapshot
+// together with what range and rangeCount returned right then, and keeps checking that they still return exactly that,
+// while a reader thread does the same for the snapshot taken at the start of each phase. The latest version is
+// checked against the map throughout.
+
+using Tree = VersionedBPlusTree<uint32_t, uint32_t>;
+using Snapshot = Tree::Snapshot;
+
+const uint32_t key_space = 20000;
+const int phases = 6; // alternately growing to half of key_space and erasing down to a few keys
+const int writes_per_check = 500;
+const size_t snapshots_kept = 8;
+const uint32_t window = 700; // keys of the ranges checked next to the full one
+
+struct Pinned {
+    Snapshot snapshot;
+    std::map<uint32_t, uint32_t> contents;
+    std::vector<Tree::Entry> full; // range(0, key_space) when it was pinned
+};
+
+// Wrong answers of snapshot against the contents it had when it was pinned.
+long check_snapshot(const Pinned &pinned, std::mt19937 &rng) {
+    long failures = 0;
+    const Snapshot &snapshot = pinned.snapshot;
+    if (snapshot.size() != pinned.contents.size() || snapshot.range(0, key_space) != pinned.full ||
+        snapshot.rangeCount(0, key_space) != pinned.full.size())
+        failures++;
+    const uint32_t low = rng() % key_space;
+    const auto first = pinned.contents.lower_bound(low);
+    const auto last = pinned.contents.upper_bound(low + window);
+    const std::vector<Tree::Entry> expected(first, last);
+    if (snapshot.range(low, low + window) != expected || snapshot.rangeCount(low, low + window) != expected.size())
+        failures++;
+    const uint32_t key = rng() % key_space;
+    const auto found = pinned.contents.find(key);
+    if (snapshot.query(key) != (found == pinned.contents.end() ? 0 : found->second))
+        failures++;
+    return failures;
+}
+
+// Wrong answers of the latest version of tree against contents.
+long check_latest(const Tree &tree, const std::map<uint32_t, uint32_t> &contents, std::mt19937 &rng) {
+    long failures = 0;
+    const std::vector<Tree::Entry> expected(contents.begin(), contents.end());
+    if (tree.size() != contents.size() || tree.range(0, key_space) != expected ||
+        tree.rangeCount(0, key_space) != expected.size())
+        failures++;
+    for (int i = 0; i < 64; i++) {
+        const uint32_t key = rng() % key_space;
+        const auto found = contents.find(key);
+        if (tree.query(key) != (found == contents.end() ? 0 : found->second))
+            failures++;
+    }
+    return failures;
+}
+
+Pinned pin(Tree &tree, const std::map<uint32_t, uint32_t> &contents) {
+    Snapshot snapshot = tree.snapshot();
+    std::vector<Tree::Entry> full = snapshot.range(0, key_space);
+    return {std::move(snapshot), contents, std::move(full)};
+}
+
+// Returns the number of wrong answers.
+long run() {
+    Tree tree;
+    std::map<uint32_t, uint32_t> contents;
+    std::mt19937 rng(1);
+    long failures = 0;
+
+    std::deque<Pinned> pinned;
+    std::atomic<long> reader_failures{0};
+    std::atomic<bool> phase_done{false};
+
+    for (int phase = 0; phase < phases; phase++) {
+        const bool growing = phase % 2 == 0;
+        const size_t target = growing ? key_space / 2 : key_space / 50;
+        // The reader checks the snapshot of the phase's start until the writer is done with it
+        const Pinned watched = pin(tree, contents);
+        phase_done = false;
+        std::thread reader([&, phase] {
+            std::mt19937 reader_rng(static_cast<unsigned>(1000 + phase));
+            do {
+                reader_failures += check_snapshot(watched, reader_rng);
+            } while (!phase_done.load(std::memory_order_relaxed));
+        });
+
+        for (int writes = 1; growing ? contents.size() < target : contents.size() > target; writes++) {
+            // Three in four writes push towards the phase's target size. Erases mostly take the next key that is
+            // there, so the tree shrinks, and sometimes one that is not.
+            uint32_t key = rng() % key_space;
+            if ((rng() % 4 != 0) == growing) {
+                const uint32_t value = rng() | 1;
+                tree.insert(key, value);
+                contents[key] = value;
+            } else {
+                const auto next = contents.lower_bound(key);
+                if (next != contents.end() && rng() % 8 != 0)
+                    key = next->first;
+                if (tree.erase(key) != (contents.erase(key) == 1))
+                    failures++;
+            }
+
+            if (writes % writes_per_check == 0) {
+                failures += check_latest(tree, contents, rng);
+                for (const Pinned &p: pinned)
+                    failures += check_snapshot(p, rng);
+                // Drop the oldest, so the nodes only its version still had get reclaimed
+                if (pinned.size() >= snapshots_kept)
+                    pinned.pop_front();
+                pinned.push_back(pin(tree, contents));
+            }
+        }
+
+        phase_done = true;
+        reader.join();
+        failures += check_latest(tree, contents, rng);
+        failures += check_snapshot(watched, rng);
+        for (const Pinned &p: pinned)
+            failures += check_snapshot(p, rng);
+        pinned.clear();
+    }
+
+    // Erase what is left, down to an empty tree
+    std::vector<uint32_t> keys;
+    for (const auto &entry: contents)
+        keys.push_back(entry.first);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    const Pinned before = pin(tree, contents);
+    for (const uint32_t key: keys) {
+        if (!tree.erase(key))
+            failures++;
+        contents.erase(key);
+    }
+    failures += check_latest(tree, contents, rng);
+    failures += check_snapshot(before, rng);
+    return failures + reader_failures;
+}
+
+int main() {
+    const long failures = run();
+    std::cout << failures << " wrong results\n";
+    return failures == 0 ? 0 : 1;
+}